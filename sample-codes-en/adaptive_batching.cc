@@ -0,0 +1,546 @@
+// Adaptive scan batch size and asynchronous in-flight depth.
+//
+// The scans in scan_tuples.cc and scan_tuples_record.cc always use the
+// default batch size, whatever latency the fetches show. Here a small
+// feedback controller chooses the scan batch size (SO_BATCH) and the number
+// of outstanding asynchronous primary key reads, either to hold the p99
+// latency of a round trip at a target or to maximize throughput.
+//
+// The batch size of a scan is fixed when the scan is defined, so the scan
+// controller decides between scans; the in-flight depth can change at any
+// time and is adjusted after every window of completed reads. Every
+// decision is printed with the measurements it was based on.
+//
+// Usage: adaptive_batching [p99 <target_us> | tput] [rounds]
+#include <NdbApi.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stddef.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+const char *connectstring = "127.0.0.1:1186";
+const char *db = "world";
+
+typedef std::chrono::steady_clock Clock;
+
+static Uint64 elapsed_us(Clock::time_point start)
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+           Clock::now() - start).count();
+}
+
+// Multiplicative increase/decrease controller with a hysteresis band and a
+// bound on the size of each step.
+class AdaptiveController {
+public:
+  enum Mode { TargetP99, MaxThroughput };
+
+  AdaptiveController(const char *name, Mode mode, Uint64 target_p99_us,
+                     Uint32 initial, Uint32 min_value, Uint32 max_value)
+    : name(name), mode(mode), target_p99_us(target_p99_us),
+      value(initial), min_value(min_value), max_value(max_value),
+      max_step(std::max<Uint32>(1, max_value / 4)),
+      band(0.10), patience(2), pending(0), direction(1),
+      ref_tput(0.0), windows(0) {};
+
+  Uint32 get() const { return value; }
+
+  // Feed one window of round trip latencies and the number of rows it
+  // delivered. Returns the value to use for the next window.
+  Uint32 update(std::vector<Uint64> &lat_us, Uint64 rows, Uint64 window_us)
+  {
+    if (lat_us.empty() || window_us == 0)
+      return value;
+
+    windows++;
+    size_t idx = (lat_us.size() * 99) / 100;
+    if (idx >= lat_us.size()) idx = lat_us.size() - 1;
+    std::nth_element(lat_us.begin(), lat_us.begin() + idx, lat_us.end());
+    Uint64 p99 = lat_us[idx];
+    double tput = rows * 1000000.0 / window_us;
+
+    // Which way does this window point? 0 means inside the band.
+    int want = 0;
+    const char *reason = "within band";
+    if (mode == TargetP99) {
+      if (p99 > target_p99_us * (1.0 + band)) {
+        want = -1;
+        reason = "p99 above target";
+      } else if (p99 < target_p99_us * (1.0 - band)) {
+        want = 1;
+        reason = "p99 below target";
+      }
+    } else {
+      // Hill climbing against the throughput measured at the previous
+      // value: keep going while the current value does better, head back
+      // when it does worse. The first window has nothing to compare with
+      // and steps straight away.
+      if (ref_tput == 0.0) {
+        want = direction;
+        reason = "probing";
+      } else if (tput > ref_tput * (1.0 + band)) {
+        want = direction;
+        reason = "throughput improved";
+      } else if (tput < ref_tput * (1.0 - band)) {
+        want = -direction;
+        reason = "throughput dropped";
+      }
+    }
+
+    // Hysteresis: only act once the same direction has been seen in
+    // `patience` consecutive windows. When climbing, a window within the
+    // band says nothing new about the current value and leaves the count
+    // as it is.
+    if (mode == MaxThroughput && ref_tput == 0.0) {
+      pending = want * patience;
+    } else if (want != 0 && want == pending_direction()) {
+      pending += want;
+    } else if (want != 0 || mode == TargetP99) {
+      pending = want;
+    }
+
+    Uint32 old_value = value;
+    if (pending >= patience || pending <= -patience) {
+      Uint32 step = std::min<Uint32>(max_step, std::max<Uint32>(1, value / 2));
+      if (pending > 0)
+        value = std::min<Uint32>(max_value, value + step);
+      else
+        value = std::max<Uint32>(min_value, value > step ? value - step : 0);
+      if (mode == MaxThroughput) {
+        // Compare later windows with what the value just measured
+        // delivered; at a bound that is the bound itself.
+        if (value != old_value)
+          direction = pending > 0 ? 1 : -1;
+        ref_tput = tput;
+      }
+      pending = 0;
+    }
+
+    std::cout << "[" << name << "] window " << windows
+              << ": samples=" << lat_us.size()
+              << " p99=" << p99 << "us"
+              << " tput=" << std::fixed << std::setprecision(0) << tput
+              << " rows/s"
+              << " -> " << old_value;
+    if (value != old_value)
+      std::cout << " => " << value;
+    else
+      std::cout << " (hold)";
+    std::cout << " [" << reason << ", pending " << pending << "]"
+              << std::endl;
+    return value;
+  }
+
+private:
+  int pending_direction() const
+  {
+    return pending > 0 ? 1 : (pending < 0 ? -1 : 0);
+  }
+
+  const char *name;
+  Mode mode;
+  Uint64 target_p99_us;
+  Uint32 value, min_value, max_value, max_step;
+  double band;
+  int patience;
+  int pending;
+  int direction;
+  double ref_tput;
+  Uint32 windows;
+};
+
+class AdaptiveBatchingExample {
+public:
+  AdaptiveBatchingExample(AdaptiveController::Mode mode, Uint64 target_us)
+    : cluster_connection(NULL), myNdb(NULL), myDict(NULL),
+      cityTable(NULL), countryTable(NULL),
+      scanBatch("scan_batch", mode, target_us, 16, 1, 992),
+      asyncDepth("async_depth", mode, target_us, 4, 1, max_depth) {};
+  ~AdaptiveBatchingExample();
+  int doTest(int rounds);
+
+private:
+  static const Uint32 max_depth = 256;
+  static const Uint32 window_reads = 200;
+
+  struct CityRow {
+    Int32 ID;
+    char  Name[35];
+    char  CountryCode[3];
+    char  District[20];
+    Int32 Population;
+  };
+
+  struct CountryRow {
+    char   nullBits;
+    char   Code[3];
+    char   Name[52];
+    Uint32 Capital;
+  };
+
+  // One outstanding asynchronous read
+  struct ReadSlot {
+    AdaptiveBatchingExample *owner;
+    NdbTransaction *trans;
+    CountryRow row;
+    Clock::time_point start;
+    bool done;
+    int result;
+  };
+
+  int define_records();
+  int load_country_codes();
+  int do_scan_read(Uint32 batch, std::vector<Uint64> &lat_us, Uint64 &rows);
+  int do_async_reads(Uint32 count);
+  int start_read(ReadSlot &slot, const char *code);
+  static void read_callback(int result, NdbTransaction *trans, void *arg);
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *cluster_connection;
+  Ndb *myNdb;
+  NdbDictionary::Dictionary* myDict;
+  const NdbDictionary::Table *cityTable, *countryTable;
+  const NdbRecord *cityRecord, *countryPkRecord, *countryRecord;
+  std::vector<std::string> countryCodes;
+  AdaptiveController scanBatch, asyncDepth;
+  std::vector<Uint64> readLatency;
+};
+
+int AdaptiveBatchingExample::doTest(int rounds)
+{
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  // Step 2. Connecting to the cluster
+  cluster_connection = new Ndb_cluster_connection(connectstring);
+  if (cluster_connection->connect(4 /* retries               */,
+                                  5 /* delay between retries */,
+                                  1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (cluster_connection->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+
+  // Step 3. Connect to 'world' database. Every in-flight read needs its
+  // own transaction object.
+  myNdb = new Ndb(cluster_connection, db);
+  if (myNdb->init(max_depth + 4)) {
+    print_error(myNdb->getNdbError(),
+                "Could not connect to the database object.");
+    return 3;
+  }
+
+  // Step 4. Get table metadata and define NdbRecord's
+  int err = 0;
+  if ((err = define_records()) || (err = load_country_codes()))
+    return err;
+
+  // Step 5. Scans: one window per scan, batch size chosen by the controller
+  std::cout << "========== Adaptive scan batch ==========" << std::endl;
+  for (int i = 0; i < rounds; i++) {
+    std::vector<Uint64> lat_us;
+    Uint64 rows = 0;
+    Clock::time_point start = Clock::now();
+    if ((err = do_scan_read(scanBatch.get(), lat_us, rows)))
+      return err;
+    scanBatch.update(lat_us, rows, elapsed_us(start));
+  }
+
+  // Step 6. Asynchronous primary key reads with adaptive in-flight depth
+  std::cout << "========== Adaptive async depth ==========" << std::endl;
+  if ((err = do_async_reads(rounds * window_reads)))
+    return err;
+
+  return 0;
+}
+
+int AdaptiveBatchingExample::define_records()
+{
+  myDict = myNdb->getDictionary();
+  cityTable = myDict->getTable("City");
+  countryTable = myDict->getTable("Country");
+  if (cityTable == NULL || countryTable == NULL) {
+    print_error(myDict->getNdbError(), "Could not retrieve a table.");
+    return 4;
+  }
+
+  NdbDictionary::RecordSpecification citySpec[5];
+  std::memset(citySpec, 0, sizeof citySpec);
+  int rsSize = sizeof(citySpec[0]);
+
+  citySpec[0].column = cityTable->getColumn("ID");
+  citySpec[0].offset = offsetof(struct CityRow, ID);
+  citySpec[1].column = cityTable->getColumn("Name");
+  citySpec[1].offset = offsetof(struct CityRow, Name);
+  citySpec[2].column = cityTable->getColumn("CountryCode");
+  citySpec[2].offset = offsetof(struct CityRow, CountryCode);
+  citySpec[3].column = cityTable->getColumn("District");
+  citySpec[3].offset = offsetof(struct CityRow, District);
+  citySpec[4].column = cityTable->getColumn("Population");
+  citySpec[4].offset = offsetof(struct CityRow, Population);
+
+  NdbDictionary::RecordSpecification countrySpec[3];
+  std::memset(countrySpec, 0, sizeof countrySpec);
+
+  countrySpec[0].column = countryTable->getColumn("Code");
+  countrySpec[0].offset = offsetof(struct CountryRow, Code);
+  countrySpec[1].column = countryTable->getColumn("Name");
+  countrySpec[1].offset = offsetof(struct CountryRow, Name);
+  countrySpec[2].column = countryTable->getColumn("Capital");
+  countrySpec[2].offset = offsetof(struct CountryRow, Capital);
+  countrySpec[2].nullbit_byte_offset = offsetof(struct CountryRow, nullBits);
+  countrySpec[2].nullbit_bit_in_byte = 0;
+
+  cityRecord = myDict->createRecord(cityTable, citySpec, 5, rsSize);
+  countryPkRecord = myDict->createRecord(countryTable, countrySpec, 1, rsSize);
+  countryRecord = myDict->createRecord(countryTable, countrySpec, 3, rsSize);
+  if (cityRecord == NULL || countryPkRecord == NULL || countryRecord == NULL) {
+    print_error(myDict->getNdbError(), "Failed to initialize NdbRecords'.");
+    return 5;
+  }
+  return 0;
+}
+
+int AdaptiveBatchingExample::load_country_codes()
+{
+  // The read workload cycles through all country codes
+  NdbTransaction *myTransaction = myNdb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(myNdb->getNdbError(), "Could not start transaction.");
+    return 6;
+  }
+
+  NdbScanOperation *sop =
+    myTransaction->scanTable(countryPkRecord, NdbOperation::LM_CommittedRead);
+  if (sop == NULL ||
+      myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    myNdb->closeTransaction(myTransaction);
+    return 7;
+  }
+
+  int check;
+  CountryRow *row;
+  while ((check = sop->nextResult((const char**) &row, true, false)) == 0)
+    countryCodes.push_back(std::string(row->Code, 3));
+
+  myNdb->closeTransaction(myTransaction);
+  if (check == -1 || countryCodes.empty()) {
+    std::cerr << "Could not read country codes." << std::endl;
+    return 8;
+  }
+  return 0;
+}
+
+int AdaptiveBatchingExample::do_scan_read(Uint32 batch,
+                                          std::vector<Uint64> &lat_us,
+                                          Uint64 &rows)
+{
+  NdbTransaction *myTransaction = myNdb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(myNdb->getNdbError(), "Could not start transaction.");
+    return 9;
+  }
+
+  NdbScanOperation::ScanOptions options;
+  options.optionsPresent =
+    NdbScanOperation::ScanOptions::SO_SCANFLAGS |
+    NdbScanOperation::ScanOptions::SO_BATCH;
+  options.scan_flags = NdbScanOperation::SF_TupScan;
+  options.batch = batch;
+
+  NdbScanOperation *sop =
+    myTransaction->scanTable(cityRecord,
+                             NdbOperation::LM_CommittedRead,
+                             NULL,
+                             &options,
+                             sizeof(NdbScanOperation::ScanOptions));
+  if (sop == NULL) {
+    print_error(myTransaction->getNdbError(),
+                "Could not retrieve an operation.");
+    myNdb->closeTransaction(myTransaction);
+    return 10;
+  }
+
+  Clock::time_point start = Clock::now();
+  if (myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    myNdb->closeTransaction(myTransaction);
+    return 11;
+  }
+
+  // Each call that is allowed to fetch is one round trip to the data
+  // nodes; its latency is what the controller sees.
+  int check = 0;
+  bool needToFetch = true;
+  CityRow *row;
+  while ((check = sop->nextResult((const char**) &row,
+                                  needToFetch, false)) >= 0) {
+    if (needToFetch) {
+      lat_us.push_back(elapsed_us(start));
+    }
+    if (check == 0) {
+      // Row available
+      needToFetch = false;
+      rows++;
+    } else if (check == 2) {
+      // Need to fetch
+      needToFetch = true;
+      start = Clock::now();
+    } else if (check == 1) {
+      // No more rows
+      break;
+    }
+  }
+
+  if (check == -1) {
+    print_error(myTransaction->getNdbError(), "Error during scan.");
+    myNdb->closeTransaction(myTransaction);
+    return 12;
+  }
+  myTransaction->execute(NdbTransaction::Commit);
+  myNdb->closeTransaction(myTransaction);
+  return 0;
+}
+
+void AdaptiveBatchingExample::read_callback(int result,
+                                            NdbTransaction *trans,
+                                            void *arg)
+{
+  ReadSlot *slot = (ReadSlot*) arg;
+  slot->result = result;
+  slot->done = true;
+  slot->owner->readLatency.push_back(elapsed_us(slot->start));
+  if (result == -1) {
+    slot->owner->print_error(trans->getNdbError(), "Read failed.");
+  }
+}
+
+int AdaptiveBatchingExample::start_read(ReadSlot &slot, const char *code)
+{
+  std::memset(&slot.row, 0, sizeof slot.row);
+  std::memcpy(slot.row.Code, code, 3);
+
+  slot.trans = myNdb->startTransaction(countryTable, code, 3);
+  if (slot.trans == NULL) {
+    print_error(myNdb->getNdbError(), "Could not start transaction.");
+    return 13;
+  }
+
+  const NdbOperation *op =
+    slot.trans->readTuple(countryPkRecord, (char*) &slot.row,
+                          countryRecord, (char*) &slot.row,
+                          NdbOperation::LM_CommittedRead);
+  if (op == NULL) {
+    print_error(slot.trans->getNdbError(), "Could not define a read.");
+    myNdb->closeTransaction(slot.trans);
+    slot.trans = NULL;
+    return 14;
+  }
+
+  slot.done = false;
+  slot.start = Clock::now();
+  slot.trans->executeAsynchPrepare(NdbTransaction::Commit,
+                                   &read_callback, &slot);
+  return 0;
+}
+
+int AdaptiveBatchingExample::do_async_reads(Uint32 count)
+{
+  std::vector<ReadSlot> slots(max_depth);
+  for (Uint32 i = 0; i < max_depth; i++) {
+    slots[i].owner = this;
+    slots[i].trans = NULL;
+  }
+
+  Uint32 issued = 0, completed = 0, active = 0, failed = 0;
+  Uint32 window_done = 0;
+  Clock::time_point window_start = Clock::now();
+
+  while (completed < count) {
+    // Top up to the current depth. The controller may have lowered it, in
+    // which case the extra reads simply drain.
+    for (Uint32 i = 0; i < max_depth && active < asyncDepth.get() &&
+                       issued < count; i++) {
+      if (slots[i].trans != NULL)
+        continue;
+      const std::string &code = countryCodes[issued % countryCodes.size()];
+      if (start_read(slots[i], code.c_str()))
+        return 15;
+      issued++;
+      active++;
+    }
+
+    // Send everything prepared and wait for at least one completion
+    myNdb->sendPollNdb(3000, 1);
+
+    for (Uint32 i = 0; i < max_depth; i++) {
+      if (slots[i].trans == NULL || !slots[i].done)
+        continue;
+      if (slots[i].result == -1)
+        failed++;
+      myNdb->closeTransaction(slots[i].trans);
+      slots[i].trans = NULL;
+      active--;
+      completed++;
+      window_done++;
+    }
+
+    if (window_done >= window_reads) {
+      asyncDepth.update(readLatency, window_done, elapsed_us(window_start));
+      readLatency.clear();
+      window_done = 0;
+      window_start = Clock::now();
+    }
+  }
+
+  std::cout << "Reads: " << completed << ", failed: " << failed
+            << ", final depth: " << asyncDepth.get() << std::endl;
+  return failed ? 16 : 0;
+}
+
+AdaptiveBatchingExample::~AdaptiveBatchingExample()
+{
+  // Step 7. Cleanup
+  if (myNdb) delete myNdb;
+  if (cluster_connection) delete cluster_connection;
+  ndb_end(0);
+}
+
+int main(int argc, char *argv[])
+{
+  AdaptiveController::Mode mode = AdaptiveController::MaxThroughput;
+  Uint64 target_us = 0;
+  int argi = 1;
+  if (argc > argi && std::strcmp(argv[argi], "p99") == 0 && argc > argi + 1) {
+    mode = AdaptiveController::TargetP99;
+    target_us = std::strtoull(argv[argi + 1], NULL, 10);
+    argi += 2;
+  } else if (argc > argi && std::strcmp(argv[argi], "tput") == 0) {
+    argi++;
+  }
+  int rounds = argc > argi ? std::atoi(argv[argi]) : 20;
+  if (rounds <= 0 || (mode == AdaptiveController::TargetP99 && target_us == 0)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [p99 <target_us> | tput] [rounds]" << std::endl;
+    return 1;
+  }
+
+  AdaptiveBatchingExample ex(mode, target_us);
+  return ex.doTest(rounds);
+}
@@ -0,0 +1,541 @@
+// Change stream consumer for City and Country.
+//
+// Subscribes to row changes of City and Country with NdbEventOperation,
+// gathers the changes of each epoch into a batch of before/after images
+// (laid out like the CityRow and CountryRow structs of the NdbRecord
+// samples) and hands the batch to a pool of apply workers. A change is
+// always applied by the worker owning the hash of its primary key, so
+// changes to the same row are applied in commit order while different rows
+// are applied in parallel.
+//
+// Progress is checkpointed as the last epoch applied by every worker,
+// including epochs that carried no changes for City or Country. The
+// event API only delivers changes from the moment of subscription, so a
+// restart resumes by skipping epochs up to the checkpoint; if the first
+// epoch received is newer than the checkpoint, changes may have been
+// missed in between and the downstream copy should be resynchronized with
+// a scan.
+//
+// Run do_scan_update() from scan_tuples_record.cc in another shell to see
+// the JPN -> ZPG rewrites arrive as one epoch batch.
+//
+// Usage: change_stream_consumer [workers] [checkpoint_file]
+#include <NdbApi.hpp>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <csignal>
+#include <stddef.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+const char *connectstring = "127.0.0.1:1186";
+const char *db = "world";
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int)
+{
+  stop_requested = 1;
+}
+
+struct CityRow {
+  Int32 ID;
+  char  Name[35];
+  char  CountryCode[3];
+  char  District[20];
+  Int32 Population;
+};
+
+struct CountryRow {
+  char   nullBits;
+  char   Code[3];
+  char   Name[52];
+  Uint32 Capital;
+};
+
+// One row change. Inserts have no before image, deletes no after image.
+struct RowChange {
+  enum TableId { City, Country } table;
+  NdbDictionary::Event::TableEvent type;
+  Uint64 epoch;
+  union {
+    CityRow city;
+    CountryRow country;
+  } before, after;
+
+  Uint32 key_hash() const
+  {
+    if (table == City)
+      return (Uint32)(after.city.ID ? after.city.ID : before.city.ID);
+    const char *code = type == NdbDictionary::Event::TE_DELETE ?
+                       before.country.Code : after.country.Code;
+    return ((Uint32)(unsigned char) code[0] << 16) |
+           ((Uint32)(unsigned char) code[1] << 8) |
+           (Uint32)(unsigned char) code[2];
+  }
+};
+
+// A worker applies the changes in its queue in order. An entry with
+// is_marker set is not a change but the end of an epoch.
+class ApplyWorker {
+public:
+  typedef std::function<void (const RowChange&)> ApplyFn;
+
+  ApplyWorker(ApplyFn fn) : apply(fn), done_epoch(0), applied(0),
+                            stopping(false),
+                            thread(&ApplyWorker::run, this) {};
+  ~ApplyWorker()
+  {
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      stopping = true;
+    }
+    cond.notify_one();
+    thread.join();
+  }
+
+  void push(const RowChange &c)
+  {
+    Entry e;
+    e.is_marker = false;
+    e.change = c;
+    enqueue(e);
+  }
+
+  void end_epoch(Uint64 epoch)
+  {
+    Entry e;
+    e.is_marker = true;
+    e.change.epoch = epoch;
+    enqueue(e);
+  }
+
+  Uint64 get_done_epoch() const { return done_epoch.load(); }
+  Uint64 get_applied() const { return applied.load(); }
+
+private:
+  struct Entry {
+    bool is_marker;
+    RowChange change;
+  };
+
+  void enqueue(const Entry &e)
+  {
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      queue.push_back(e);
+    }
+    cond.notify_one();
+  }
+
+  void run()
+  {
+    for (;;) {
+      Entry e;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (queue.empty() && !stopping)
+          cond.wait(lock);
+        if (queue.empty())
+          return;
+        e = queue.front();
+        queue.pop_front();
+      }
+      if (e.is_marker) {
+        done_epoch.store(e.change.epoch);
+      } else {
+        apply(e.change);
+        applied++;
+      }
+    }
+  }
+
+  ApplyFn apply;
+  std::atomic<Uint64> done_epoch;
+  std::atomic<Uint64> applied;
+  bool stopping;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::deque<Entry> queue;
+  std::thread thread;
+};
+
+class ChangeStreamConsumer {
+public:
+  ChangeStreamConsumer() : cluster_connection(NULL), myNdb(NULL),
+                           myDict(NULL), cityOp(NULL), countryOp(NULL),
+                           resume_epoch(0) {};
+  ~ChangeStreamConsumer();
+  int doTest(int nworkers, const char *checkpoint_file);
+
+private:
+  static const int cityCols = 5;
+  static const int countryCols = 3;
+
+  int create_event(const char *event_name, const char *table_name,
+                   const char **columns, int ncolumns);
+  NdbEventOperation *subscribe(const char *event_name,
+                               const char **columns, int ncolumns,
+                               NdbRecAttr **after, NdbRecAttr **before);
+  void copy_city(NdbRecAttr **attrs, CityRow &row);
+  void copy_country(NdbRecAttr **attrs, CountryRow &row);
+  void dispatch(std::vector<RowChange> &batch, Uint64 epoch);
+  void write_checkpoint(const char *checkpoint_file);
+  Uint64 applied_epoch();
+  static void apply_change(const RowChange &c);
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *cluster_connection;
+  Ndb *myNdb;
+  NdbDictionary::Dictionary* myDict;
+  NdbEventOperation *cityOp, *countryOp;
+  NdbRecAttr *cityAfter[cityCols], *cityBefore[cityCols];
+  NdbRecAttr *countryAfter[countryCols], *countryBefore[countryCols];
+  std::vector<ApplyWorker*> workers;
+  Uint64 resume_epoch;
+};
+
+static const char *cityColumns[] =
+  { "ID", "Name", "CountryCode", "District", "Population" };
+static const char *countryColumns[] = { "Code", "Name", "Capital" };
+
+int ChangeStreamConsumer::doTest(int nworkers, const char *checkpoint_file)
+{
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  // Step 2. Connecting to the cluster
+  cluster_connection = new Ndb_cluster_connection(connectstring);
+  if (cluster_connection->connect(4 /* retries               */,
+                                  5 /* delay between retries */,
+                                  1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (cluster_connection->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+
+  // Step 3. Connect to 'world' database
+  myNdb = new Ndb(cluster_connection, db);
+  if (myNdb->init()) {
+    print_error(myNdb->getNdbError(),
+                "Could not connect to the database object.");
+    return 3;
+  }
+  myDict = myNdb->getDictionary();
+
+  // Step 4. Read the resume position
+  if (checkpoint_file != NULL) {
+    std::ifstream in(checkpoint_file);
+    if (in >> resume_epoch)
+      std::cout << "Resuming after epoch " << (resume_epoch >> 32) << "/"
+                << (resume_epoch & 0xFFFFFFFF) << std::endl;
+  }
+
+  // Step 5. Define the events and subscribe
+  int err = 0;
+  if ((err = create_event("world_city_changes", "City",
+                          cityColumns, cityCols)) ||
+      (err = create_event("world_country_changes", "Country",
+                          countryColumns, countryCols)))
+    return err;
+
+  cityOp = subscribe("world_city_changes", cityColumns, cityCols,
+                     cityAfter, cityBefore);
+  countryOp = subscribe("world_country_changes", countryColumns, countryCols,
+                        countryAfter, countryBefore);
+  if (cityOp == NULL || countryOp == NULL)
+    return 6;
+
+  // Step 6. Start the apply workers
+  for (int i = 0; i < nworkers; i++)
+    workers.push_back(new ApplyWorker(&ChangeStreamConsumer::apply_change));
+
+  // Step 7. Main loop: collect each epoch into a batch and dispatch it
+  std::vector<RowChange> batch;
+  Uint64 batch_epoch = 0, first_epoch = 0, last_applied = 0;
+  Uint64 last_dispatched = 0;
+  std::chrono::steady_clock::time_point last_report =
+    std::chrono::steady_clock::now();
+
+  while (!stop_requested) {
+    Uint64 highest_queued = 0;
+    int res = myNdb->pollEvents(1000, &highest_queued);
+    if (res < 0) {
+      print_error(myNdb->getNdbError(), "Failed to poll events.");
+      return 7;
+    }
+
+    NdbEventOperation *op;
+    while ((op = myNdb->nextEvent()) != NULL) {
+      Uint64 epoch = op->getGCI();
+      if (first_epoch == 0) {
+        first_epoch = epoch;
+        if (resume_epoch != 0 && epoch > resume_epoch + (1ULL << 32))
+          std::cerr << "Warning: first epoch received is newer than the "
+                    << "checkpoint; changes in between may have been "
+                    << "missed." << std::endl;
+      }
+
+      // Events arrive epoch by epoch; a new epoch closes the previous batch
+      if (epoch != batch_epoch) {
+        if (batch_epoch != 0)
+          dispatch(batch, batch_epoch);
+        batch_epoch = epoch;
+      }
+      if (epoch <= resume_epoch)
+        continue;
+
+      NdbDictionary::Event::TableEvent type = op->getEventType();
+      if (type != NdbDictionary::Event::TE_INSERT &&
+          type != NdbDictionary::Event::TE_UPDATE &&
+          type != NdbDictionary::Event::TE_DELETE) {
+        if (type == NdbDictionary::Event::TE_DROP ||
+            type == NdbDictionary::Event::TE_CLUSTER_FAILURE) {
+          std::cerr << "Subscription lost (event type " << type << ")."
+                    << std::endl;
+          stop_requested = 1;
+        }
+        continue;
+      }
+
+      RowChange c;
+      std::memset(&c, 0, sizeof c);
+      c.type = type;
+      c.epoch = epoch;
+      if (op == cityOp) {
+        c.table = RowChange::City;
+        if (type != NdbDictionary::Event::TE_INSERT)
+          copy_city(cityBefore, c.before.city);
+        if (type != NdbDictionary::Event::TE_DELETE)
+          copy_city(cityAfter, c.after.city);
+      } else {
+        c.table = RowChange::Country;
+        if (type != NdbDictionary::Event::TE_INSERT)
+          copy_country(countryBefore, c.before.country);
+        if (type != NdbDictionary::Event::TE_DELETE)
+          copy_country(countryAfter, c.after.country);
+      }
+      batch.push_back(c);
+    }
+
+    // Everything returned by nextEvent() belongs to complete epochs
+    if (batch_epoch != 0) {
+      dispatch(batch, batch_epoch);
+      last_dispatched = batch_epoch;
+      batch_epoch = 0;
+    }
+
+    // Epochs without changes are never delivered. Once the queue has
+    // drained, everything up to the highest epoch pollEvents() reported
+    // has been seen, so move the applied position up to it; otherwise an
+    // idle consumer would report a growing lag.
+    if (highest_queued > last_dispatched) {
+      dispatch(batch, highest_queued);
+      last_dispatched = highest_queued;
+    }
+
+    // Step 8. Report lag and throughput once a second
+    std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(now - last_report).count();
+    if (secs >= 1.0) {
+      Uint64 applied = 0;
+      for (size_t i = 0; i < workers.size(); i++)
+        applied += workers[i]->get_applied();
+      Uint64 done = applied_epoch();
+      Uint64 latest = myNdb->getLatestGCI();
+      std::cout << "applied epoch " << (done >> 32)
+                << ", lag " << (latest > done && done ? (latest - done) >> 32 : 0)
+                << " GCIs, " << (Uint64) ((applied - last_applied) / secs)
+                << " changes/s" << std::endl;
+      last_applied = applied;
+      last_report = now;
+      write_checkpoint(checkpoint_file);
+    }
+  }
+
+  // Step 9. Drain the workers and save the final position
+  for (size_t i = 0; i < workers.size(); i++)
+    delete workers[i];
+  workers.clear();
+  write_checkpoint(checkpoint_file);
+  return 0;
+}
+
+int ChangeStreamConsumer::create_event(const char *event_name,
+                                       const char *table_name,
+                                       const char **columns, int ncolumns)
+{
+  const NdbDictionary::Table *table = myDict->getTable(table_name);
+  if (table == NULL) {
+    print_error(myDict->getNdbError(), "Could not retrieve a table.");
+    return 4;
+  }
+
+  // Report all subscribed columns on update, so that both images are
+  // complete rows
+  NdbDictionary::Event myEvent(event_name, *table);
+  myEvent.addTableEvent(NdbDictionary::Event::TE_ALL);
+  myEvent.addEventColumns(ncolumns, columns);
+  myEvent.setReport(NdbDictionary::Event::ER_ALL);
+
+  // 746: event already exists, e.g. from a previous run
+  if (myDict->createEvent(myEvent) != 0 &&
+      myDict->getNdbError().code != 746) {
+    print_error(myDict->getNdbError(), "Could not create an event.");
+    return 5;
+  }
+  return 0;
+}
+
+NdbEventOperation *ChangeStreamConsumer::subscribe(const char *event_name,
+                                                   const char **columns,
+                                                   int ncolumns,
+                                                   NdbRecAttr **after,
+                                                   NdbRecAttr **before)
+{
+  NdbEventOperation *op = myNdb->createEventOperation(event_name);
+  if (op == NULL) {
+    print_error(myNdb->getNdbError(), "Could not create an event operation.");
+    return NULL;
+  }
+
+  for (int i = 0; i < ncolumns; i++) {
+    after[i] = op->getValue(columns[i]);
+    before[i] = op->getPreValue(columns[i]);
+  }
+
+  if (op->execute() != 0) {
+    print_error(op->getNdbError(), "Could not subscribe.");
+    myNdb->dropEventOperation(op);
+    return NULL;
+  }
+  return op;
+}
+
+void ChangeStreamConsumer::copy_city(NdbRecAttr **attrs, CityRow &row)
+{
+  row.ID = attrs[0]->int32_value();
+  std::memcpy(row.Name, attrs[1]->aRef(), sizeof(row.Name));
+  std::memcpy(row.CountryCode, attrs[2]->aRef(), sizeof(row.CountryCode));
+  std::memcpy(row.District, attrs[3]->aRef(), sizeof(row.District));
+  row.Population = attrs[4]->int32_value();
+}
+
+void ChangeStreamConsumer::copy_country(NdbRecAttr **attrs, CountryRow &row)
+{
+  std::memcpy(row.Code, attrs[0]->aRef(), sizeof(row.Code));
+  std::memcpy(row.Name, attrs[1]->aRef(), sizeof(row.Name));
+  if (attrs[2]->isNULL() == 1) {
+    row.nullBits |= 0x01;
+  } else {
+    row.Capital = attrs[2]->u_32_value();
+  }
+}
+
+void ChangeStreamConsumer::dispatch(std::vector<RowChange> &batch,
+                                    Uint64 epoch)
+{
+  for (size_t i = 0; i < batch.size(); i++)
+    workers[batch[i].key_hash() % workers.size()]->push(batch[i]);
+
+  // Every worker gets the end-of-epoch marker, also if it had no changes
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i]->end_epoch(epoch);
+  batch.clear();
+}
+
+Uint64 ChangeStreamConsumer::applied_epoch()
+{
+  // An epoch is applied once every worker has passed its marker
+  Uint64 done = ~(Uint64) 0;
+  for (size_t i = 0; i < workers.size(); i++) {
+    Uint64 e = workers[i]->get_done_epoch();
+    if (e < done) done = e;
+  }
+  if (done == ~(Uint64) 0 || done < resume_epoch)
+    done = resume_epoch;
+  return done;
+}
+
+void ChangeStreamConsumer::write_checkpoint(const char *checkpoint_file)
+{
+  if (checkpoint_file == NULL)
+    return;
+  Uint64 done = applied_epoch();
+  if (done == 0)
+    return;
+  std::ofstream out(checkpoint_file, std::ios::out | std::ios::trunc);
+  out << done << std::endl;
+}
+
+void ChangeStreamConsumer::apply_change(const RowChange &c)
+{
+  // Stand-in for the downstream system: print the change
+  static std::mutex print_mutex;
+  std::lock_guard<std::mutex> guard(print_mutex);
+  const char *type = c.type == NdbDictionary::Event::TE_INSERT ? "INSERT" :
+                     c.type == NdbDictionary::Event::TE_DELETE ? "DELETE" :
+                                                                 "UPDATE";
+  if (c.table == RowChange::City) {
+    const CityRow &r = c.type == NdbDictionary::Event::TE_DELETE ?
+                       c.before.city : c.after.city;
+    std::cout << type << " City " << r.ID << ": CountryCode "
+              << std::string(c.before.city.CountryCode, 3) << " -> "
+              << std::string(c.after.city.CountryCode, 3)
+              << ", Population " << c.before.city.Population << " -> "
+              << c.after.city.Population << std::endl;
+  } else {
+    const CountryRow &r = c.type == NdbDictionary::Event::TE_DELETE ?
+                          c.before.country : c.after.country;
+    std::cout << type << " Country " << std::string(r.Code, 3) << std::endl;
+  }
+}
+
+ChangeStreamConsumer::~ChangeStreamConsumer()
+{
+  // Step 10. Cleanup
+  for (size_t i = 0; i < workers.size(); i++)
+    delete workers[i];
+  if (cityOp) myNdb->dropEventOperation(cityOp);
+  if (countryOp) myNdb->dropEventOperation(countryOp);
+  if (myNdb) delete myNdb;
+  if (cluster_connection) delete cluster_connection;
+  ndb_end(0);
+}
+
+int main(int argc, char *argv[])
+{
+  int nworkers = argc > 1 ? std::atoi(argv[1]) : 4;
+  const char *checkpoint_file = argc > 2 ? argv[2] : NULL;
+  if (nworkers <= 0) {
+    std::cerr << "Usage: " << argv[0]
+              << " [workers] [checkpoint_file]" << std::endl;
+    return 1;
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  ChangeStreamConsumer consumer;
+  return consumer.doTest(nworkers, checkpoint_file);
+}
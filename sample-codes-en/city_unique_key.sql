@@ -0,0 +1,6 @@
+-- Adds the unique key used by unique_index_lookup.cc. USING HASH makes
+-- NDB create only the unique hash index (name_district$unique in the NDB
+-- dictionary) and no ordered index next to it.
+-- Fails if two cities share Name, CountryCode and District.
+ALTER TABLE City
+  ADD UNIQUE KEY name_district (Name, CountryCode, District) USING HASH;
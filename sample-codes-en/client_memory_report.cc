@@ -0,0 +1,556 @@
+// Client memory accounting.
+//
+// The NDB API keeps released transactions, operations and NdbRecAttr's on
+// per-Ndb free lists, NdbRecord's live until releaseRecord(), and every
+// open scan holds receive buffers for its batches. None of this shows in
+// the samples, so a process that grows over hours gives no hint where.
+//
+// ClientMemoryTracker collects three things:
+//  - per Ndb free list usage (Ndb::get_free_list_usage()), sampled by the
+//    thread that owns the Ndb since Ndb objects are not thread safe
+//  - NdbRecord's per table, sized from getRecordRowLength() and the
+//    number of columns
+//  - bytes held by scans in flight, registered by the code running them
+// A report, as text or one JSON object per line, shows current values and
+// high-water marks and names the free lists that grew in each of the last
+// few reports.
+//
+// The workload reads Country by primary key with getValue() in one thread
+// and scans City with NdbRecord in another. With leak=1 the reader forgets
+// to close every 50th transaction, up to 1000 of them, which the report
+// points out.
+//
+// Usage: client_memory_report [key=value ...]
+//   seconds=20      duration
+//   interval=2      seconds between reports
+//   format=text     text or json
+//   leak=0          1 to leak transactions on purpose
+#include <NdbApi.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <stddef.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+const char *connectstring = "127.0.0.1:1186";
+const char *db = "world";
+
+typedef std::chrono::steady_clock Clock;
+
+class ClientMemoryTracker {
+public:
+  ClientMemoryTracker() : start(Clock::now()) {};
+
+  // Reads the free lists of `ndb`; call from the thread using it
+  void update_ndb(const std::string &name, Ndb *ndb);
+
+  void add_record(const char *table, const NdbRecord *record,
+                  Uint32 columns);
+  void release_record(const NdbRecord *record);
+
+  // Receive buffers of a scan: a batch of rows per fragment scanned
+  static Uint64 scan_bytes(const NdbRecord *record, Uint32 batch,
+                           Uint32 fragments)
+  {
+    return (Uint64) NdbDictionary::getRecordRowLength(record) *
+           batch * fragments;
+  }
+  void scan_started(const void *scan, Uint64 bytes);
+  void scan_finished(const void *scan);
+
+  enum Format { Text, Json };
+  void report(std::ostream &out, Format format);
+
+private:
+  struct FreeList {
+    Uint32 created;
+    Uint32 free;
+    Uint32 size;
+  };
+
+  struct RecordInfo {
+    std::string table;
+    Uint64 bytes;
+  };
+
+  // Size of an NdbRecord object, which the API does not expose: a fixed
+  // part plus one attribute descriptor per column
+  static const Uint32 record_base_bytes = 128;
+  static const Uint32 record_column_bytes = 48;
+
+  // Reports in which a free list must grow to be reported as growing
+  static const size_t growth_reports = 3;
+
+  Uint64 high(const std::string &key, Uint64 value)
+  {
+    Uint64 &h = highWater[key];
+    h = std::max(h, value);
+    return h;
+  }
+
+  std::string json_str(const std::string &s)
+  {
+    return "\"" + s + "\"";
+  }
+
+  std::mutex mutex;
+  Clock::time_point start;
+
+  // "ndb/list" -> latest sample
+  std::map<std::string, FreeList> freeLists;
+  std::map<const NdbRecord*, RecordInfo> records;
+  std::map<const void*, Uint64> scans;
+  std::map<std::string, Uint64> highWater;
+  // "ndb/list" -> m_created of the last reports
+  std::map<std::string, std::deque<Uint32> > history;
+};
+
+void ClientMemoryTracker::update_ndb(const std::string &name, Ndb *ndb)
+{
+  std::vector<std::pair<std::string, FreeList> > lists;
+  Ndb::Free_list_usage usage;
+  usage.m_name = NULL;
+  while (ndb->get_free_list_usage(&usage) != NULL) {
+    FreeList fl = { usage.m_created, usage.m_free, usage.m_sizeof };
+    lists.push_back(std::make_pair(name + "/" + usage.m_name, fl));
+  }
+
+  std::lock_guard<std::mutex> guard(mutex);
+  for (size_t i = 0; i < lists.size(); i++)
+    freeLists[lists[i].first] = lists[i].second;
+}
+
+void ClientMemoryTracker::add_record(const char *table,
+                                     const NdbRecord *record,
+                                     Uint32 columns)
+{
+  RecordInfo info;
+  info.table = table;
+  info.bytes = record_base_bytes + columns * record_column_bytes +
+               NdbDictionary::getRecordRowLength(record);
+  std::lock_guard<std::mutex> guard(mutex);
+  records[record] = info;
+}
+
+void ClientMemoryTracker::release_record(const NdbRecord *record)
+{
+  std::lock_guard<std::mutex> guard(mutex);
+  records.erase(record);
+}
+
+void ClientMemoryTracker::scan_started(const void *scan, Uint64 bytes)
+{
+  std::lock_guard<std::mutex> guard(mutex);
+  scans[scan] = bytes;
+  Uint64 total = 0;
+  for (std::map<const void*, Uint64>::const_iterator it = scans.begin();
+       it != scans.end(); ++it)
+    total += it->second;
+  high("scans", total);   // peaks between reports count too
+}
+
+void ClientMemoryTracker::scan_finished(const void *scan)
+{
+  std::lock_guard<std::mutex> guard(mutex);
+  scans.erase(scan);
+}
+
+void ClientMemoryTracker::report(std::ostream &out, Format format)
+{
+  std::lock_guard<std::mutex> guard(mutex);
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  // Free lists, and which of them grew in each of the last reports
+  std::vector<std::string> growing;
+  Uint64 freeListBytes = 0;
+  for (std::map<std::string, FreeList>::const_iterator it =
+         freeLists.begin(); it != freeLists.end(); ++it) {
+    std::deque<Uint32> &h = history[it->first];
+    h.push_back(it->second.created);
+    if (h.size() > growth_reports + 1)
+      h.pop_front();
+    bool grew = h.size() == growth_reports + 1;
+    for (size_t i = 1; grew && i < h.size(); i++)
+      grew = h[i] > h[i - 1];
+    if (grew)
+      growing.push_back(it->first);
+    freeListBytes += (Uint64) it->second.created * it->second.size;
+  }
+
+  std::map<std::string, std::pair<Uint32, Uint64> > perTable;
+  Uint64 recordBytes = 0;
+  for (std::map<const NdbRecord*, RecordInfo>::const_iterator it =
+         records.begin(); it != records.end(); ++it) {
+    perTable[it->second.table].first++;
+    perTable[it->second.table].second += it->second.bytes;
+    recordBytes += it->second.bytes;
+  }
+
+  Uint64 scanBytes = 0;
+  for (std::map<const void*, Uint64>::const_iterator it = scans.begin();
+       it != scans.end(); ++it)
+    scanBytes += it->second;
+
+  if (format == Text) {
+    out << "========== Client memory at " << std::fixed
+        << std::setprecision(1) << seconds << " s ==========" << std::endl;
+    out << std::left << std::setw(32) << "free list" << std::right
+        << std::setw(9) << "created" << std::setw(9) << "free"
+        << std::setw(11) << "bytes" << std::setw(11) << "high"
+        << std::endl;
+    for (std::map<std::string, FreeList>::const_iterator it =
+           freeLists.begin(); it != freeLists.end(); ++it) {
+      Uint64 bytes = (Uint64) it->second.created * it->second.size;
+      out << std::left << std::setw(32) << it->first << std::right
+          << std::setw(9) << it->second.created
+          << std::setw(9) << it->second.free
+          << std::setw(11) << bytes
+          << std::setw(11) << high("list/" + it->first, bytes)
+          << std::endl;
+    }
+    for (std::map<std::string, std::pair<Uint32, Uint64> >::const_iterator
+           it = perTable.begin(); it != perTable.end(); ++it) {
+      out << "NdbRecord's of " << it->first << ": " << it->second.first
+          << ", " << it->second.second << " bytes (high "
+          << high("records/" + it->first, it->second.second) << ")"
+          << std::endl;
+    }
+    out << "Scans in flight: " << scans.size() << ", " << scanBytes
+        << " bytes (high " << high("scans", scanBytes) << ")" << std::endl;
+    out << "Total: " << freeListBytes + recordBytes + scanBytes
+        << " bytes (high "
+        << high("total", freeListBytes + recordBytes + scanBytes) << ")"
+        << std::endl;
+    for (size_t i = 0; i < growing.size(); i++)
+      out << "WARNING: " << growing[i] << " grew in each of the last "
+          << growth_reports << " reports" << std::endl;
+    return;
+  }
+
+  out << "{\"seconds\":" << std::fixed << std::setprecision(3) << seconds
+      << ",\"free_lists\":[";
+  const char *sep = "";
+  for (std::map<std::string, FreeList>::const_iterator it =
+         freeLists.begin(); it != freeLists.end(); ++it) {
+    Uint64 bytes = (Uint64) it->second.created * it->second.size;
+    out << sep << "{\"name\":" << json_str(it->first)
+        << ",\"created\":" << it->second.created
+        << ",\"free\":" << it->second.free
+        << ",\"sizeof\":" << it->second.size
+        << ",\"bytes\":" << bytes
+        << ",\"high\":" << high("list/" + it->first, bytes) << "}";
+    sep = ",";
+  }
+  out << "],\"records\":[";
+  sep = "";
+  for (std::map<std::string, std::pair<Uint32, Uint64> >::const_iterator
+         it = perTable.begin(); it != perTable.end(); ++it) {
+    out << sep << "{\"table\":" << json_str(it->first)
+        << ",\"count\":" << it->second.first
+        << ",\"bytes\":" << it->second.second
+        << ",\"high\":" << high("records/" + it->first, it->second.second)
+        << "}";
+    sep = ",";
+  }
+  out << "],\"scans\":{\"count\":" << scans.size()
+      << ",\"bytes\":" << scanBytes
+      << ",\"high\":" << high("scans", scanBytes) << "}"
+      << ",\"total\":{\"bytes\":" << freeListBytes + recordBytes + scanBytes
+      << ",\"high\":"
+      << high("total", freeListBytes + recordBytes + scanBytes) << "}"
+      << ",\"growing\":[";
+  for (size_t i = 0; i < growing.size(); i++)
+    out << (i ? "," : "") << json_str(growing[i]);
+  out << "]}" << std::endl;
+}
+
+struct Options {
+  int seconds;
+  int interval;
+  ClientMemoryTracker::Format format;
+  bool leak;
+};
+
+class ClientMemoryExample {
+public:
+  ClientMemoryExample() : cluster_connection(NULL), readerNdb(NULL),
+                          scanNdb(NULL), stop(false) {};
+  ~ClientMemoryExample();
+  int doTest(const Options &opts);
+
+private:
+  struct CityRow {
+    Int32 ID;
+    char  Name[35];
+    char  CountryCode[3];
+    char  District[20];
+    Int32 Population;
+  };
+
+  // Every open transaction counts against Ndb::init(), so the leak stops
+  // here rather than running into error 4006
+  static const Uint32 maxLeaked = 1000;
+
+  int define_records();
+  void reader_thread(bool leak);
+  void scan_thread();
+  int scan_once();
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *cluster_connection;
+  Ndb *readerNdb, *scanNdb;
+  const NdbDictionary::Table *countryTable, *cityTable;
+  const NdbRecord *cityRecord, *cityPopRecord;
+  std::vector<std::string> codes;
+  std::vector<NdbTransaction*> leaked;
+  ClientMemoryTracker tracker;
+  std::atomic<bool> stop;
+};
+
+int ClientMemoryExample::doTest(const Options &opts)
+{
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  // Step 2. Connecting to the cluster
+  cluster_connection = new Ndb_cluster_connection(connectstring);
+  if (cluster_connection->connect(4 /* retries               */,
+                                  5 /* delay between retries */,
+                                  1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (cluster_connection->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+
+  // Step 3. One Ndb per thread; the reader needs room for the
+  // transactions it leaks
+  readerNdb = new Ndb(cluster_connection, db);
+  if (readerNdb->init(opts.leak ? maxLeaked + 4 : 4)) {
+    print_error(readerNdb->getNdbError(),
+                "Could not connect to the database object.");
+    return 3;
+  }
+  scanNdb = new Ndb(cluster_connection, db);
+  if (scanNdb->init()) {
+    print_error(scanNdb->getNdbError(),
+                "Could not connect to the database object.");
+    return 3;
+  }
+
+  // Step 4. Get table metadata and define NdbRecord's
+  if (define_records())
+    return 4;
+
+  const char *sample[] = { "JPN", "USA", "CHN", "IND", "KOR",
+                           "DEU", "GBR", "SWE", "ATA" };
+  codes.assign(sample, sample + sizeof(sample) / sizeof(sample[0]));
+
+  // Step 5. Run the workload and report every interval
+  std::thread reader(&ClientMemoryExample::reader_thread, this, opts.leak);
+  std::thread scanner(&ClientMemoryExample::scan_thread, this);
+
+  Clock::time_point end = Clock::now() + std::chrono::seconds(opts.seconds);
+  while (Clock::now() < end) {
+    std::this_thread::sleep_for(std::chrono::seconds(opts.interval));
+    tracker.report(std::cout, opts.format);
+  }
+  stop = true;
+  reader.join();
+  scanner.join();
+  return 0;
+}
+
+int ClientMemoryExample::define_records()
+{
+  // Each table through the dictionary of the Ndb that uses it
+  NdbDictionary::Dictionary *myDict = scanNdb->getDictionary();
+  NdbDictionary::Dictionary *readerDict = readerNdb->getDictionary();
+  if ((cityTable = myDict->getTable("City")) == NULL) {
+    print_error(myDict->getNdbError(), "Could not retrieve a table.");
+    return -1;
+  }
+  if ((countryTable = readerDict->getTable("Country")) == NULL) {
+    print_error(readerDict->getNdbError(), "Could not retrieve a table.");
+    return -1;
+  }
+
+  NdbDictionary::RecordSpecification recordSpec[5];
+  std::memset(recordSpec, 0, sizeof recordSpec);
+  int rsSize = sizeof(recordSpec[0]);
+
+  recordSpec[0].column = cityTable->getColumn("Population");
+  recordSpec[0].offset = offsetof(struct CityRow, Population);
+  recordSpec[1].column = cityTable->getColumn("ID");
+  recordSpec[1].offset = offsetof(struct CityRow, ID);
+  recordSpec[2].column = cityTable->getColumn("Name");
+  recordSpec[2].offset = offsetof(struct CityRow, Name);
+  recordSpec[3].column = cityTable->getColumn("CountryCode");
+  recordSpec[3].offset = offsetof(struct CityRow, CountryCode);
+  recordSpec[4].column = cityTable->getColumn("District");
+  recordSpec[4].offset = offsetof(struct CityRow, District);
+
+  cityRecord = myDict->createRecord(cityTable, recordSpec, 5, rsSize);
+  cityPopRecord = myDict->createRecord(cityTable, recordSpec, 1, rsSize);
+  if (cityRecord == NULL || cityPopRecord == NULL) {
+    print_error(myDict->getNdbError(), "Failed to initialize NdbRecords'.");
+    return -1;
+  }
+  tracker.add_record("City", cityRecord, 5);
+  tracker.add_record("City", cityPopRecord, 1);
+  return 0;
+}
+
+// Country reads with getValue(), as in read_tuples.cc
+void ClientMemoryExample::reader_thread(bool leak)
+{
+  for (Uint64 n = 0; !stop; n++) {
+    if (n % 100 == 0)
+      tracker.update_ndb("reader", readerNdb);
+
+    NdbTransaction *myTransaction = readerNdb->startTransaction();
+    if (myTransaction == NULL) {
+      print_error(readerNdb->getNdbError(), "Could not start transaction.");
+      return;
+    }
+
+    NdbOperation *myOperation = myTransaction->getNdbOperation(countryTable);
+    if (myOperation == NULL ||
+        myOperation->readTuple(NdbOperation::LM_CommittedRead) == -1 ||
+        myOperation->equal("Code", codes[n % codes.size()].c_str()) == -1 ||
+        myOperation->getValue("Name", NULL) == NULL ||
+        myOperation->getValue("Capital", NULL) == NULL ||
+        myTransaction->execute( NdbTransaction::Commit ) == -1) {
+      print_error(myTransaction->getNdbError(), "Read failed.");
+      readerNdb->closeTransaction(myTransaction);
+      return;
+    }
+
+    if (leak && n % 50 == 49 && leaked.size() < maxLeaked)
+      leaked.push_back(myTransaction);   // closed only at exit
+    else
+      readerNdb->closeTransaction(myTransaction);
+  }
+  tracker.update_ndb("reader", readerNdb);
+}
+
+void ClientMemoryExample::scan_thread()
+{
+  while (!stop) {
+    tracker.update_ndb("scanner", scanNdb);
+    if (scan_once())
+      return;
+  }
+}
+
+// Full scan of City, registered with the tracker while it is open
+int ClientMemoryExample::scan_once()
+{
+  NdbTransaction *myTransaction = scanNdb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(scanNdb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  const Uint32 batch = 64;
+  NdbScanOperation::ScanOptions options;
+  options.optionsPresent = NdbScanOperation::ScanOptions::SO_BATCH;
+  options.batch = batch;
+
+  NdbScanOperation *sop =
+    myTransaction->scanTable(cityRecord,
+                             NdbOperation::LM_CommittedRead,
+                             NULL,
+                             &options,
+                             sizeof(NdbScanOperation::ScanOptions));
+  if (sop == NULL ||
+      myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    scanNdb->closeTransaction(myTransaction);
+    return -1;
+  }
+  tracker.scan_started(sop, ClientMemoryTracker::scan_bytes(
+                              cityRecord, batch,
+                              cityTable->getFragmentCount()));
+
+  int check;
+  const CityRow *row;
+  Uint64 population = 0;
+  while ((check = sop->nextResult((const char**) &row, true, false)) == 0)
+    population += row->Population;
+
+  tracker.scan_finished(sop);
+  if (check == -1) {
+    print_error(myTransaction->getNdbError(), "Error during scan.");
+    scanNdb->closeTransaction(myTransaction);
+    return -1;
+  }
+  scanNdb->closeTransaction(myTransaction);
+  return 0;
+}
+
+ClientMemoryExample::~ClientMemoryExample()
+{
+  // Step 6. Cleanup
+  for (size_t i = 0; i < leaked.size(); i++)
+    readerNdb->closeTransaction(leaked[i]);
+  if (readerNdb) delete readerNdb;
+  if (scanNdb) delete scanNdb;
+  if (cluster_connection) delete cluster_connection;
+  ndb_end(0);
+}
+
+int main(int argc, char *argv[])
+{
+  Options opts;
+  opts.seconds = 20;
+  opts.interval = 2;
+  opts.format = ClientMemoryTracker::Text;
+  opts.leak = false;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    size_t eq = arg.find('=');
+    std::string key = arg.substr(0, eq);
+    std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+    if (key == "seconds")
+      opts.seconds = std::atoi(value.c_str());
+    else if (key == "interval")
+      opts.interval = std::atoi(value.c_str());
+    else if (key == "format" && (value == "text" || value == "json"))
+      opts.format = value == "json" ? ClientMemoryTracker::Json
+                                    : ClientMemoryTracker::Text;
+    else if (key == "leak")
+      opts.leak = std::atoi(value.c_str()) != 0;
+    else {
+      std::cerr << "Usage: " << argv[0] << " [seconds=N] [interval=N]"
+                << " [format=text|json] [leak=0|1]" << std::endl;
+      return 1;
+    }
+  }
+  if (opts.seconds <= 0 || opts.interval <= 0) {
+    std::cerr << "seconds and interval must be positive." << std::endl;
+    return 1;
+  }
+
+  ClientMemoryExample ex;
+  return ex.doTest(opts);
+}
@@ -0,0 +1,7 @@
+-- Lets committed reads of Country be served by any replica instead of the
+-- primary only, as used by nearest_replica_read.cc.
+ALTER TABLE Country ALGORITHM=INPLACE, COMMENT="NDB_TABLE=READ_BACKUP=1";
+
+-- Alternatively keep a full copy of Country on every data node; this
+-- needs a copying ALTER TABLE.
+-- ALTER TABLE Country ALGORITHM=COPY, COMMENT="NDB_TABLE=FULLY_REPLICATED=1";
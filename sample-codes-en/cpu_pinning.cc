@@ -0,0 +1,412 @@
+// CPU placement of client threads.
+//
+// The samples create Ndb_cluster_connection with default settings, so the
+// receive thread of the connection and the user threads are placed by the
+// OS scheduler. This driver takes a CPU topology, pins each worker thread
+// and the receive thread of each connection to the given cores, sets the
+// receive thread activation threshold and the adaptive send time, and logs
+// the resulting placement. It then runs a closed-loop Country PK read
+// workload and reports throughput and p99, optionally both unpinned and
+// pinned for comparison.
+//
+// Worker pinning uses pthread_setaffinity_np() and is Linux specific.
+//
+// Usage: cpu_pinning [key=value ...], defaults shown
+//   connections=1          number of Ndb_cluster_connection objects
+//   workers=4              number of worker threads (spread over connections)
+//   recv_cpus=LIST         receive thread CPU per connection, e.g. 0,1;
+//                          not pinned if not given
+//   worker_cpus=LIST       worker CPUs, used round robin, e.g. 2,3,4,5;
+//                          not pinned if not given
+//   recv_threshold=-1      set_recv_thread_activation_threshold(), -1 keeps
+//                          the connection's setting
+//   adaptive_send_ms=-1    set_max_adaptive_send_time(), -1 keeps the
+//                          connection's setting
+//   seconds=10             duration of each run
+//   compare=0              1 to run unpinned first, then pinned
+//
+// For example: cpu_pinning connections=2 workers=8 recv_cpus=0,1
+//                          worker_cpus=2,3,4,5 recv_threshold=8 compare=1
+#include <NdbApi.hpp>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+const char *connectstring = "127.0.0.1:1186";
+const char *db = "world";
+
+typedef std::chrono::steady_clock Clock;
+
+struct Topology {
+  int connections;
+  int workers;
+  std::vector<int> recv_cpus;
+  std::vector<int> worker_cpus;
+  int recv_threshold;      // -1 = leave default
+  int adaptive_send_ms;    // -1 = leave default
+  int seconds;
+  bool compare;
+};
+
+class CpuPinningExample {
+public:
+  CpuPinningExample() {};
+  ~CpuPinningExample();
+  int doTest(const Topology &topo);
+
+private:
+  struct CountryRow {
+    char   nullBits;
+    char   Code[3];
+    char   Name[52];
+    Uint32 Capital;
+  };
+
+  // A connection with the metadata resolved through it
+  struct Connection {
+    Ndb_cluster_connection *conn;
+    Ndb *metaNdb;
+    const NdbDictionary::Table *countryTable;
+    const NdbRecord *pkRecord, *valsRecord;
+  };
+
+  struct WorkerResult {
+    std::vector<Uint32> latency_us;
+    int cpu;
+    int error;
+  };
+
+  int run(const Topology &topo, bool pinned);
+  int connect(Ndb_cluster_connection *&conn);
+  int define_records(Connection &c);
+  int load_country_codes(Connection &c);
+  void worker(const Connection *c, int cpu, int worker_no,
+              WorkerResult *res);
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  std::vector<std::string> countryCodes;
+  std::atomic<bool> stop;
+};
+
+int CpuPinningExample::doTest(const Topology &topo)
+{
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  int err = 0;
+  if (topo.compare && (err = run(topo, false)))
+    return err;
+  return run(topo, true);
+}
+
+int CpuPinningExample::connect(Ndb_cluster_connection *&conn)
+{
+  // Step 2. Connecting to the cluster
+  conn = new Ndb_cluster_connection(connectstring);
+  if (conn->connect(4 /* retries               */,
+                    5 /* delay between retries */,
+                    1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (conn->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+  return 0;
+}
+
+int CpuPinningExample::define_records(Connection &c)
+{
+  // Table objects and NdbRecord's are resolved per connection and shared
+  // by the workers of that connection; metaNdb keeps them referenced.
+  c.metaNdb = new Ndb(c.conn, db);
+  if (c.metaNdb->init()) {
+    print_error(c.metaNdb->getNdbError(),
+                "Could not connect to the database object.");
+    return 3;
+  }
+
+  NdbDictionary::Dictionary *myDict = c.metaNdb->getDictionary();
+  c.countryTable = myDict->getTable("Country");
+  if (c.countryTable == NULL) {
+    print_error(myDict->getNdbError(), "Could not retrieve a table.");
+    return 4;
+  }
+
+  NdbDictionary::RecordSpecification recordSpec[3];
+  std::memset(recordSpec, 0, sizeof recordSpec);
+  recordSpec[0].column = c.countryTable->getColumn("Code");
+  recordSpec[0].offset = offsetof(struct CountryRow, Code);
+  recordSpec[1].column = c.countryTable->getColumn("Name");
+  recordSpec[1].offset = offsetof(struct CountryRow, Name);
+  recordSpec[2].column = c.countryTable->getColumn("Capital");
+  recordSpec[2].offset = offsetof(struct CountryRow, Capital);
+  recordSpec[2].nullbit_byte_offset = offsetof(struct CountryRow, nullBits);
+  recordSpec[2].nullbit_bit_in_byte = 0;
+
+  c.pkRecord = myDict->createRecord(c.countryTable, recordSpec, 1,
+                                    sizeof(recordSpec[0]));
+  c.valsRecord = myDict->createRecord(c.countryTable, recordSpec, 3,
+                                      sizeof(recordSpec[0]));
+  if (c.pkRecord == NULL || c.valsRecord == NULL) {
+    print_error(myDict->getNdbError(), "Failed to initialize NdbRecords'.");
+    return 5;
+  }
+  return 0;
+}
+
+int CpuPinningExample::load_country_codes(Connection &c)
+{
+  // Key set for the workload
+  NdbTransaction *trans = c.metaNdb->startTransaction();
+  if (trans == NULL) {
+    print_error(c.metaNdb->getNdbError(), "Could not start transaction.");
+    return 6;
+  }
+  NdbScanOperation *sop =
+    trans->scanTable(c.pkRecord, NdbOperation::LM_CommittedRead);
+  if (sop == NULL || trans->execute(NdbTransaction::NoCommit) == -1) {
+    print_error(trans->getNdbError(), "Failed to prepare a scan.");
+    c.metaNdb->closeTransaction(trans);
+    return 7;
+  }
+  int check;
+  CountryRow *row;
+  countryCodes.clear();
+  while ((check = sop->nextResult((const char**) &row, true, false)) == 0)
+    countryCodes.push_back(std::string(row->Code, 3));
+  c.metaNdb->closeTransaction(trans);
+  if (check == -1 || countryCodes.empty()) {
+    std::cerr << "Could not read country codes." << std::endl;
+    return 8;
+  }
+  return 0;
+}
+
+int CpuPinningExample::run(const Topology &topo, bool pinned)
+{
+  std::cout << "========== " << (pinned ? "Pinned" : "Unpinned")
+            << " ==========" << std::endl;
+
+  // Step 3. Create and configure the connections
+  std::vector<Connection> conns(topo.connections);
+  for (size_t i = 0; i < conns.size(); i++) {
+    conns[i].conn = NULL;
+    conns[i].metaNdb = NULL;
+  }
+
+  int err = 0;
+  for (int i = 0; i < topo.connections && !err; i++) {
+    if ((err = connect(conns[i].conn)))
+      break;
+
+    Ndb_cluster_connection *conn = conns[i].conn;
+    if (topo.recv_threshold >= 0)
+      conn->set_recv_thread_activation_threshold(topo.recv_threshold);
+    if (topo.adaptive_send_ms >= 0)
+      conn->set_max_adaptive_send_time(topo.adaptive_send_ms);
+
+    std::cout << "connection " << i << " (node " << conn->node_id() << "):"
+              << " recv_thread_activation_threshold="
+              << conn->get_recv_thread_activation_threshold()
+              << " max_adaptive_send_time="
+              << conn->get_max_adaptive_send_time() << "ms";
+    if (pinned && !topo.recv_cpus.empty()) {
+      Uint16 cpu = topo.recv_cpus[i % topo.recv_cpus.size()];
+      if (conn->set_recv_thread_cpu(&cpu, 1, 0) != 0) {
+        std::cout << " recv_cpu=" << cpu << " (failed)";
+      } else {
+        std::cout << " recv_cpu=" << cpu;
+      }
+    } else {
+      std::cout << " recv_cpu=any";
+    }
+    std::cout << std::endl;
+
+    err = define_records(conns[i]);
+  }
+
+  if (!err)
+    err = load_country_codes(conns[0]);
+
+  // Step 4. Start the workers
+  std::vector<WorkerResult> results(topo.workers);
+  if (!err) {
+    stop = false;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < topo.workers; i++) {
+      int cpu = -1;
+      if (pinned && !topo.worker_cpus.empty())
+        cpu = topo.worker_cpus[i % topo.worker_cpus.size()];
+      workers.push_back(std::thread(&CpuPinningExample::worker, this,
+                                    &conns[i % conns.size()], cpu, i,
+                                    &results[i]));
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(topo.seconds));
+    stop = true;
+    for (size_t i = 0; i < workers.size(); i++)
+      workers[i].join();
+  }
+
+  // Step 5. Report placement, throughput and latency
+  if (!err) {
+    std::vector<Uint32> all;
+    for (int i = 0; i < topo.workers; i++) {
+      if (results[i].error) {
+        err = results[i].error;
+        continue;
+      }
+      std::cout << "worker " << i << ": connection " << i % conns.size()
+                << ", cpu " << results[i].cpu
+                << ", " << results[i].latency_us.size() << " reads"
+                << std::endl;
+      all.insert(all.end(), results[i].latency_us.begin(),
+                 results[i].latency_us.end());
+    }
+    if (!all.empty()) {
+      std::sort(all.begin(), all.end());
+      std::cout << "throughput: " << all.size() / topo.seconds << " reads/s"
+                << ", p50: " << all[all.size() / 2] << "us"
+                << ", p99: " << all[(all.size() * 99) / 100] << "us"
+                << std::endl;
+    }
+  }
+
+  // Step 6. Cleanup of this run
+  for (size_t i = 0; i < conns.size(); i++) {
+    if (conns[i].metaNdb) delete conns[i].metaNdb;
+    if (conns[i].conn) delete conns[i].conn;
+  }
+  return err;
+}
+
+void CpuPinningExample::worker(const Connection *c, int cpu, int worker_no,
+                               WorkerResult *res)
+{
+  res->error = 0;
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+      std::cerr << "Could not pin worker to cpu " << cpu << "." << std::endl;
+  }
+  // Where we actually run; for unpinned workers this is just a sample
+  res->cpu = sched_getcpu();
+
+  Ndb ndb(c->conn, db);
+  if (ndb.init()) {
+    print_error(ndb.getNdbError(),
+                "Could not connect to the database object.");
+    res->error = 9;
+    return;
+  }
+
+  // Workers start at different keys so that they do not run in lockstep
+  size_t n = worker_no * 17;
+  while (!stop) {
+    CountryRow row;
+    std::memset(&row, 0, sizeof row);
+    std::memcpy(row.Code, countryCodes[n++ % countryCodes.size()].c_str(), 3);
+
+    Clock::time_point start = Clock::now();
+    NdbTransaction *trans = ndb.startTransaction(c->countryTable, row.Code, 3);
+    if (trans == NULL) {
+      print_error(ndb.getNdbError(), "Could not start transaction.");
+      res->error = 10;
+      return;
+    }
+    if (trans->readTuple(c->pkRecord, (char*) &row,
+                         c->valsRecord, (char*) &row,
+                         NdbOperation::LM_CommittedRead) == NULL ||
+        trans->execute(NdbTransaction::Commit) == -1) {
+      print_error(trans->getNdbError(), "Transaction failed.");
+      ndb.closeTransaction(trans);
+      res->error = 11;
+      return;
+    }
+    ndb.closeTransaction(trans);
+    res->latency_us.push_back(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+        Clock::now() - start).count());
+  }
+}
+
+CpuPinningExample::~CpuPinningExample()
+{
+  // Step 7. Cleanup
+  ndb_end(0);
+}
+
+static std::vector<int> parse_cpus(const std::string &s)
+{
+  std::vector<int> cpus;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ','))
+    if (!item.empty())
+      cpus.push_back(std::atoi(item.c_str()));
+  return cpus;
+}
+
+int main(int argc, char *argv[])
+{
+  Topology topo;
+  topo.connections = 1;
+  topo.workers = 4;
+  topo.recv_threshold = -1;
+  topo.adaptive_send_ms = -1;
+  topo.seconds = 10;
+  topo.compare = false;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    size_t eq = arg.find('=');
+    if (eq == std::string::npos) {
+      std::cerr << "Usage: " << argv[0] << " [key=value ...]" << std::endl;
+      return 1;
+    }
+    std::string key = arg.substr(0, eq), value = arg.substr(eq + 1);
+    if (key == "connections") topo.connections = std::atoi(value.c_str());
+    else if (key == "workers") topo.workers = std::atoi(value.c_str());
+    else if (key == "recv_cpus") topo.recv_cpus = parse_cpus(value);
+    else if (key == "worker_cpus") topo.worker_cpus = parse_cpus(value);
+    else if (key == "recv_threshold")
+      topo.recv_threshold = std::atoi(value.c_str());
+    else if (key == "adaptive_send_ms")
+      topo.adaptive_send_ms = std::atoi(value.c_str());
+    else if (key == "seconds") topo.seconds = std::atoi(value.c_str());
+    else if (key == "compare") topo.compare = std::atoi(value.c_str()) != 0;
+    else {
+      std::cerr << "Unknown option " << key << "." << std::endl;
+      return 1;
+    }
+  }
+  if (topo.connections <= 0 || topo.workers <= 0 || topo.seconds <= 0) {
+    std::cerr << "connections, workers and seconds must be positive."
+              << std::endl;
+    return 1;
+  }
+
+  CpuPinningExample ex;
+  return ex.doTest(topo);
+}
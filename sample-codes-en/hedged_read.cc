@@ -0,0 +1,543 @@
+// Hedged primary key reads.
+//
+// A single PK read such as the Country lookup in read_tuples_record.cc
+// normally takes one round trip. While a data node restarts, or runs a
+// global or local checkpoint, a read coordinated by that node can take
+// 10-100 times as long, and that sets the p99.9 latency.
+//
+// HedgedReader sends a committed read asynchronously and polls for the
+// reply. If no reply has come once the hedge threshold has passed, it
+// sends the same read again, through a transaction coordinated by another
+// data node. It uses whichever reply arrives first. Committed reads of a
+// read backup table (country_read_backup.sql) may be served by any
+// replica, so both answers are valid.
+//
+// The threshold is a percentile of the latencies of recent first
+// attempts, so hedges follow the latency the cluster has now. A token
+// bucket caps hedges at a share of all reads, so a slow cluster does not
+// receive twice the load. The losing request is not waited for. Its
+// transaction stays open until its own reply arrives and is closed from
+// the callback, because an NdbTransaction with a request in flight must
+// not be closed. Once the abandoned requests fill the transactions the
+// Ndb was initialized for, no more hedges are sent until some of them
+// have been answered.
+//
+// The benchmark reads Country with hedging off and on, and reports the
+// latency percentiles, hedges issued and hedges won. Under the stand-in
+// library, set NDB_STANDIN_STALL_PERMILLE to make data nodes stall.
+//
+// Usage: hedged_read [reads] [percentile] [max hedge %]
+#include <NdbApi.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <stddef.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+const char *connectstring = "127.0.0.1:1186";
+const char *db = "world";
+
+typedef std::chrono::steady_clock Clock;
+
+struct CountryRow {
+  char   nullBits;
+  char   Code[3];
+  char   Name[52];
+  Uint32 Capital;
+};
+
+// Latencies of recent first attempts. The threshold is computed again
+// every tenth of a window, not for every read.
+class LatencyWindow {
+public:
+  LatencyWindow(size_t size, double percentile, double floor_us)
+    : size(size), percentile(percentile), floor_us(floor_us), next(0),
+      sinceUpdate(0), threshold(0) {}
+
+  void add(double us)
+  {
+    if (samples.size() < size)
+      samples.push_back(us);
+    else
+      samples[next++ % size] = us;
+    if (++sinceUpdate >= size / 10 || threshold == 0)
+      update();
+  }
+
+  // 0 until there are samples
+  double threshold_us() const { return threshold; }
+
+private:
+  void update()
+  {
+    std::vector<double> sorted(samples);
+    size_t k = (size_t) (percentile / 100 * (sorted.size() - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    threshold = std::max(sorted[k], floor_us);
+    sinceUpdate = 0;
+  }
+
+  size_t size;
+  double percentile;
+  double floor_us;
+  size_t next;
+  size_t sinceUpdate;
+  double threshold;
+  std::vector<double> samples;
+};
+
+class HedgedReader {
+public:
+  struct Options {
+    bool hedging;
+    double percentile;       // of first attempt latency, the threshold
+    double maxHedgeRate;     // hedges per read, at most
+    double minThresholdUs;
+  };
+
+  HedgedReader(Ndb *ndb, const NdbDictionary::Table *table,
+               const NdbRecord *pkRecord, const NdbRecord *valsRecord,
+               const Options &options)
+    : reads(0), hedgesIssued(0), hedgesWon(0), hedgesCapped(0),
+      hedgesBlocked(0), lastNode(0), ndb(ndb), table(table), pkRecord(pkRecord),
+      valsRecord(valsRecord), options(options),
+      window(1000, options.percentile, options.minThresholdUs),
+      budget(1), pending(0) {};
+  ~HedgedReader();
+
+  // Finds a partition coordinated by each data node; a hedge goes
+  // through one of them
+  int prepare();
+
+  // `row.Code` holds the key; the other columns are filled in
+  int read(CountryRow &row);
+
+  // Waits for the replies of abandoned requests
+  void drain();
+
+  double threshold_us() const { return window.threshold_us(); }
+
+  // Transactions the Ndb must be initialized for. A read uses two at
+  // most; the rest are left to abandoned requests.
+  static const int maxTransactions = 64;
+
+  Uint64 reads, hedgesIssued, hedgesWon, hedgesCapped;
+  Uint64 hedgesBlocked;      // skipped, too many abandoned requests
+  Uint32 lastNode;           // coordinator of the answer of the last read
+
+private:
+  struct Request {
+    HedgedReader *reader;
+    NdbTransaction *trans;
+    CountryRow row;
+    Clock::time_point sent;
+    bool hedge;
+    bool done;
+    bool abandoned;          // the other request answered first
+    int result;
+    NdbError error;
+  };
+
+  Request *launch(const CountryRow &key, bool hedge, Uint32 avoidNode);
+  void finish(Request *req);
+  static void callback(int result, NdbTransaction *trans, void *arg);
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb *ndb;
+  const NdbDictionary::Table *table;
+  const NdbRecord *pkRecord, *valsRecord;
+  Options options;
+  LatencyWindow window;
+  double budget;             // hedges that may be sent now
+  int pending;               // abandoned requests still in flight
+  std::map<Uint32, Uint32> nodePartition;
+  std::vector<Request*> freeRequests;
+};
+
+HedgedReader::~HedgedReader()
+{
+  drain();
+  for (size_t i = 0; i < freeRequests.size(); i++)
+    delete freeRequests[i];
+}
+
+int HedgedReader::prepare()
+{
+  for (Uint32 p = 0; p < table->getPartitionCount(); p++) {
+    NdbTransaction *trans = ndb->startTransaction(table, p);
+    if (trans == NULL) {
+      print_error(ndb->getNdbError(), "Could not start transaction.");
+      return -1;
+    }
+    Uint32 node = trans->getConnectedNodeId();
+    if (nodePartition.find(node) == nodePartition.end())
+      nodePartition[node] = p;
+    ndb->closeTransaction(trans);
+  }
+  return 0;
+}
+
+void HedgedReader::callback(int result, NdbTransaction *trans, void *arg)
+{
+  Request *req = (Request*) arg;
+  req->done = true;
+  req->result = result;
+  if (result)
+    req->error = trans->getNdbError();
+  // Late first attempts count too, or the threshold would only ever see
+  // the fast ones
+  if (!req->hedge)
+    req->reader->window.add(std::chrono::duration<double, std::micro>(
+                              Clock::now() - req->sent).count());
+  if (req->abandoned) {
+    req->reader->pending--;
+    req->reader->finish(req);
+  }
+}
+
+// Defines and sends one committed read. The first attempt is hinted by
+// the key; a hedge goes through a node other than `avoidNode`.
+HedgedReader::Request *
+HedgedReader::launch(const CountryRow &key, bool hedge, Uint32 avoidNode)
+{
+  NdbTransaction *trans = NULL;
+  if (!hedge) {
+    trans = ndb->startTransaction(table, key.Code, sizeof(key.Code));
+  } else {
+    std::map<Uint32, Uint32>::const_iterator it = nodePartition.begin();
+    while (it != nodePartition.end() && it->first == avoidNode)
+      ++it;
+    trans = it == nodePartition.end()
+              ? ndb->startTransaction()
+              : ndb->startTransaction(table, it->second);
+  }
+  if (trans == NULL) {
+    print_error(ndb->getNdbError(), "Could not start transaction.");
+    return NULL;
+  }
+
+  Request *req;
+  if (freeRequests.empty()) {
+    req = new Request;
+  } else {
+    req = freeRequests.back();
+    freeRequests.pop_back();
+  }
+  req->reader = this;
+  req->trans = trans;
+  req->row = key;
+  req->hedge = hedge;
+  req->done = false;
+  req->abandoned = false;
+  req->result = 0;
+
+  if (trans->readTuple(pkRecord, (char*) &req->row,
+                       valsRecord, (char*) &req->row,
+                       NdbOperation::LM_CommittedRead) == NULL) {
+    print_error(trans->getNdbError(), "Could not define the read.");
+    finish(req);
+    return NULL;
+  }
+  trans->executeAsynchPrepare(NdbTransaction::Commit, &callback, req);
+  req->sent = Clock::now();
+  ndb->sendPreparedTransactions(1);
+  return req;
+}
+
+void HedgedReader::finish(Request *req)
+{
+  ndb->closeTransaction(req->trans);
+  req->trans = NULL;
+  freeRequests.push_back(req);
+}
+
+int HedgedReader::read(CountryRow &row)
+{
+  Request *first = launch(row, false, 0);
+  if (first == NULL)
+    return -1;
+  Uint32 firstNode = first->trans->getConnectedNodeId();
+  Request *second = NULL;
+  bool decided = false;      // hedged, or passed over by the cap
+  budget = std::min(budget + options.maxHedgeRate, 10.0);
+  reads++;
+
+  // pollNdb() waits in whole milliseconds, which is coarser than the
+  // threshold, so poll without waiting until a reply is in
+  Request *winner = NULL;
+  for (;;) {
+    ndb->pollNdb(0, 1);
+    if (first->done && first->result == 0)
+      winner = first;
+    else if (second != NULL && second->done && second->result == 0)
+      winner = second;
+    if (winner != NULL)
+      break;
+
+    // Errors are not hedged; they are for the caller to handle
+    if (first->done && (second == NULL || second->done)) {
+      print_error(first->error, "Read failed.");
+      finish(first);
+      if (second != NULL)
+        finish(second);
+      return -1;
+    }
+
+    double threshold = window.threshold_us();
+    if (options.hedging && !decided && threshold > 0 &&
+        std::chrono::duration<double, std::micro>(
+          Clock::now() - first->sent).count() >= threshold) {
+      decided = true;
+      if (pending >= maxTransactions - 2) {
+        // A long stall leaves losers open; another hedge would not fit
+        hedgesBlocked++;
+      } else if (budget >= 1) {
+        budget -= 1;
+        second = launch(row, true, firstNode);
+        if (second != NULL)
+          hedgesIssued++;
+      } else {
+        hedgesCapped++;
+      }
+    }
+    std::this_thread::yield();
+  }
+
+  std::memcpy(&row, &winner->row, sizeof row);
+  lastNode = winner->trans->getConnectedNodeId();
+  if (winner == second)
+    hedgesWon++;
+
+  // The loser stays open until its reply arrives
+  Request *loser = winner == first ? second : first;
+  if (loser != NULL && !loser->done) {
+    loser->abandoned = true;
+    pending++;
+  } else if (loser != NULL) {
+    finish(loser);
+  }
+  finish(winner);
+  return 0;
+}
+
+void HedgedReader::drain()
+{
+  while (pending > 0)
+    ndb->pollNdb(3000, 1);
+}
+
+class HedgedReadExample {
+public:
+  HedgedReadExample() : cluster_connection(NULL), myNdb(NULL),
+                        myDict(NULL), myTable(NULL) {};
+  ~HedgedReadExample();
+  int doTest(int reads, double percentile, double maxHedgePct);
+
+private:
+  int load_codes();
+  int run(bool hedging, int reads, double percentile, double maxHedgePct);
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *cluster_connection;
+  Ndb *myNdb;
+  NdbDictionary::Dictionary* myDict;
+  const NdbDictionary::Table *myTable;
+  const NdbRecord *pkRecord, *valsRecord;
+  std::vector<std::string> codes;
+};
+
+int HedgedReadExample::doTest(int reads, double percentile,
+                              double maxHedgePct)
+{
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  // Step 2. Connecting to the cluster
+  cluster_connection = new Ndb_cluster_connection(connectstring);
+  if (cluster_connection->connect(4 /* retries               */,
+                                  5 /* delay between retries */,
+                                  1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (cluster_connection->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+
+  // Step 3. Connect to 'world' database; two transactions per read at most
+  // plus the abandoned ones
+  myNdb = new Ndb(cluster_connection, db);
+  if (myNdb->init(HedgedReader::maxTransactions)) {
+    print_error(myNdb->getNdbError(),
+                "Could not connect to the database object.");
+    return 3;
+  }
+
+  // Step 4. Get table metadata
+  myDict = myNdb->getDictionary();
+  if ((myTable = myDict->getTable("Country")) == NULL) {
+    print_error(myDict->getNdbError(), "Could not retrieve a table.");
+    return 4;
+  }
+  if (!myTable->getReadBackupFlag() && !myTable->getFullyReplicated())
+    std::cout << "Country is not a read backup table; committed reads "
+              << "coordinated elsewhere pay an extra hop "
+              << "(see country_read_backup.sql)." << std::endl;
+
+  // Step 5. Define NdbRecord's
+  NdbDictionary::RecordSpecification recordSpec[3];
+  std::memset(recordSpec, 0, sizeof recordSpec);
+  int rsSize = sizeof(recordSpec[0]);
+
+  recordSpec[0].column = myTable->getColumn("Code");
+  recordSpec[0].offset = offsetof(struct CountryRow, Code);
+  recordSpec[1].column = myTable->getColumn("Name");
+  recordSpec[1].offset = offsetof(struct CountryRow, Name);
+  recordSpec[2].column = myTable->getColumn("Capital");
+  recordSpec[2].offset = offsetof(struct CountryRow, Capital);
+  recordSpec[2].nullbit_byte_offset = offsetof(struct CountryRow, nullBits);
+  recordSpec[2].nullbit_bit_in_byte = 0;
+
+  pkRecord = myDict->createRecord(myTable, recordSpec, 1, rsSize);
+  valsRecord = myDict->createRecord(myTable, recordSpec, 3, rsSize);
+  if (pkRecord == NULL || valsRecord == NULL) {
+    print_error(myDict->getNdbError(), "Failed to initialize NdbRecords'.");
+    return 5;
+  }
+
+  // Step 6. Compare plain and hedged reads
+  if (load_codes())
+    return 6;
+  std::cout << "========== " << reads << " Country reads, hedge after p"
+            << percentile << ", at most " << maxHedgePct
+            << "% hedged ==========" << std::endl;
+  if (run(false, reads, percentile, maxHedgePct) ||
+      run(true, reads, percentile, maxHedgePct))
+    return 7;
+  return 0;
+}
+
+int HedgedReadExample::load_codes()
+{
+  NdbTransaction *myTransaction = myNdb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(myNdb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  NdbScanOperation *sop =
+    myTransaction->scanTable(pkRecord, NdbOperation::LM_CommittedRead);
+  if (sop == NULL ||
+      myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    myNdb->closeTransaction(myTransaction);
+    return -1;
+  }
+
+  int check;
+  const CountryRow *row;
+  while ((check = sop->nextResult((const char**) &row, true, false)) == 0)
+    codes.push_back(std::string(row->Code, 3));
+  myNdb->closeTransaction(myTransaction);
+  if (check == -1 || codes.empty()) {
+    std::cerr << "Could not read country codes." << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+int HedgedReadExample::run(bool hedging, int reads, double percentile,
+                           double maxHedgePct)
+{
+  HedgedReader::Options options;
+  options.hedging = hedging;
+  options.percentile = percentile;
+  options.maxHedgeRate = maxHedgePct / 100;
+  options.minThresholdUs = 50;
+
+  std::vector<double> latencies;
+  latencies.reserve(reads);
+  {
+    HedgedReader reader(myNdb, myTable, pkRecord, valsRecord, options);
+    if (reader.prepare())
+      return -1;
+
+    for (int i = 0; i < reads; i++) {
+      CountryRow row;
+      std::memcpy(row.Code, codes[(i * 7) % codes.size()].data(), 3);
+      Clock::time_point start = Clock::now();
+      if (reader.read(row))
+        return -1;
+      latencies.push_back(std::chrono::duration<double, std::micro>(
+                            Clock::now() - start).count());
+    }
+    reader.drain();
+
+    double sum = 0;
+    for (size_t i = 0; i < latencies.size(); i++)
+      sum += latencies[i];
+    std::sort(latencies.begin(), latencies.end());
+    size_t n = latencies.size();
+
+    std::cout << (hedging ? "hedged: " : "plain:  ") << std::fixed
+              << std::setprecision(0)
+              << "avg " << sum / n
+              << " us, p50 " << latencies[n / 2]
+              << ", p99 " << latencies[n * 99 / 100]
+              << ", p99.9 " << latencies[n * 999 / 1000]
+              << ", max " << latencies[n - 1] << " us" << std::endl;
+    if (hedging)
+      std::cout << "        threshold " << reader.threshold_us()
+                << " us, hedges issued " << reader.hedgesIssued
+                << std::setprecision(1) << " ("
+                << 100.0 * reader.hedgesIssued / reader.reads
+                << "%), won " << reader.hedgesWon
+                << ", skipped by the cap " << reader.hedgesCapped
+                << ", by requests in flight " << reader.hedgesBlocked
+                << std::endl;
+  }
+  return 0;
+}
+
+HedgedReadExample::~HedgedReadExample()
+{
+  // Step 7. Cleanup
+  if (myNdb) delete myNdb;
+  if (cluster_connection) delete cluster_connection;
+  ndb_end(0);
+}
+
+int main(int argc, char *argv[])
+{
+  int reads = argc > 1 ? std::atoi(argv[1]) : 20000;
+  double percentile = argc > 2 ? std::atof(argv[2]) : 95;
+  double maxHedgePct = argc > 3 ? std::atof(argv[3]) : 5;
+  if (reads <= 0 || percentile <= 0 || percentile >= 100 ||
+      maxHedgePct < 0) {
+    std::cerr << "Usage: hedged_read [reads] [percentile] [max hedge %]"
+              << std::endl;
+    return 1;
+  }
+
+  HedgedReadExample ex;
+  return ex.doTest(reads, percentile, maxHedgePct);
+}
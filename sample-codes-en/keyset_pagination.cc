@@ -0,0 +1,529 @@
+// Keyset pagination over the Population index.
+//
+// Paging through City with the scan of NdbApiExample3::do_index_scan_read()
+// means keeping its transaction and scan open while the user looks at a
+// page, which holds a scan record on every fragment and, with LM_Read, the
+// row locks of the current batch. CityPager instead reads every page with
+// its own short committed-read scan and returns an opaque token to resume
+// from. The token holds the (Population, ID) of the last row; the next scan
+// starts at that Population with an inclusive lower IndexBound and a filter
+// drops the rows of the same Population with an ID not above the token.
+//
+// The ordered index is on Population only, so rows with equal Population
+// come in no particular order. A page therefore reads to the end of the
+// Population value its last row has and sorts that group by ID, which makes
+// (Population, ID) a total order and no row is lost or repeated.
+//
+// The benchmark pages through City both ways with a think time between
+// pages and reports page latency. It also estimates the scan records held
+// on the data nodes, assuming one per fragment while a scan is open
+// (getFragmentCount()) and taking the open time from the client side.
+// These figures are not measured; on a real cluster compare them with
+// ndbinfo, as thread_load_sampler.cc does.
+//
+// Usage: keyset_pagination [page_size] [pages] [think_ms]
+#include <NdbApi.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <stddef.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+const char *connectstring = "127.0.0.1:1186";
+const char *db = "world";
+
+typedef std::chrono::steady_clock Clock;
+
+struct CityRow {
+  Int32 ID;
+  char  Name[35];
+  char  CountryCode[3];
+  char  District[20];
+  Int32 Population;
+};
+
+// Pages through City in (Population, ID) order without state on the data
+// nodes between pages.
+class CityPager {
+public:
+  CityPager(Ndb *ndb, const NdbDictionary::Table *table,
+            const NdbRecord *indexRecord, const NdbRecord *valsRecord)
+    : ndb(ndb), table(table), indexRecord(indexRecord),
+      valsRecord(valsRecord) {};
+
+  // Reads up to `size` rows after `token`, or from the start when it is
+  // empty. `next` is the token for the following page, empty at the end.
+  int page(const std::string &token, Uint32 size,
+           std::vector<CityRow> &rows, std::string &next);
+
+  static std::string make_token(Int32 population, Int32 id);
+  static bool parse_token(const std::string &token,
+                          Int32 &population, Int32 &id);
+
+private:
+  static bool row_less(const CityRow &a, const CityRow &b)
+  {
+    return a.Population != b.Population ? a.Population < b.Population
+                                        : a.ID < b.ID;
+  }
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb *ndb;
+  const NdbDictionary::Table *table;
+  const NdbRecord *indexRecord, *valsRecord;
+};
+
+// Version, both keys and a check byte, hex encoded. Clients only pass it
+// back; the check rejects tokens that were cut or edited.
+std::string CityPager::make_token(Int32 population, Int32 id)
+{
+  unsigned char raw[10];
+  raw[0] = 1;
+  std::memcpy(raw + 1, &population, 4);
+  std::memcpy(raw + 5, &id, 4);
+  raw[9] = 0x5a;
+  for (int i = 0; i < 9; i++)
+    raw[9] ^= raw[i];
+
+  std::string token;
+  char hex[3];
+  for (int i = 0; i < 10; i++) {
+    std::snprintf(hex, sizeof(hex), "%02x", raw[i]);
+    token += hex;
+  }
+  return token;
+}
+
+bool CityPager::parse_token(const std::string &token,
+                            Int32 &population, Int32 &id)
+{
+  unsigned char raw[10];
+  if (token.size() != 2 * sizeof(raw))
+    return false;
+  for (size_t i = 0; i < sizeof(raw); i++) {
+    unsigned int byte;
+    if (std::sscanf(token.c_str() + 2 * i, "%2x", &byte) != 1)
+      return false;
+    raw[i] = (unsigned char) byte;
+  }
+
+  unsigned char check = 0x5a;
+  for (int i = 0; i < 9; i++)
+    check ^= raw[i];
+  if (raw[0] != 1 || raw[9] != check)
+    return false;
+  std::memcpy(&population, raw + 1, 4);
+  std::memcpy(&id, raw + 5, 4);
+  return true;
+}
+
+int CityPager::page(const std::string &token, Uint32 size,
+                    std::vector<CityRow> &rows, std::string &next)
+{
+  rows.clear();
+  next.clear();
+
+  Int32 lastPopulation = 0, lastId = 0;
+  bool resume = !token.empty();
+  if (resume && !parse_token(token, lastPopulation, lastId)) {
+    std::cerr << "Invalid resume token." << std::endl;
+    return -1;
+  }
+
+  // Skip what the previous pages returned: NOT (Population = last AND
+  // ID <= last). Rows below the last Population are cut off by the bound.
+  NdbInterpretedCode code(table);
+  if (resume) {
+    NdbScanFilter filter(&code);
+    if (filter.begin(NdbScanFilter::NAND) < 0 ||
+        filter.cmp(NdbScanFilter::COND_EQ,
+                   table->getColumn("Population")->getColumnNo(),
+                   &lastPopulation, sizeof(lastPopulation)) < 0 ||
+        filter.cmp(NdbScanFilter::COND_LE,
+                   table->getColumn("ID")->getColumnNo(),
+                   &lastId, sizeof(lastId)) < 0 ||
+        filter.end() < 0) {
+      print_error(filter.getNdbError(), "Failed to set a filter.");
+      return -1;
+    }
+  }
+
+  NdbTransaction *myTransaction = ndb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(ndb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  // One page, plus the row telling whether there is more, fits in the
+  // first batch of every fragment
+  NdbScanOperation::ScanOptions options;
+  options.optionsPresent =
+    NdbScanOperation::ScanOptions::SO_SCANFLAGS |
+    NdbScanOperation::ScanOptions::SO_BATCH;
+  options.scan_flags = NdbScanOperation::SF_OrderBy;
+  options.batch = size + 1;
+  if (resume) {
+    options.optionsPresent |= NdbScanOperation::ScanOptions::SO_INTERPRETED;
+    options.interpretedCode = &code;
+  }
+
+  CityRow low;
+  low.Population = lastPopulation;
+  NdbIndexScanOperation::IndexBound bound;
+  bound.low_key = (char*) &low;
+  bound.low_key_count = 1;
+  bound.low_inclusive = true;
+  bound.high_key = NULL;
+  bound.high_key_count = 0;
+  bound.high_inclusive = false;
+  bound.range_no = 0;
+
+  NdbIndexScanOperation *isop =
+    myTransaction->scanIndex(indexRecord,
+                             valsRecord,
+                             NdbOperation::LM_CommittedRead,
+                             NULL,
+                             resume ? &bound : NULL,
+                             &options,
+                             sizeof(NdbScanOperation::ScanOptions));
+  if (isop == NULL ||
+      myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    ndb->closeTransaction(myTransaction);
+    return -1;
+  }
+
+  // Read past the page until the Population of its last row is complete
+  int check;
+  const CityRow *row;
+  while ((check = isop->nextResult((const char**) &row, true, false)) == 0) {
+    rows.push_back(*row);
+    if (rows.size() > size &&
+        rows.back().Population != rows[size - 1].Population)
+      break;
+  }
+
+  if (check == -1) {
+    print_error(myTransaction->getNdbError(), "Error during index scan.");
+    ndb->closeTransaction(myTransaction);
+    return -1;
+  }
+  isop->close(false, true);
+  ndb->closeTransaction(myTransaction);
+
+  std::sort(rows.begin(), rows.end(), row_less);
+  if (rows.size() > size) {
+    rows.resize(size);
+    next = make_token(rows.back().Population, rows.back().ID);
+  }
+  return 0;
+}
+
+class KeysetPaginationExample {
+public:
+  KeysetPaginationExample() : cluster_connection(NULL), myNdb(NULL),
+                              myDict(NULL), myTable(NULL), myIndex(NULL),
+                              valsRecord(NULL), indexRecord(NULL) {};
+  ~KeysetPaginationExample();
+  int doTest(Uint32 pageSize, int pages, int thinkMs);
+
+private:
+  struct Result {
+    int pages;
+    Uint64 rows;
+    double avg_ms, p99_ms;
+    // Estimates: one scan record per fragment while a scan is open
+    Uint32 heldScanRecords;   // between pages
+    double scanRecordSeconds; // held over the whole run
+  };
+
+  int run_keyset(Uint32 pageSize, int pages, int thinkMs, Result &result);
+  int run_open_scan(Uint32 pageSize, int pages, int thinkMs,
+                    Result &result);
+  void summarize(std::vector<double> &latencies, Result &result);
+  void report(const char *label, const Result &r);
+
+  std::string char_to_str(const char *s, int max_len)
+  {
+    std::string str(s, max_len);
+    return str.substr(0, str.find_last_not_of(" ") + 1);
+  }
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *cluster_connection;
+  Ndb *myNdb;
+  NdbDictionary::Dictionary* myDict;
+  const NdbDictionary::Table *myTable;
+  const NdbDictionary::Index *myIndex;
+  const NdbRecord *valsRecord, *indexRecord;
+};
+
+int KeysetPaginationExample::doTest(Uint32 pageSize, int pages, int thinkMs)
+{
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  // Step 2. Connecting to the cluster
+  cluster_connection = new Ndb_cluster_connection(connectstring);
+  if (cluster_connection->connect(4 /* retries               */,
+                                  5 /* delay between retries */,
+                                  1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (cluster_connection->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+
+  // Step 3. Connect to 'world' database
+  myNdb = new Ndb(cluster_connection, db);
+  if (myNdb->init()) {
+    print_error(myNdb->getNdbError(),
+                "Could not connect to the database object.");
+    return 3;
+  }
+
+  // Step 4. Get table metadata
+  myDict = myNdb->getDictionary();
+  if ((myTable = myDict->getTable("City")) == NULL ||
+      (myIndex = myDict->getIndex("Population", "City")) == NULL) {
+    print_error(myDict->getNdbError(), "Could not retrieve metadata.");
+    return 4;
+  }
+
+  // Step 5. Define NdbRecord's
+  NdbDictionary::RecordSpecification recordSpec[5];
+  std::memset(recordSpec, 0, sizeof recordSpec);
+  int rsSize = sizeof(recordSpec[0]);
+
+  recordSpec[0].column = myTable->getColumn("ID");
+  recordSpec[0].offset = offsetof(struct CityRow, ID);
+  recordSpec[1].column = myTable->getColumn("Name");
+  recordSpec[1].offset = offsetof(struct CityRow, Name);
+  recordSpec[2].column = myTable->getColumn("CountryCode");
+  recordSpec[2].offset = offsetof(struct CityRow, CountryCode);
+  recordSpec[3].column = myTable->getColumn("District");
+  recordSpec[3].offset = offsetof(struct CityRow, District);
+  recordSpec[4].column = myTable->getColumn("Population");
+  recordSpec[4].offset = offsetof(struct CityRow, Population);
+
+  valsRecord = myDict->createRecord(myTable, recordSpec, 5, rsSize);
+  indexRecord = myDict->createRecord(myIndex, &recordSpec[4], 1, rsSize);
+  if (valsRecord == NULL || indexRecord == NULL) {
+    print_error(myDict->getNdbError(), "Failed to initialize NdbRecords'.");
+    return 5;
+  }
+
+  // Step 6. The first two pages
+  CityPager pager(myNdb, myTable, indexRecord, valsRecord);
+  std::string token;
+  std::vector<CityRow> rows;
+  for (int p = 1; p <= 2; p++) {
+    std::string next;
+    if (pager.page(token, 5, rows, next))
+      return 6;
+    std::cout << "========== Page " << p << " ==========" << std::endl;
+    for (size_t i = 0; i < rows.size(); i++)
+      std::cout << "Id: " << rows[i].ID
+                << ", Name: " << char_to_str(rows[i].Name, 35)
+                << ", Population: " << rows[i].Population << std::endl;
+    std::cout << "Next token: " << (next.empty() ? "(end)" : next)
+              << std::endl;
+    token = next;
+  }
+
+  // Step 7. Page through City both ways
+  Result keyset, open;
+  if (run_keyset(pageSize, pages, thinkMs, keyset) ||
+      run_open_scan(pageSize, pages, thinkMs, open))
+    return 7;
+
+  std::cout << "========== " << pageSize << " rows per page, "
+            << thinkMs << " ms think time ==========" << std::endl;
+  report("keyset pages", keyset);
+  report("open scan   ", open);
+  return 0;
+}
+
+// Every page is its own transaction; nothing is held between pages
+int KeysetPaginationExample::run_keyset(Uint32 pageSize, int pages,
+                                        int thinkMs, Result &result)
+{
+  CityPager pager(myNdb, myTable, indexRecord, valsRecord);
+  std::vector<double> latencies;
+  std::set<Int32> seen;
+  std::string token;
+  CityRow prev;
+  prev.Population = 0;
+  prev.ID = 0;
+  result.rows = 0;
+
+  for (int p = 0; p < pages; p++) {
+    std::vector<CityRow> rows;
+    std::string next;
+    Clock::time_point start = Clock::now();
+    if (pager.page(token, pageSize, rows, next))
+      return -1;
+    latencies.push_back(std::chrono::duration<double, std::milli>(
+                          Clock::now() - start).count());
+
+    // Pages must continue each other without gaps or repeats
+    for (size_t i = 0; i < rows.size(); i++) {
+      bool ordered = rows[i].Population > prev.Population ||
+                     (rows[i].Population == prev.Population &&
+                      rows[i].ID > prev.ID);
+      if ((result.rows > 0 && !ordered) || !seen.insert(rows[i].ID).second) {
+        std::cerr << "Page " << p << " is out of order at ID "
+                  << rows[i].ID << "." << std::endl;
+        return -1;
+      }
+      prev = rows[i];
+      result.rows++;
+    }
+
+    if (next.empty())
+      break;
+    token = next;
+    std::this_thread::sleep_for(std::chrono::milliseconds(thinkMs));
+  }
+
+  summarize(latencies, result);
+  result.heldScanRecords = 0;
+  result.scanRecordSeconds = 0;
+  for (size_t i = 0; i < latencies.size(); i++)
+    result.scanRecordSeconds +=
+      latencies[i] / 1000.0 * myTable->getFragmentCount();
+  return 0;
+}
+
+// One ordered scan kept open across pages, as do_index_scan_read() would
+// have to be used for paging
+int KeysetPaginationExample::run_open_scan(Uint32 pageSize, int pages,
+                                           int thinkMs, Result &result)
+{
+  Clock::time_point opened = Clock::now();
+  NdbTransaction *myTransaction = myNdb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(myNdb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  NdbScanOperation::ScanOptions options;
+  options.optionsPresent = NdbScanOperation::ScanOptions::SO_SCANFLAGS;
+  options.scan_flags = NdbScanOperation::SF_OrderBy;
+
+  NdbIndexScanOperation *isop =
+    myTransaction->scanIndex(indexRecord,
+                             valsRecord,
+                             NdbOperation::LM_CommittedRead,
+                             NULL,
+                             NULL,
+                             &options,
+                             sizeof(NdbScanOperation::ScanOptions));
+  if (isop == NULL ||
+      myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    myNdb->closeTransaction(myTransaction);
+    return -1;
+  }
+
+  std::vector<double> latencies;
+  result.rows = 0;
+  int check = 0;
+  for (int p = 0; p < pages && check == 0; p++) {
+    Clock::time_point start = Clock::now();
+    const CityRow *row;
+    for (Uint32 i = 0; i < pageSize; i++) {
+      check = isop->nextResult((const char**) &row, true, false);
+      if (check != 0)
+        break;
+      result.rows++;
+    }
+    latencies.push_back(std::chrono::duration<double, std::milli>(
+                          Clock::now() - start).count());
+    if (check == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(thinkMs));
+  }
+
+  if (check == -1) {
+    print_error(myTransaction->getNdbError(), "Error during index scan.");
+    myNdb->closeTransaction(myTransaction);
+    return -1;
+  }
+  myNdb->closeTransaction(myTransaction);
+
+  summarize(latencies, result);
+  result.heldScanRecords = myTable->getFragmentCount();
+  result.scanRecordSeconds =
+    std::chrono::duration<double>(Clock::now() - opened).count() *
+    myTable->getFragmentCount();
+  return 0;
+}
+
+void KeysetPaginationExample::summarize(std::vector<double> &latencies,
+                                        Result &result)
+{
+  result.pages = (int) latencies.size();
+  double sum = 0;
+  for (size_t i = 0; i < latencies.size(); i++)
+    sum += latencies[i];
+  std::sort(latencies.begin(), latencies.end());
+  result.avg_ms = latencies.empty() ? 0 : sum / latencies.size();
+  result.p99_ms = latencies.empty() ? 0
+                : latencies[latencies.size() * 99 / 100];
+}
+
+void KeysetPaginationExample::report(const char *label, const Result &r)
+{
+  std::cout << label << std::fixed << std::setprecision(3)
+            << "  pages " << r.pages
+            << ", rows " << r.rows
+            << ", avg " << r.avg_ms << " ms"
+            << ", p99 " << r.p99_ms << " ms"
+            << ", est. scan records held between pages " << r.heldScanRecords
+            << ", est. scan record seconds " << r.scanRecordSeconds
+            << std::endl;
+}
+
+KeysetPaginationExample::~KeysetPaginationExample()
+{
+  // Step 8. Cleanup
+  if (myNdb) delete myNdb;
+  if (cluster_connection) delete cluster_connection;
+  ndb_end(0);
+}
+
+int main(int argc, char *argv[])
+{
+  int pageSize = argc > 1 ? std::atoi(argv[1]) : 20;
+  int pages = argc > 2 ? std::atoi(argv[2]) : 50;
+  int thinkMs = argc > 3 ? std::atoi(argv[3]) : 10;
+  if (pageSize <= 0 || pages <= 0 || thinkMs < 0) {
+    std::cerr << "Usage: " << argv[0]
+              << " [page_size] [pages] [think_ms]" << std::endl;
+    return 1;
+  }
+
+  KeysetPaginationExample ex;
+  return ex.doTest(pageSize, pages, thinkMs);
+}
@@ -0,0 +1,790 @@
+// Open-loop load generator.
+//
+// The samples run closed loops: the next operation starts when the last
+// one is done. When the cluster slows down, a closed loop simply sends
+// less, so the queueing delay a real client population would see never
+// appears in its numbers.
+//
+// This generator issues operations at a fixed arrival rate, whatever the
+// state of the cluster. A dispatcher thread creates arrivals at their
+// intended start times and queues them. A pool of worker threads, each
+// with its own Ndb, executes them. The latency of an operation is measured
+// from its intended start time, not from the moment a worker picked it
+// up. Time spent waiting for a free worker is therefore counted, which
+// corrects for coordinated omission. The service time, measured from the
+// pick-up, is reported next to it.
+//
+// The operations are the access paths of the samples:
+//   pk      Country read by primary key (read_tuples_record.cc)
+//   scan    City table scan filtered on CountryCode (do_scan_read)
+//   range   Population index range scan over 20 cities (do_index_scan_read)
+//   update  scan with exclusive lock and updateCurrentTuple() of the
+//           cities of one country (do_scan_update). CountryCode is written
+//           back unchanged, so runs leave the table as it was.
+// Keys (country codes and Population ranks) are uniform, Zipfian with
+// parameter theta, or hotspot: `hot` of all accesses go to `hotkeys` of
+// the keys.
+//
+// A sweep runs each arrival rate for a few seconds. It stops at the first
+// rate the cluster cannot keep up with, where the completed rate falls
+// below 95% of the target or the p99 latency exceeds ten times that of
+// the first rate. The rate before that one is the saturation knee.
+//
+// Usage: load_generator [key=value ...]
+//   rate=0               fixed rate in operations/s; 0 runs the sweep
+//   sweep=1000:20000:1000  first:last:step of the sweep
+//   seconds=3            per rate
+//   threads=16           workers
+//   mix=pk:70,scan:5,range:20,update:5
+//   dist=uniform         uniform, zipf or hotspot
+//   theta=0.99           Zipf parameter
+//   hot=0.9 hotkeys=0.1  hotspot shares
+#include <NdbApi.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cmath>
+#include <stddef.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+const char *connectstring = "127.0.0.1:1186";
+const char *db = "world";
+
+typedef std::chrono::steady_clock Clock;
+
+struct CountryRow {
+  char   nullBits;
+  char   Code[3];
+  char   Name[52];
+  Uint32 Capital;
+};
+
+struct CityRow {
+  Int32 ID;
+  char  Name[35];
+  char  CountryCode[3];
+  char  District[20];
+  Int32 Population;
+};
+
+enum OpType { OpPk, OpScan, OpRange, OpUpdate, NumOpTypes };
+static const char *opNames[NumOpTypes] = { "pk", "scan", "range", "update" };
+
+// Rows of a Population range scan
+static const size_t rangeWidth = 20;
+
+// Picks key indexes 0..n-1. Ranks are shuffled once so that the hot keys
+// are spread over the table, not the first ones in key order.
+class KeyChooser {
+public:
+  enum Distribution { Uniform, Zipf, Hotspot };
+
+  KeyChooser(size_t n, Distribution dist, double theta, double hot,
+             double hotKeys, std::mt19937 &rng)
+    : dist(dist), hot(hot), permutation(n)
+  {
+    for (size_t i = 0; i < n; i++)
+      permutation[i] = i;
+    std::shuffle(permutation.begin(), permutation.end(), rng);
+    hotCount = std::max((size_t) 1, (size_t) (hotKeys * n));
+    if (dist == Zipf) {
+      cdf.resize(n);
+      double sum = 0;
+      for (size_t i = 0; i < n; i++)
+        cdf[i] = (sum += 1 / std::pow((double) (i + 1), theta));
+      for (size_t i = 0; i < n; i++)
+        cdf[i] /= sum;
+    }
+  }
+
+  size_t next(std::mt19937 &rng)
+  {
+    std::uniform_real_distribution<double> u(0, 1);
+    size_t n = permutation.size(), rank;
+    switch (dist) {
+    case Zipf:
+      rank = std::lower_bound(cdf.begin(), cdf.end(), u(rng)) - cdf.begin();
+      break;
+    case Hotspot:
+      if (u(rng) < hot || hotCount >= n)
+        rank = rng() % hotCount;
+      else
+        rank = hotCount + rng() % (n - hotCount);
+      break;
+    default:
+      rank = rng() % n;
+    }
+    return permutation[std::min(rank, n - 1)];
+  }
+
+private:
+  Distribution dist;
+  double hot;
+  size_t hotCount;
+  std::vector<size_t> permutation;
+  std::vector<double> cdf;
+};
+
+struct Options {
+  int rate;
+  int sweepFirst, sweepLast, sweepStep;
+  int seconds;
+  int threads;
+  int mix[NumOpTypes];
+  KeyChooser::Distribution dist;
+  double theta, hot, hotKeys;
+};
+
+class LoadGenerator {
+public:
+  LoadGenerator(const Options &opts)
+    : cluster_connection(NULL), myNdb(NULL), myDict(NULL),
+      countryTable(NULL), cityTable(NULL), opts(opts) {};
+  ~LoadGenerator();
+  int doTest();
+
+private:
+  struct Arrival {
+    Clock::time_point intended;
+    OpType type;
+    size_t key;
+  };
+
+  struct Result {
+    double target, achieved;
+    Uint64 ops, failed;
+    // Microseconds from the intended start, and service times
+    std::vector<double> latency[NumOpTypes], service[NumOpTypes];
+    size_t maxBacklog;
+  };
+
+  struct Percentiles {
+    double p50, p99, p999, max;
+  };
+
+  int load_keys();
+  int run_rate(int rate, Result &result);
+  void dispatch(int rate, Result &result);
+  void work(Ndb *ndb, Result &result, std::mutex &resultMutex);
+  int execute(Ndb *ndb, const Arrival &a);
+  int pk_read(Ndb *ndb, size_t key);
+  int city_scan(Ndb *ndb, size_t key, bool update);
+  int range_scan(Ndb *ndb, size_t key);
+  int fetch_all(NdbTransaction *trans, NdbScanOperation *sop, bool update);
+  static Percentiles percentiles(std::vector<double> &v);
+  void report(const Result &r);
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *cluster_connection;
+  Ndb *myNdb;
+  NdbDictionary::Dictionary* myDict;
+  const NdbDictionary::Table *countryTable, *cityTable;
+  const NdbDictionary::Index *myIndex;
+  const NdbRecord *countryPk, *countryVals, *cityVals, *populationKey;
+  const NdbDictionary::Column *countryCodeCol;
+  Options opts;
+
+  std::vector<std::string> codes;      // Country primary keys
+  std::vector<Int32> populations;      // sorted City populations
+
+  // Queue between the dispatcher and the workers
+  std::mutex queueMutex;
+  std::condition_variable queueReady;
+  std::deque<Arrival> queue;
+  bool dispatchDone;
+};
+
+int LoadGenerator::doTest()
+{
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  // Step 2. Connecting to the cluster
+  cluster_connection = new Ndb_cluster_connection(connectstring);
+  if (cluster_connection->connect(4 /* retries               */,
+                                  5 /* delay between retries */,
+                                  1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (cluster_connection->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+
+  // Step 3. Connect to 'world' database
+  myNdb = new Ndb(cluster_connection, db);
+  if (myNdb->init()) {
+    print_error(myNdb->getNdbError(),
+                "Could not connect to the database object.");
+    return 3;
+  }
+
+  // Step 4. Get table metadata
+  myDict = myNdb->getDictionary();
+  if ((countryTable = myDict->getTable("Country")) == NULL ||
+      (cityTable = myDict->getTable("City")) == NULL) {
+    print_error(myDict->getNdbError(), "Could not retrieve a table.");
+    return 4;
+  }
+  if ((myIndex = myDict->getIndex("Population", "City")) == NULL) {
+    print_error(myDict->getNdbError(), "Could not retrieve an index.");
+    return 4;
+  }
+  countryCodeCol = cityTable->getColumn("CountryCode");
+
+  // Step 5. Define NdbRecord's; they are shared by all workers
+  NdbDictionary::RecordSpecification recordSpec[5];
+  std::memset(recordSpec, 0, sizeof recordSpec);
+  int rsSize = sizeof(recordSpec[0]);
+
+  recordSpec[0].column = countryTable->getColumn("Code");
+  recordSpec[0].offset = offsetof(struct CountryRow, Code);
+  recordSpec[1].column = countryTable->getColumn("Name");
+  recordSpec[1].offset = offsetof(struct CountryRow, Name);
+  recordSpec[2].column = countryTable->getColumn("Capital");
+  recordSpec[2].offset = offsetof(struct CountryRow, Capital);
+  recordSpec[2].nullbit_byte_offset = offsetof(struct CountryRow, nullBits);
+  recordSpec[2].nullbit_bit_in_byte = 0;
+  countryPk = myDict->createRecord(countryTable, recordSpec, 1, rsSize);
+  countryVals = myDict->createRecord(countryTable, recordSpec, 3, rsSize);
+
+  std::memset(recordSpec, 0, sizeof recordSpec);
+  recordSpec[0].column = cityTable->getColumn("ID");
+  recordSpec[0].offset = offsetof(struct CityRow, ID);
+  recordSpec[1].column = cityTable->getColumn("Name");
+  recordSpec[1].offset = offsetof(struct CityRow, Name);
+  recordSpec[2].column = countryCodeCol;
+  recordSpec[2].offset = offsetof(struct CityRow, CountryCode);
+  recordSpec[3].column = cityTable->getColumn("District");
+  recordSpec[3].offset = offsetof(struct CityRow, District);
+  recordSpec[4].column = cityTable->getColumn("Population");
+  recordSpec[4].offset = offsetof(struct CityRow, Population);
+  cityVals = myDict->createRecord(cityTable, recordSpec, 5, rsSize);
+  populationKey = myDict->createRecord(myIndex, &recordSpec[4], 1, rsSize);
+
+  if (countryPk == NULL || countryVals == NULL || cityVals == NULL ||
+      populationKey == NULL) {
+    print_error(myDict->getNdbError(), "Failed to initialize NdbRecords'.");
+    return 5;
+  }
+
+  // Step 6. Collect the keys the operations choose from
+  if (load_keys())
+    return 6;
+
+  // Step 7. Run the fixed rate, or sweep until saturation
+  std::cout << "mix";
+  for (int t = 0; t < NumOpTypes; t++)
+    std::cout << " " << opNames[t] << ":" << opts.mix[t];
+  std::cout << ", " << opts.threads << " workers, " << opts.seconds
+            << " s per rate" << std::endl;
+  std::cout << "    target  achieved      p50      p99    p99.9      max"
+            << "  svc p99  backlog   (latency in us from intended start)"
+            << std::endl;
+
+  if (opts.rate > 0) {
+    Result r;
+    if (run_rate(opts.rate, r))
+      return 7;
+    report(r);
+    return 0;
+  }
+
+  double baseP99 = 0;
+  int knee = 0;
+  bool saturated = false;
+  for (int rate = opts.sweepFirst; rate <= opts.sweepLast;
+       rate += opts.sweepStep) {
+    Result r;
+    if (run_rate(rate, r))
+      return 7;
+    report(r);
+
+    std::vector<double> all;
+    for (int t = 0; t < NumOpTypes; t++)
+      all.insert(all.end(), r.latency[t].begin(), r.latency[t].end());
+    double p99 = percentiles(all).p99;
+    if (baseP99 == 0)
+      baseP99 = p99;
+    if (r.achieved < 0.95 * r.target || p99 > 10 * baseP99) {
+      saturated = true;
+      break;
+    }
+    knee = rate;
+  }
+
+  if (!saturated)
+    std::cout << "No saturation up to " << knee << " ops/s." << std::endl;
+  else if (knee == 0)
+    std::cout << "Saturated at the first rate; lower sweep=." << std::endl;
+  else
+    std::cout << "Saturation knee at about " << knee << " ops/s."
+              << std::endl;
+  return 0;
+}
+
+int LoadGenerator::load_keys()
+{
+  NdbTransaction *myTransaction = myNdb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(myNdb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  NdbScanOperation *csop =
+    myTransaction->scanTable(countryPk, NdbOperation::LM_CommittedRead);
+  NdbScanOperation *psop =
+    myTransaction->scanTable(cityVals, NdbOperation::LM_CommittedRead);
+  if (csop == NULL || psop == NULL ||
+      myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    myNdb->closeTransaction(myTransaction);
+    return -1;
+  }
+
+  int check;
+  const CountryRow *country;
+  while ((check = csop->nextResult((const char**) &country, true,
+                                   false)) == 0)
+    codes.push_back(std::string(country->Code, 3));
+  const CityRow *city;
+  if (check != -1)
+    while ((check = psop->nextResult((const char**) &city, true,
+                                     false)) == 0)
+      populations.push_back(city->Population);
+  myNdb->closeTransaction(myTransaction);
+
+  if (check == -1 || codes.empty() || populations.size() <= rangeWidth) {
+    std::cerr << "Could not read the keys." << std::endl;
+    return -1;
+  }
+  std::sort(populations.begin(), populations.end());
+  return 0;
+}
+
+int LoadGenerator::run_rate(int rate, Result &result)
+{
+  result.target = rate;
+  result.ops = result.failed = 0;
+  result.maxBacklog = 0;
+  dispatchDone = false;
+
+  // Connect the workers before the clock starts
+  std::vector<Ndb*> ndbs;
+  for (int i = 0; i < opts.threads; i++) {
+    Ndb *ndb = new Ndb(cluster_connection, db);
+    ndbs.push_back(ndb);
+    if (ndb->init()) {
+      print_error(ndb->getNdbError(),
+                  "Could not connect to the database object.");
+      for (size_t j = 0; j < ndbs.size(); j++)
+        delete ndbs[j];
+      return -1;
+    }
+  }
+
+  std::mutex resultMutex;
+  std::vector<std::thread> workers;
+  for (int i = 0; i < opts.threads; i++)
+    workers.push_back(std::thread(&LoadGenerator::work, this, ndbs[i],
+                                  std::ref(result), std::ref(resultMutex)));
+
+  Clock::time_point start = Clock::now();
+  dispatch(rate, result);
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+  double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+  for (size_t i = 0; i < ndbs.size(); i++)
+    delete ndbs[i];
+  result.achieved = result.ops / secs;
+  return 0;
+}
+
+// Creates the arrivals at their intended times. Being late never drops
+// or delays an arrival's intended time, it only grows the queue.
+void LoadGenerator::dispatch(int rate, Result &result)
+{
+  std::mt19937 rng(rate);
+  KeyChooser countryKeys(codes.size(), opts.dist, opts.theta, opts.hot,
+                         opts.hotKeys, rng);
+  KeyChooser rangeKeys(populations.size() - rangeWidth, opts.dist,
+                       opts.theta, opts.hot, opts.hotKeys, rng);
+  int mixTotal = 0;
+  for (int t = 0; t < NumOpTypes; t++)
+    mixTotal += opts.mix[t];
+
+  Uint64 total = (Uint64) rate * opts.seconds;
+  std::chrono::nanoseconds interval(1000000000LL / rate);
+  Clock::time_point start = Clock::now();
+
+  for (Uint64 i = 0; i < total; i++) {
+    Arrival a;
+    a.intended = start + interval * (Int64) i;
+    int pick = rng() % mixTotal, t = 0;
+    while (pick >= opts.mix[t])
+      pick -= opts.mix[t++];
+    a.type = (OpType) t;
+    a.key = a.type == OpRange ? rangeKeys.next(rng) : countryKeys.next(rng);
+
+    std::this_thread::sleep_until(a.intended);
+    std::lock_guard<std::mutex> guard(queueMutex);
+    queue.push_back(a);
+    result.maxBacklog = std::max(result.maxBacklog, queue.size());
+    queueReady.notify_one();
+  }
+
+  std::lock_guard<std::mutex> guard(queueMutex);
+  dispatchDone = true;
+  queueReady.notify_all();
+}
+
+void LoadGenerator::work(Ndb *ndb, Result &result, std::mutex &resultMutex)
+{
+  std::vector<double> latency[NumOpTypes], service[NumOpTypes];
+  Uint64 ops = 0, failed = 0;
+
+  for (;;) {
+    Arrival a;
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      queueReady.wait(lock, [this] { return !queue.empty() || dispatchDone; });
+      if (queue.empty())
+        break;
+      a = queue.front();
+      queue.pop_front();
+    }
+
+    Clock::time_point picked = Clock::now();
+    if (execute(ndb, a)) {
+      failed++;
+      continue;
+    }
+    Clock::time_point done = Clock::now();
+    latency[a.type].push_back(std::chrono::duration<double, std::micro>(
+                                done - a.intended).count());
+    service[a.type].push_back(std::chrono::duration<double, std::micro>(
+                                done - picked).count());
+    ops++;
+  }
+
+  std::lock_guard<std::mutex> guard(resultMutex);
+  for (int t = 0; t < NumOpTypes; t++) {
+    result.latency[t].insert(result.latency[t].end(),
+                             latency[t].begin(), latency[t].end());
+    result.service[t].insert(result.service[t].end(),
+                             service[t].begin(), service[t].end());
+  }
+  result.ops += ops;
+  result.failed += failed;
+}
+
+int LoadGenerator::execute(Ndb *ndb, const Arrival &a)
+{
+  switch (a.type) {
+  case OpPk:     return pk_read(ndb, a.key);
+  case OpScan:   return city_scan(ndb, a.key, false);
+  case OpRange:  return range_scan(ndb, a.key);
+  case OpUpdate: return city_scan(ndb, a.key, true);
+  default:       return -1;
+  }
+}
+
+int LoadGenerator::pk_read(Ndb *ndb, size_t key)
+{
+  CountryRow row;
+  std::memcpy(row.Code, codes[key].data(), 3);
+  NdbTransaction *myTransaction =
+    ndb->startTransaction(countryTable, row.Code, sizeof(row.Code));
+  if (myTransaction == NULL) {
+    print_error(ndb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  const NdbOperation *op =
+    myTransaction->readTuple(countryPk, (char*) &row,
+                             countryVals, (char*) &row,
+                             NdbOperation::LM_CommittedRead);
+  if (op == NULL ||
+      myTransaction->execute( NdbTransaction::Commit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Read failed.");
+    ndb->closeTransaction(myTransaction);
+    return -1;
+  }
+  ndb->closeTransaction(myTransaction);
+  return 0;
+}
+
+// The cities of one country: a filtered table scan, or with `update` the
+// scan update of do_scan_update
+int LoadGenerator::city_scan(Ndb *ndb, size_t key, bool update)
+{
+  NdbTransaction *myTransaction = ndb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(ndb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  NdbInterpretedCode code(cityTable);
+  NdbScanFilter filter(&code);
+  if (filter.begin(NdbScanFilter::AND) < 0 ||
+      filter.cmp(NdbScanFilter::COND_EQ, countryCodeCol->getColumnNo(),
+                 codes[key].data(), 3) < 0 ||
+      filter.end() < 0) {
+    print_error(filter.getNdbError(), "Failed to set a filter.");
+    ndb->closeTransaction(myTransaction);
+    return -1;
+  }
+
+  NdbScanOperation::ScanOptions options;
+  options.optionsPresent =
+    NdbScanOperation::ScanOptions::SO_SCANFLAGS |
+    NdbScanOperation::ScanOptions::SO_INTERPRETED;
+  options.scan_flags = update ? NdbScanOperation::SF_KeyInfo
+                              : NdbScanOperation::SF_TupScan;
+  options.interpretedCode = &code;
+
+  NdbScanOperation *sop =
+    myTransaction->scanTable(cityVals,
+                             update ? NdbOperation::LM_Exclusive
+                                    : NdbOperation::LM_CommittedRead,
+                             NULL, &options,
+                             sizeof(NdbScanOperation::ScanOptions));
+  if (sop == NULL ||
+      myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    ndb->closeTransaction(myTransaction);
+    return -1;
+  }
+
+  int res = fetch_all(myTransaction, sop, update);
+  ndb->closeTransaction(myTransaction);
+  return res;
+}
+
+int LoadGenerator::range_scan(Ndb *ndb, size_t key)
+{
+  NdbTransaction *myTransaction = ndb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(ndb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  CityRow low, high;
+  low.Population = populations[key];
+  high.Population = populations[key + rangeWidth];
+  NdbIndexScanOperation::IndexBound bound;
+  bound.low_key = (char*) &low;
+  bound.low_key_count = 1;
+  bound.low_inclusive = true;
+  bound.high_key = (char*) &high;
+  bound.high_key_count = 1;
+  bound.high_inclusive = false;
+  bound.range_no = 0;
+
+  NdbIndexScanOperation *isop =
+    myTransaction->scanIndex(populationKey, cityVals,
+                             NdbOperation::LM_CommittedRead, NULL, &bound);
+  if (isop == NULL ||
+      myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    ndb->closeTransaction(myTransaction);
+    return -1;
+  }
+
+  int res = fetch_all(myTransaction, isop, false);
+  ndb->closeTransaction(myTransaction);
+  return res;
+}
+
+int LoadGenerator::fetch_all(NdbTransaction *trans, NdbScanOperation *sop,
+                             bool update)
+{
+  int check;
+  bool needToFetch = true;
+  CityRow *row;
+  while ((check = sop->nextResult((const char**) &row,
+                                  needToFetch, false)) >= 0) {
+    if (check == 0) {
+      needToFetch = false;
+      if (update &&
+          sop->updateCurrentTuple(trans, cityVals, (char*) row) == NULL) {
+        print_error(trans->getNdbError(), "Failed update row.");
+        return -1;
+      }
+    } else if (check == 2) {
+      // Send the updates of this batch before fetching the next
+      if (update && trans->execute( NdbTransaction::NoCommit ) == -1)
+        break;
+      needToFetch = true;
+    } else {
+      break;
+    }
+  }
+  if (check == -1 || trans->execute( NdbTransaction::Commit ) == -1) {
+    print_error(trans->getNdbError(), "Error during scan.");
+    return -1;
+  }
+  return 0;
+}
+
+LoadGenerator::Percentiles LoadGenerator::percentiles(std::vector<double> &v)
+{
+  Percentiles p = { 0, 0, 0, 0 };
+  if (v.empty())
+    return p;
+  std::sort(v.begin(), v.end());
+  size_t n = v.size();
+  p.p50 = v[n / 2];
+  p.p99 = v[n * 99 / 100];
+  p.p999 = v[n * 999 / 1000];
+  p.max = v[n - 1];
+  return p;
+}
+
+void LoadGenerator::report(const Result &r)
+{
+  std::vector<double> all, allService;
+  for (int t = 0; t < NumOpTypes; t++) {
+    all.insert(all.end(), r.latency[t].begin(), r.latency[t].end());
+    allService.insert(allService.end(), r.service[t].begin(),
+                      r.service[t].end());
+  }
+  Percentiles p = percentiles(all);
+  Percentiles s = percentiles(allService);
+
+  std::cout << std::fixed << std::setprecision(0)
+            << std::setw(10) << r.target << std::setw(10) << r.achieved
+            << std::setw(9) << p.p50 << std::setw(9) << p.p99
+            << std::setw(9) << p.p999 << std::setw(9) << p.max
+            << std::setw(9) << s.p99 << std::setw(9) << r.maxBacklog;
+  if (r.failed)
+    std::cout << "  (" << r.failed << " failed)";
+  std::cout << std::endl;
+
+  for (int t = 0; t < NumOpTypes; t++) {
+    if (r.latency[t].empty())
+      continue;
+    std::vector<double> v(r.latency[t]), sv(r.service[t]);
+    Percentiles pt = percentiles(v);
+    Percentiles st = percentiles(sv);
+    std::cout << std::setw(10) << opNames[t] << std::setw(10)
+              << r.latency[t].size() << std::setw(9) << pt.p50
+              << std::setw(9) << pt.p99 << std::setw(9) << pt.p999
+              << std::setw(9) << pt.max << std::setw(9) << st.p99
+              << std::endl;
+  }
+}
+
+LoadGenerator::~LoadGenerator()
+{
+  // Step 8. Cleanup
+  if (myNdb) delete myNdb;
+  if (cluster_connection) delete cluster_connection;
+  ndb_end(0);
+}
+
+// "pk:70,scan:5,..." into opts.mix
+static bool parse_mix(const std::string &value, Options &opts)
+{
+  std::memset(opts.mix, 0, sizeof opts.mix);
+  size_t pos = 0;
+  int total = 0;
+  while (pos < value.size()) {
+    size_t end = value.find(',', pos);
+    if (end == std::string::npos)
+      end = value.size();
+    std::string item = value.substr(pos, end - pos);
+    size_t colon = item.find(':');
+    int t = 0;
+    while (t < NumOpTypes && item.substr(0, colon) != opNames[t])
+      t++;
+    if (t == NumOpTypes || colon == std::string::npos)
+      return false;
+    opts.mix[t] = std::atoi(item.c_str() + colon + 1);
+    if (opts.mix[t] < 0)
+      return false;
+    total += opts.mix[t];
+    pos = end + 1;
+  }
+  return total > 0;
+}
+
+int main(int argc, char *argv[])
+{
+  Options opts;
+  opts.rate = 0;
+  opts.sweepFirst = 1000;
+  opts.sweepLast = 20000;
+  opts.sweepStep = 1000;
+  opts.seconds = 3;
+  opts.threads = 16;
+  parse_mix("pk:70,scan:5,range:20,update:5", opts);
+  opts.dist = KeyChooser::Uniform;
+  opts.theta = 0.99;
+  opts.hot = 0.9;
+  opts.hotKeys = 0.1;
+
+  bool ok = true;
+  for (int i = 1; i < argc && ok; i++) {
+    std::string arg(argv[i]);
+    size_t eq = arg.find('=');
+    std::string key = arg.substr(0, eq);
+    std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+    if (key == "rate")
+      opts.rate = std::atoi(value.c_str());
+    else if (key == "sweep")
+      ok = std::sscanf(value.c_str(), "%d:%d:%d", &opts.sweepFirst,
+                       &opts.sweepLast, &opts.sweepStep) == 3;
+    else if (key == "seconds")
+      opts.seconds = std::atoi(value.c_str());
+    else if (key == "threads")
+      opts.threads = std::atoi(value.c_str());
+    else if (key == "mix")
+      ok = parse_mix(value, opts);
+    else if (key == "dist" && value == "uniform")
+      opts.dist = KeyChooser::Uniform;
+    else if (key == "dist" && value == "zipf")
+      opts.dist = KeyChooser::Zipf;
+    else if (key == "dist" && value == "hotspot")
+      opts.dist = KeyChooser::Hotspot;
+    else if (key == "theta")
+      opts.theta = std::atof(value.c_str());
+    else if (key == "hot")
+      opts.hot = std::atof(value.c_str());
+    else if (key == "hotkeys")
+      opts.hotKeys = std::atof(value.c_str());
+    else
+      ok = false;
+  }
+  if (!ok || opts.rate < 0 || opts.seconds <= 0 || opts.threads <= 0 ||
+      opts.sweepFirst <= 0 || opts.sweepStep <= 0 ||
+      opts.hotKeys <= 0 || opts.hotKeys > 1) {
+    std::cerr << "Usage: " << argv[0] << " [rate=N] [sweep=first:last:step]"
+              << " [seconds=N] [threads=N] [mix=pk:N,scan:N,range:N,update:N]"
+              << " [dist=uniform|zipf|hotspot] [theta=X] [hot=X]"
+              << " [hotkeys=X]" << std::endl;
+    return 1;
+  }
+
+  LoadGenerator ex(opts);
+  return ex.doTest();
+}
@@ -0,0 +1,765 @@
+// Process-wide metadata and NdbRecord registry.
+//
+// scan_tuples.cc looks up City and its Population index at the start of
+// every do_* function, and NdbApiExample3 builds its own NdbRecords per
+// instance. With many threads, each with its own Ndb, that repeats the
+// dictionary work and keeps one copy of every NdbRecord per thread.
+//
+// MetadataRegistry resolves each table once: the table, its columns, its
+// indexes and the NdbRecords defined on it. The results form an immutable
+// TableEntry that all threads share read-only. Readers take the current
+// entry with get(), which is an atomic load of a shared pointer and needs
+// no lock, and keep it for the length of their operation.
+//
+// A schema change, such as an ALTER TABLE, raises the table's object
+// version. Operations defined with the old NdbRecords then fail with a
+// schema error (241 Invalid schema object version). Readers pass their
+// schema errors to handle_error(), and the registry builds a new entry
+// next to the old one and publishes it. Readers are never stopped. Those
+// holding the old entry finish with it or retry once, and the old
+// generation is freed when the last of them lets go.
+//
+// Optionally a watcher thread also compares versions at a fixed interval,
+// so that a change is picked up before a reader fails on it. That check
+// is not free: the dictionary cache is shared by the whole cluster
+// connection, and every poll drops each registered table from it and
+// reads it again from the data nodes, one dictionary round trip per table
+// even when nothing changed. The watcher is off unless a poll interval is
+// given.
+//
+// Every entry owns an Ndb object, because dictionary objects and
+// NdbRecords live as long as the Dictionary they came from.
+//
+// The demo runs City primary key reads on several threads in three
+// modes:
+//   - resolving the metadata on every call, as scan_tuples.cc does;
+//   - resolving it once per thread, as NdbApiExample3 does;
+//   - using the shared registry.
+// For each mode it reports throughput, dictionary calls and NdbRecords
+// created. Under the stand-in library NDB_STANDIN_ALTER_MS simulates
+// repeated ALTER TABLEs on City.
+//
+// Usage: metadata_registry [threads] [reads per thread] [poll ms]
+//   poll ms defaults to 0, no watcher
+#include <NdbApi.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <stddef.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+const char *connectstring = "127.0.0.1:1186";
+const char *db = "world";
+
+typedef std::chrono::steady_clock Clock;
+
+struct CityRow {
+  Int32 ID;
+  char  Name[35];
+  char  CountryCode[3];
+  char  District[20];
+  Int32 Population;
+};
+
+static bool is_schema_version_error(const NdbError &e)
+{
+  return e.code == 241 ||      // Invalid schema object version
+         e.code == 283 ||      // Table is being dropped
+         e.code == 284;        // Table not defined in transaction coordinator
+}
+
+class MetadataRegistry {
+public:
+  struct ColumnDef {
+    const char *name;
+    Uint32 offset;
+    int nullbitByte;           // -1 when the column is not nullable
+    Uint32 nullbitBit;
+  };
+
+  // An NdbRecord on a table, or on an index of it when `index` is set
+  struct RecordDef {
+    std::string name;
+    std::string table;
+    std::string index;
+    std::vector<ColumnDef> columns;
+  };
+
+  // One resolved version of a table. Immutable once published.
+  class TableEntry {
+  public:
+    ~TableEntry();
+
+    const NdbDictionary::Table *table() const { return tab; }
+    const NdbDictionary::Column *column(const char *name) const;
+    const NdbDictionary::Index *index(const char *name) const;
+    const NdbRecord *record(const char *name) const;
+
+    std::string name;
+    int version;               // schema version it was built from
+    Uint64 generation;         // counts rebuilds within this process
+
+  private:
+    friend class MetadataRegistry;
+    TableEntry() : version(0), generation(0), owner(NULL), tab(NULL) {}
+
+    Ndb *owner;                // the dictionary objects belong to it
+    const NdbDictionary::Table *tab;
+    std::map<std::string, const NdbDictionary::Column*> columns;
+    std::map<std::string, const NdbDictionary::Index*> indexes;
+    std::map<std::string, NdbRecord*> records;
+  };
+  typedef std::shared_ptr<const TableEntry> EntryPtr;
+
+  MetadataRegistry(Ndb_cluster_connection *conn, const char *database)
+    : rebuilds(0), lookups(0), dictCalls(0), recordsCreated(0),
+      conn(conn), database(database),
+      probe(NULL), generations(0), stopping(false),
+      snapshot(std::make_shared<Map>()) {}
+  ~MetadataRegistry();
+
+  // Record definitions are registered before start()
+  void define_record(const RecordDef &def) { defs.push_back(def); }
+
+  // Resolves every table with a record definition and, if poll_ms > 0,
+  // starts the watcher
+  int start(int poll_ms);
+  void stop();
+
+  // The current entry of a table, or an empty pointer if it is unknown
+  EntryPtr get(const std::string &table) const
+  {
+    lookups++;
+    std::shared_ptr<const Map> map = std::atomic_load(&snapshot);
+    Map::const_iterator it = map->find(table);
+    return it == map->end() ? EntryPtr() : it->second;
+  }
+
+  // Called by a reader whose operation on `entry` failed. For a schema
+  // version error the entry is rebuilt, unless another thread did it
+  // already, and the caller should retry with get().
+  bool handle_error(const EntryPtr &entry, const NdbError &error);
+
+  // Compares the version of every table with the dictionary and rebuilds
+  // the entries that changed. Costs a dictionary round trip per table.
+  // Returns the number rebuilt, -1 on error.
+  int refresh();
+
+  std::atomic<Uint64> rebuilds;
+  mutable std::atomic<Uint64> lookups;
+  // getTable, listIndexes and getIndex calls, by build() and refresh()
+  std::atomic<Uint64> dictCalls;
+  std::atomic<Uint64> recordsCreated;
+
+private:
+  typedef std::map<std::string, EntryPtr> Map;
+
+  EntryPtr build(const std::string &table, NdbError &error);
+  int rebuild(const std::string &table);
+  void publish(const EntryPtr &entry);
+  void watch(int poll_ms);
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *conn;
+  std::string database;
+  std::vector<RecordDef> defs;
+  Ndb *probe;                  // for version checks, used by writers only
+  Uint64 generations;
+
+  std::mutex writer;           // serializes rebuilds; readers never take it
+  std::mutex waitMutex;
+  std::condition_variable wakeup;
+  bool stopping;
+  std::thread watcher;
+
+  std::shared_ptr<const Map> snapshot;
+};
+
+MetadataRegistry::TableEntry::~TableEntry()
+{
+  NdbDictionary::Dictionary *dict = owner->getDictionary();
+  for (std::map<std::string, NdbRecord*>::iterator it = records.begin();
+       it != records.end(); ++it)
+    dict->releaseRecord(it->second);
+  delete owner;
+}
+
+const NdbDictionary::Column *
+MetadataRegistry::TableEntry::column(const char *name) const
+{
+  std::map<std::string, const NdbDictionary::Column*>::const_iterator it =
+    columns.find(name);
+  return it == columns.end() ? NULL : it->second;
+}
+
+const NdbDictionary::Index *
+MetadataRegistry::TableEntry::index(const char *name) const
+{
+  std::map<std::string, const NdbDictionary::Index*>::const_iterator it =
+    indexes.find(name);
+  return it == indexes.end() ? NULL : it->second;
+}
+
+const NdbRecord *MetadataRegistry::TableEntry::record(const char *name) const
+{
+  std::map<std::string, NdbRecord*>::const_iterator it = records.find(name);
+  return it == records.end() ? NULL : it->second;
+}
+
+MetadataRegistry::~MetadataRegistry()
+{
+  stop();
+  std::atomic_store(&snapshot, std::make_shared<const Map>());
+  delete probe;
+}
+
+int MetadataRegistry::start(int poll_ms)
+{
+  probe = new Ndb(conn, database.c_str());
+  if (probe->init()) {
+    print_error(probe->getNdbError(), "Could not initialize the probe Ndb.");
+    return -1;
+  }
+
+  std::lock_guard<std::mutex> guard(writer);
+  for (size_t i = 0; i < defs.size(); i++) {
+    if (get(defs[i].table))
+      continue;
+    if (rebuild(defs[i].table))
+      return -1;
+  }
+  rebuilds = 0;
+  if (poll_ms > 0)
+    watcher = std::thread(&MetadataRegistry::watch, this, poll_ms);
+  return 0;
+}
+
+void MetadataRegistry::stop()
+{
+  {
+    std::lock_guard<std::mutex> guard(waitMutex);
+    stopping = true;
+  }
+  wakeup.notify_all();
+  if (watcher.joinable())
+    watcher.join();
+}
+
+// Resolves the table into a new entry, using an Ndb object of its own
+MetadataRegistry::EntryPtr
+MetadataRegistry::build(const std::string &table, NdbError &error)
+{
+  std::shared_ptr<TableEntry> entry(new TableEntry);
+  entry->name = table;
+  entry->owner = new Ndb(conn, database.c_str());
+  if (entry->owner->init()) {
+    error = entry->owner->getNdbError();
+    return EntryPtr();
+  }
+
+  NdbDictionary::Dictionary *dict = entry->owner->getDictionary();
+  dictCalls++;
+  if ((entry->tab = dict->getTable(table.c_str())) == NULL) {
+    error = dict->getNdbError();
+    return EntryPtr();
+  }
+  entry->version = entry->tab->getObjectVersion();
+
+  for (int i = 0; i < entry->tab->getNoOfColumns(); i++) {
+    const NdbDictionary::Column *col = entry->tab->getColumn(i);
+    entry->columns[col->getName()] = col;
+  }
+
+  NdbDictionary::Dictionary::List list;
+  dictCalls++;
+  if (dict->listIndexes(list, table.c_str())) {
+    error = dict->getNdbError();
+    return EntryPtr();
+  }
+  for (unsigned i = 0; i < list.count; i++) {
+    dictCalls++;
+    const NdbDictionary::Index *index =
+      dict->getIndex(list.elements[i].name, table.c_str());
+    if (index == NULL) {
+      error = dict->getNdbError();
+      return EntryPtr();
+    }
+    entry->indexes[list.elements[i].name] = index;
+  }
+
+  for (size_t i = 0; i < defs.size(); i++) {
+    const RecordDef &def = defs[i];
+    if (def.table != table)
+      continue;
+
+    std::vector<NdbDictionary::RecordSpecification> spec(def.columns.size());
+    std::memset(&spec[0], 0, spec.size() * sizeof spec[0]);
+    for (size_t c = 0; c < def.columns.size(); c++) {
+      const ColumnDef &cd = def.columns[c];
+      if ((spec[c].column = entry->column(cd.name)) == NULL) {
+        error.code = 4335;
+        error.message = "Unknown column in record definition";
+        return EntryPtr();
+      }
+      spec[c].offset = cd.offset;
+      if (cd.nullbitByte >= 0) {
+        spec[c].nullbit_byte_offset = cd.nullbitByte;
+        spec[c].nullbit_bit_in_byte = cd.nullbitBit;
+      }
+    }
+
+    NdbRecord *rec;
+    if (def.index.empty()) {
+      rec = dict->createRecord(entry->tab, &spec[0], spec.size(),
+                               sizeof spec[0]);
+    } else {
+      const NdbDictionary::Index *index = entry->index(def.index.c_str());
+      if (index == NULL) {
+        error.code = 4243;
+        error.message = "Index not found";
+        return EntryPtr();
+      }
+      rec = dict->createRecord(index, &spec[0], spec.size(), sizeof spec[0]);
+    }
+    if (rec == NULL) {
+      error = dict->getNdbError();
+      return EntryPtr();
+    }
+    recordsCreated++;
+    entry->records[def.name] = rec;
+  }
+  return entry;
+}
+
+// Called with `writer` held
+int MetadataRegistry::rebuild(const std::string &table)
+{
+  NdbError error;
+  EntryPtr entry = build(table, error);
+  if (!entry) {
+    print_error(error, ("Could not resolve " + table).c_str());
+    return -1;
+  }
+  std::const_pointer_cast<TableEntry>(entry)->generation = ++generations;
+  publish(entry);
+  rebuilds++;
+  return 0;
+}
+
+// Copy on write: readers keep the map they loaded, new readers get the
+// new one
+void MetadataRegistry::publish(const EntryPtr &entry)
+{
+  std::shared_ptr<Map> map =
+    std::make_shared<Map>(*std::atomic_load(&snapshot));
+  (*map)[entry->name] = entry;
+  std::atomic_store(&snapshot, std::shared_ptr<const Map>(map));
+}
+
+bool MetadataRegistry::handle_error(const EntryPtr &entry,
+                                    const NdbError &error)
+{
+  if (!entry || !is_schema_version_error(error))
+    return false;
+
+  std::lock_guard<std::mutex> guard(writer);
+  EntryPtr current = get(entry->name);
+  if (current && current->generation != entry->generation)
+    return true;               // somebody rebuilt it meanwhile
+
+  // The dictionary cache is shared by the whole connection; without this
+  // build() would get the stale table back
+  probe->getDictionary()->invalidateTable(entry->name.c_str());
+  return rebuild(entry->name) == 0;
+}
+
+int MetadataRegistry::refresh()
+{
+  std::lock_guard<std::mutex> guard(writer);
+  std::shared_ptr<const Map> map = std::atomic_load(&snapshot);
+  NdbDictionary::Dictionary *dict = probe->getDictionary();
+  int rebuilt = 0;
+
+  for (Map::const_iterator it = map->begin(); it != map->end(); ++it) {
+    // Drop the cached copy so getTable() asks the data nodes
+    dict->invalidateTable(it->first.c_str());
+    dictCalls++;
+    const NdbDictionary::Table *t = dict->getTable(it->first.c_str());
+    if (t == NULL) {
+      print_error(dict->getNdbError(), "Version check failed.");
+      return -1;
+    }
+    if (t->getObjectVersion() == it->second->version)
+      continue;
+    if (rebuild(it->first))
+      return -1;
+    rebuilt++;
+  }
+  return rebuilt;
+}
+
+void MetadataRegistry::watch(int poll_ms)
+{
+  std::unique_lock<std::mutex> lock(waitMutex);
+  while (!wakeup.wait_for(lock, std::chrono::milliseconds(poll_ms),
+                          [this] { return stopping; })) {
+    lock.unlock();
+    refresh();
+    lock.lock();
+  }
+}
+
+class RegistryExample {
+public:
+  RegistryExample() : cluster_connection(NULL), registry(NULL),
+                      cities(0) {};
+  ~RegistryExample();
+  int doTest(int threads, int reads, int poll_ms);
+
+private:
+  enum Mode { PerCall, PerThread, Shared };
+
+  struct Counters {
+    std::atomic<Uint64> reads, dictCalls, recordsCreated, retries, failures;
+    Counters() : reads(0), dictCalls(0), recordsCreated(0), retries(0),
+                 failures(0) {}
+  };
+
+  // Metadata a thread resolved for itself, as NdbApiExample3 does
+  struct LocalMetadata {
+    const NdbDictionary::Table *table;
+    NdbRecord *pkRecord, *rowRecord;
+    LocalMetadata() : table(NULL), pkRecord(NULL), rowRecord(NULL) {}
+  };
+
+  int run(Mode mode, int threads, int reads, const char *label);
+  void reader(Mode mode, int thread, int reads, Counters &counters);
+  int resolve(NdbDictionary::Dictionary *dict, LocalMetadata &md,
+              Counters &counters);
+  void release(NdbDictionary::Dictionary *dict, LocalMetadata &md);
+  int read_city(Ndb *ndb, const NdbRecord *pkRecord,
+                const NdbRecord *rowRecord, Int32 id, NdbError &error);
+  int show_entry();
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *cluster_connection;
+  MetadataRegistry *registry;
+  int cities;
+};
+
+int RegistryExample::doTest(int threads, int reads, int poll_ms)
+{
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  // Step 2. Connecting to the cluster
+  cluster_connection = new Ndb_cluster_connection(connectstring);
+  if (cluster_connection->connect(4 /* retries               */,
+                                  5 /* delay between retries */,
+                                  1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (cluster_connection->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+
+  // Step 3. Register the NdbRecords used by the readers
+  registry = new MetadataRegistry(cluster_connection, db);
+
+  MetadataRegistry::RecordDef pk = { "pk", "City", "", {} };
+  pk.columns.push_back({ "ID", offsetof(struct CityRow, ID), -1, 0 });
+  registry->define_record(pk);
+
+  MetadataRegistry::RecordDef row = { "row", "City", "", pk.columns };
+  row.columns.push_back({ "Name", offsetof(struct CityRow, Name), -1, 0 });
+  row.columns.push_back({ "CountryCode",
+                          offsetof(struct CityRow, CountryCode), -1, 0 });
+  row.columns.push_back({ "District",
+                          offsetof(struct CityRow, District), -1, 0 });
+  row.columns.push_back({ "Population",
+                          offsetof(struct CityRow, Population), -1, 0 });
+  registry->define_record(row);
+
+  MetadataRegistry::RecordDef population = { "population", "City",
+                                             "Population", {} };
+  population.columns.push_back({ "Population",
+                                 offsetof(struct CityRow, Population),
+                                 -1, 0 });
+  registry->define_record(population);
+
+  // Step 4. Resolve the metadata and start watching schema versions
+  if (registry->start(poll_ms))
+    return 3;
+  if (show_entry())
+    return 4;
+
+  // Step 5. Compare the three ways of getting at the metadata
+  std::cout << "========== " << threads << " threads x " << reads
+            << " City reads ==========" << std::endl;
+  if (run(PerCall, threads, reads, "per call  ") ||
+      run(PerThread, threads, reads, "per thread") ||
+      run(Shared, threads, reads, "registry  "))
+    return 5;
+
+  registry->stop();
+  std::cout << "Registry: " << registry->lookups << " lookups" << std::endl;
+  return 0;
+}
+
+int RegistryExample::show_entry()
+{
+  MetadataRegistry::EntryPtr city = registry->get("City");
+  std::cout << "City: version " << city->version << ", "
+            << city->table()->getNoOfColumns() << " columns, index"
+            << (city->index("Population") ? " Population" : "es: none")
+            << "; resolved with " << registry->dictCalls
+            << " dictionary lookups and " << registry->recordsCreated
+            << " NdbRecords" << std::endl;
+
+  // Rows are numbered 1..n; find n through the Population index
+  Ndb ndb(cluster_connection, db);
+  if (ndb.init()) {
+    print_error(ndb.getNdbError(), "Could not connect to the database object.");
+    return -1;
+  }
+  NdbTransaction *myTransaction = ndb.startTransaction();
+  if (myTransaction == NULL) {
+    print_error(ndb.getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+  NdbIndexScanOperation *sop =
+    myTransaction->scanIndex(city->record("population"),
+                             city->record("row"),
+                             NdbOperation::LM_CommittedRead);
+  if (sop == NULL ||
+      myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    ndb.closeTransaction(myTransaction);
+    return -1;
+  }
+  int check;
+  const CityRow *row;
+  while ((check = sop->nextResult((const char**) &row, true, false)) == 0)
+    if (row->ID > cities)
+      cities = row->ID;
+  ndb.closeTransaction(myTransaction);
+  if (check == -1 || cities == 0) {
+    std::cerr << "Could not read City." << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+int RegistryExample::run(Mode mode, int threads, int reads,
+                         const char *label)
+{
+  Counters counters;
+  Uint64 rebuilds0 = registry->rebuilds;
+  Uint64 dictCalls0 = registry->dictCalls;
+  Uint64 records0 = registry->recordsCreated;
+  Clock::time_point start = Clock::now();
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; i++)
+    workers.push_back(std::thread(&RegistryExample::reader, this, mode, i,
+                                  reads, std::ref(counters)));
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+
+  double secs = std::chrono::duration<double>(Clock::now() - start).count();
+  Uint64 rebuilt = registry->rebuilds - rebuilds0;
+  if (mode == Shared) {
+    // The watcher's version checks and every rebuild, during this run
+    counters.dictCalls = registry->dictCalls - dictCalls0;
+    counters.recordsCreated = registry->recordsCreated - records0;
+  }
+
+  std::cout << label << ": " << std::fixed << std::setprecision(0)
+            << counters.reads / secs << " reads/s, "
+            << counters.dictCalls << " dictionary lookups, "
+            << counters.recordsCreated << " NdbRecords created, "
+            << counters.retries << " schema retries";
+  if (mode == Shared)
+    std::cout << ", " << rebuilt << " rebuilds";
+  std::cout << std::endl;
+  return counters.failures ? -1 : 0;
+}
+
+void RegistryExample::reader(Mode mode, int thread, int reads,
+                             Counters &counters)
+{
+  Ndb ndb(cluster_connection, db);
+  if (ndb.init()) {
+    print_error(ndb.getNdbError(), "Could not connect to the database object.");
+    counters.failures++;
+    return;
+  }
+  NdbDictionary::Dictionary *dict = ndb.getDictionary();
+  LocalMetadata md;
+  if (mode == PerThread && resolve(dict, md, counters)) {
+    counters.failures++;
+    return;
+  }
+
+  Uint32 seed = 12345 + thread;
+  for (int i = 0; i < reads; i++) {
+    seed = seed * 1103515245 + 12345;
+    Int32 id = 1 + (seed >> 8) % cities;
+
+    for (int attempt = 0; ; attempt++) {
+      NdbError error;
+      int res;
+      if (mode == Shared) {
+        MetadataRegistry::EntryPtr city = registry->get("City");
+        res = read_city(&ndb, city->record("pk"), city->record("row"), id,
+                        error);
+        if (res && attempt < 3 && registry->handle_error(city, error)) {
+          counters.retries++;
+          continue;
+        }
+      } else {
+        if (mode == PerCall && resolve(dict, md, counters)) {
+          counters.failures++;
+          return;
+        }
+        res = read_city(&ndb, md.pkRecord, md.rowRecord, id, error);
+        if (mode == PerCall)
+          release(dict, md);
+        if (res && attempt < 3 && is_schema_version_error(error)) {
+          // Resolve again from the dictionary
+          counters.retries++;
+          dict->invalidateTable("City");
+          if (mode == PerThread) {
+            release(dict, md);
+            if (resolve(dict, md, counters)) {
+              counters.failures++;
+              return;
+            }
+          }
+          continue;
+        }
+      }
+      if (res) {
+        print_error(error, "City read failed.");
+        counters.failures++;
+        return;
+      }
+      counters.reads++;
+      break;
+    }
+  }
+  release(dict, md);
+}
+
+int RegistryExample::resolve(NdbDictionary::Dictionary *dict,
+                             LocalMetadata &md, Counters &counters)
+{
+  counters.dictCalls++;
+  if ((md.table = dict->getTable("City")) == NULL) {
+    print_error(dict->getNdbError(), "Could not retrieve a table.");
+    return -1;
+  }
+
+  NdbDictionary::RecordSpecification recordSpec[5];
+  std::memset(recordSpec, 0, sizeof recordSpec);
+  int rsSize = sizeof(recordSpec[0]);
+
+  recordSpec[0].column = md.table->getColumn("ID");
+  recordSpec[0].offset = offsetof(struct CityRow, ID);
+  recordSpec[1].column = md.table->getColumn("Name");
+  recordSpec[1].offset = offsetof(struct CityRow, Name);
+  recordSpec[2].column = md.table->getColumn("CountryCode");
+  recordSpec[2].offset = offsetof(struct CityRow, CountryCode);
+  recordSpec[3].column = md.table->getColumn("District");
+  recordSpec[3].offset = offsetof(struct CityRow, District);
+  recordSpec[4].column = md.table->getColumn("Population");
+  recordSpec[4].offset = offsetof(struct CityRow, Population);
+
+  md.pkRecord = dict->createRecord(md.table, recordSpec, 1, rsSize);
+  md.rowRecord = dict->createRecord(md.table, recordSpec, 5, rsSize);
+  if (md.pkRecord == NULL || md.rowRecord == NULL) {
+    print_error(dict->getNdbError(), "Failed to initialize NdbRecords'.");
+    return -1;
+  }
+  counters.recordsCreated += 2;
+  return 0;
+}
+
+void RegistryExample::release(NdbDictionary::Dictionary *dict,
+                              LocalMetadata &md)
+{
+  if (md.pkRecord) dict->releaseRecord(md.pkRecord);
+  if (md.rowRecord) dict->releaseRecord(md.rowRecord);
+  md.pkRecord = md.rowRecord = NULL;
+}
+
+int RegistryExample::read_city(Ndb *ndb, const NdbRecord *pkRecord,
+                               const NdbRecord *rowRecord, Int32 id,
+                               NdbError &error)
+{
+  NdbTransaction *myTransaction = ndb->startTransaction();
+  if (myTransaction == NULL) {
+    error = ndb->getNdbError();
+    return -1;
+  }
+
+  CityRow row;
+  row.ID = id;
+  const NdbOperation *op =
+    myTransaction->readTuple(pkRecord, (char*) &row, rowRecord, (char*) &row,
+                             NdbOperation::LM_CommittedRead);
+  if (op == NULL ||
+      myTransaction->execute( NdbTransaction::Commit ) == -1) {
+    error = myTransaction->getNdbError();
+    ndb->closeTransaction(myTransaction);
+    return -1;
+  }
+  ndb->closeTransaction(myTransaction);
+  return 0;
+}
+
+RegistryExample::~RegistryExample()
+{
+  // Step 6. Cleanup
+  if (registry) delete registry;
+  if (cluster_connection) delete cluster_connection;
+  ndb_end(0);
+}
+
+int main(int argc, char *argv[])
+{
+  int threads = argc > 1 ? std::atoi(argv[1]) : 4;
+  int reads = argc > 2 ? std::atoi(argv[2]) : 2000;
+  int poll_ms = argc > 3 ? std::atoi(argv[3]) : 0;
+  if (threads <= 0 || reads <= 0) {
+    std::cerr << "Usage: metadata_registry [threads] [reads per thread] "
+              << "[poll ms]" << std::endl;
+    return 1;
+  }
+
+  RegistryExample ex;
+  return ex.doTest(threads, reads, poll_ms);
+}
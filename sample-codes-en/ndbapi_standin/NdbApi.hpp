@@ -0,0 +1,801 @@
+// In-process stand-in for the subset of the NDB API used by the samples.
+//
+// Build a sample against it instead of the real client library:
+//   g++ -std=c++11 -Indbapi_standin -o scan_tuples_record
+//       scan_tuples_record.cc ndbapi_standin/ndbapi_standin.cc -lpthread
+//
+// The "cluster" is an in-memory copy of world.City and world.Country
+// (a few real rows plus generated ones), partitioned like an NDB table.
+// City has the ordered index Population and the unique hash index of
+// city_unique_key.sql.
+// Every execute() and every scan fetch counts as one round trip to the
+// data nodes and sleeps for a configurable latency, and scans deliver rows
+// in batches, so client side changes to the read and scan paths can be
+// measured without a cluster. Key reads served by a replica on another
+// node than the transaction coordinator pay an extra hop; Country is a
+// read backup table (country_read_backup.sql), City is not. A data node
+// can stall for a while, as during a GCP or an LCP; every round trip
+// coordinated by it waits until the stall is over. Optionally each
+// request also costs data node time, and a node serves its requests one
+// at a time, so many small transactions queue up. There is no locking,
+// no isolation and no rollback: operations take effect when they are
+// executed.
+//
+// Asynchronous transactions (executeAsynchPrepare() and sendPollNdb())
+// are executed when sent and complete once their latency has passed.
+//
+// Configuration is read from the environment when the first connection
+// is made, or can be set through NdbStandin::config() before that:
+//   NDB_STANDIN_RTT_US       latency of one round trip (default 100)
+//   NDB_STANDIN_JITTER_US    uniform extra latency per round trip (0)
+//   NDB_STANDIN_BATCH        default rows per partition per fetch (256)
+//   NDB_STANDIN_PARTITIONS   partitions per table (4)
+//   NDB_STANDIN_CITIES       rows in City (4079)
+//   NDB_STANDIN_NODES        data nodes, two replicas per partition (2)
+//   NDB_STANDIN_HOP_US       extra latency of a remote replica (50)
+//   NDB_STANDIN_ALTER_MS     raise the schema version of City every N ms,
+//                            as an online ALTER TABLE would (0 = never)
+//   NDB_STANDIN_STALL_PERMILLE  round trips per 1000 that start a stall
+//                            on their coordinator node (0)
+//   NDB_STANDIN_STALL_US     length of a stall (5000)
+//   NDB_STANDIN_REQUEST_US   data node time per request (0)
+//   NDB_STANDIN_OP_US        data node time per key operation (0)
+#ifndef NDBAPI_STANDIN_HPP
+#define NDBAPI_STANDIN_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+typedef uint8_t  Uint8;
+typedef uint16_t Uint16;
+typedef uint32_t Uint32;
+typedef uint64_t Uint64;
+typedef int8_t   Int8;
+typedef int16_t  Int16;
+typedef int32_t  Int32;
+typedef int64_t  Int64;
+
+int ndb_init();
+void ndb_end(int);
+
+namespace NdbStandin {
+  struct Config {
+    Uint32 round_trip_us;
+    Uint32 jitter_us;
+    Uint32 scan_batch;
+    Uint32 partitions;
+    Uint32 city_rows;
+    Uint32 data_nodes;
+    Uint32 hop_us;
+    Uint32 alter_ms;
+    Uint32 stall_permille;
+    Uint32 stall_us;
+    Uint32 request_us;
+    Uint32 op_us;
+  };
+
+  // Round trips and rows served since start or the last reset_stats()
+  struct Stats {
+    Uint64 round_trips;
+    Uint64 rows_sent;
+    Uint64 transactions;
+  };
+
+  Config &config();
+  Stats stats();
+  void reset_stats();
+
+  struct TableData;
+  struct IndexData;
+  struct Filter;
+}
+
+struct NdbError {
+  enum Status {
+    Success,
+    TemporaryError,
+    PermanentError,
+    UnknownResult
+  };
+
+  enum Classification {
+    NoError,
+    ApplicationError,
+    NoDataFound,
+    ConstraintViolation,
+    SchemaError,
+    UserDefinedError,
+    InsufficientSpace,
+    TemporaryResourceError,
+    NodeRecoveryError,
+    OverloadError,
+    TimeoutExpired,
+    UnknownResultError,
+    InternalError,
+    FunctionNotImplemented,
+    UnknownErrorCode,
+    NodeShutdown,
+    SchemaObjectExists,
+    InternalTemporary
+  };
+
+  Status status;
+  Classification classification;
+  int code;
+  int mysql_code;
+  const char *message;
+  char *details;
+
+  NdbError() : status(Success), classification(NoError), code(0),
+               mysql_code(0), message("No error"), details(NULL) {}
+  void set(int code, const char *message,
+           Status status = PermanentError,
+           Classification classification = ApplicationError);
+};
+
+class Ndb;
+class NdbRecord;
+class NdbTransaction;
+class NdbOperation;
+class NdbScanOperation;
+class NdbIndexScanOperation;
+class NdbInterpretedCode;
+
+struct Ndb_cluster_connection_node_iter {
+  Ndb_cluster_connection_node_iter() : cur_pos(0) {}
+  Uint32 cur_pos;
+};
+
+class Ndb_cluster_connection {
+public:
+  Ndb_cluster_connection(const char *connectstring = 0);
+  ~Ndb_cluster_connection();
+
+  int connect(int no_retries = 30, int retry_delay_in_seconds = 1,
+              int verbose = 0);
+  int wait_until_ready(int timeout_for_first_alive,
+                       int timeout_after_first_alive);
+  unsigned no_db_nodes();
+  unsigned node_id();
+  void set_data_node_neighbour(Uint32 neighbour_node);
+  void init_get_next_node(Ndb_cluster_connection_node_iter &iter);
+  unsigned get_next_node(Ndb_cluster_connection_node_iter &iter);
+
+private:
+  friend class Ndb;
+  bool connected;
+  Uint32 neighbour;
+};
+
+class NdbRecAttr {
+public:
+  int isNULL() const { return defined ? (null ? 1 : 0) : -1; }
+  char *aRef() const { return (char*) &value[0]; }
+  Uint32 get_size_in_bytes() const { return (Uint32) value.size(); }
+  Uint32 u_32_value() const;
+  Int32 int32_value() const;
+
+private:
+  friend class NdbOperation;
+  friend class NdbScanOperation;
+  friend class Ndb;
+  NdbRecAttr(int column) : column(column), defined(false), null(false) {}
+
+  int column;
+  bool defined;
+  bool null;
+  std::vector<char> value;
+};
+
+namespace NdbDictionary {
+  class Object {
+  public:
+    enum Type {
+      TypeUndefined = 0,
+      SystemTable = 1,
+      UserTable = 2,
+      UniqueHashIndex = 3,
+      OrderedIndex = 6
+    };
+  };
+
+  class Column {
+  public:
+    enum Type {
+      Undefined = 0,
+      Int = 7,
+      Unsigned = 8,
+      Char = 14
+    };
+
+    const char *getName() const { return name.c_str(); }
+    int getColumnNo() const { return no; }
+    Type getType() const { return type; }
+    int getLength() const { return length; }
+    int getSizeInBytes() const { return size; }
+    bool getNullable() const { return nullable; }
+    bool getPrimaryKey() const { return pk; }
+
+  private:
+    friend struct NdbStandin::TableData;
+    std::string name;
+    int no;
+    Type type;
+    int length;
+    int size;
+    bool nullable;
+    bool pk;
+  };
+
+  class Table {
+  public:
+    const char *getName() const;
+    const Column *getColumn(const char *name) const;
+    const Column *getColumn(int attributeId) const;
+    int getNoOfColumns() const;
+    int getNoOfPrimaryKeys() const;
+    Uint32 getPartitionCount() const;
+    Uint32 getFragmentCount() const { return getPartitionCount(); }
+    bool getReadBackupFlag() const;
+    bool getFullyReplicated() const;
+    int getObjectVersion() const { return version; }
+
+  private:
+    friend struct NdbStandin::TableData;
+    friend class Dictionary;
+    friend class ::NdbTransaction;
+    friend class ::NdbOperation;
+    friend class ::NdbScanOperation;
+    friend class ::NdbInterpretedCode;
+    friend class ::Ndb;
+    NdbStandin::TableData *data;
+    int version;           // schema version when fetched
+  };
+
+  class Index {
+  public:
+    enum Type {
+      Undefined = 0,
+      UniqueHashIndex = 3,
+      OrderedIndex = 6
+    };
+
+    const char *getName() const;
+    const char *getTable() const;
+    unsigned getNoOfColumns() const;
+    const Column *getColumn(unsigned no) const;
+    Type getType() const;
+    int getObjectVersion() const { return 1; }
+
+  private:
+    friend struct NdbStandin::IndexData;
+    friend class Dictionary;
+    friend class ::NdbTransaction;
+    NdbStandin::IndexData *data;
+  };
+
+  struct RecordSpecification {
+    const Column *column;
+    Uint32 offset;
+    Uint32 nullbit_byte_offset;
+    Uint32 nullbit_bit_in_byte;
+    Uint32 column_flags;
+  };
+
+  class Dictionary {
+  public:
+    struct List {
+      struct Element {
+        unsigned id;
+        Object::Type type;
+        char *database;
+        char *schema;
+        char *name;
+      };
+      unsigned count;
+      Element *elements;
+
+      List() : count(0), elements(NULL) {}
+      ~List() { delete[] elements; }
+    };
+
+    const Table *getTable(const char *name) const;
+    int listIndexes(List &list, const char *tableName) const;
+
+    // Drop the cached copy so the next getTable() sees the current schema.
+    // Objects handed out before stay valid until the Dictionary is gone.
+    void invalidateTable(const char *name);
+    const Index *getIndex(const char *indexName,
+                          const char *tableName) const;
+    const NdbError &getNdbError() const { return error; }
+
+    NdbRecord *createRecord(const Table *table,
+                            const RecordSpecification *recSpec,
+                            Uint32 length, Uint32 elemSize,
+                            Uint32 flags = 0);
+    NdbRecord *createRecord(const Index *index,
+                            const RecordSpecification *recSpec,
+                            Uint32 length, Uint32 elemSize,
+                            Uint32 flags = 0);
+    void releaseRecord(NdbRecord *rec);
+
+  private:
+    friend class ::Ndb;
+    Dictionary(const Ndb *ndb) : ndb(ndb) {}
+    ~Dictionary();
+    NdbRecord *makeRecord(NdbStandin::TableData *table,
+                          NdbStandin::IndexData *index,
+                          const RecordSpecification *recSpec,
+                          Uint32 length, Uint32 elemSize);
+
+    const Ndb *ndb;
+    mutable NdbError error;
+    std::vector<NdbRecord*> records;
+    mutable std::vector<std::pair<std::string, Table*> > tables;
+    std::vector<Table*> retiredTables;
+  };
+
+  Uint32 getRecordRowLength(const NdbRecord *record);
+  // Attribute ids of a record in ascending order, and where each is kept
+  // in a row
+  bool getFirstAttrId(const NdbRecord *record, Uint32 &firstAttrId);
+  bool getNextAttrId(const NdbRecord *record, Uint32 &attrId);
+  bool getOffset(const NdbRecord *record, Uint32 attrId, Uint32 &offset);
+}
+
+class NdbInterpretedCode {
+public:
+  NdbInterpretedCode(const NdbDictionary::Table *table = 0,
+                     Uint32 *buffer = 0, Uint32 buffer_word_size = 0);
+  ~NdbInterpretedCode();
+  const NdbError &getNdbError() const { return error; }
+
+private:
+  friend class NdbScanFilter;
+  friend class NdbScanOperation;
+  NdbStandin::TableData *table;
+  NdbStandin::Filter *filter;
+  NdbError error;
+};
+
+class NdbOperation {
+public:
+  enum LockMode {
+    LM_Read = 0,
+    LM_Exclusive = 1,
+    LM_CommittedRead = 2,
+    LM_Dirty = 2,
+    LM_SimpleRead = 3
+  };
+
+  enum AbortOption {
+    DefaultAbortOption = -1,
+    AbortOnError = 0,
+    AO_IgnoreError = 2
+  };
+
+  struct OperationOptions {
+    enum Flags {
+      OO_ABORTOPTION = 0x01
+    };
+    Uint64 optionsPresent;
+    AbortOption abortOption;
+  };
+
+  int readTuple(LockMode lockMode = LM_Read);
+  int updateTuple();
+  int equal(const char *anAttrName, const char *aValue);
+  int equal(const char *anAttrName, Int32 aValue);
+  int equal(const char *anAttrName, Uint32 aValue);
+  NdbRecAttr *getValue(const char *anAttrName, char *aValue = 0);
+  int setValue(const char *anAttrName, const char *aValue);
+  int setValue(const char *anAttrName, Int32 aValue);
+  int setValue(const char *anAttrName, Uint32 aValue);
+
+  const NdbError &getNdbError() const { return error; }
+  NdbTransaction *getNdbTransaction() const { return trans; }
+
+protected:
+  friend class NdbTransaction;
+  friend class NdbScanOperation;
+  friend class NdbScanFilter;
+  enum Type { Read, Update, Scan, IndexScan };
+  typedef std::vector<std::pair<int, std::vector<char> > > ColumnValues;
+
+  NdbOperation(NdbTransaction *trans, NdbStandin::TableData *table,
+               Type type);
+  virtual ~NdbOperation();
+
+  int add_value(ColumnValues &to, const char *name, const void *value,
+                Uint32 len);
+  void add_record(ColumnValues &to, const NdbRecord *record,
+                  const char *row, bool keys_only);
+  void fill_rec_attrs(size_t row);
+  int execute_key_op();
+
+  NdbTransaction *trans;
+  NdbStandin::TableData *table;
+  Type type;
+  LockMode lockMode;
+  NdbError error;
+
+  // Key and new values, copied when the operation is defined. An empty
+  // value is NULL. targetRow is set instead of keys by updateCurrentTuple().
+  ColumnValues keys;
+  ColumnValues values;
+  long targetRow;
+  int schemaVersion;       // of the table or NdbRecord it was defined with
+  bool remote;             // served by a replica away from the coordinator
+
+  // Index of a unique key read, NULL for a primary key operation
+  NdbStandin::IndexData *keyIndex;
+
+  // Where read results go
+  std::vector<NdbRecAttr*> recAttrs;
+  const NdbRecord *resultRecord;
+  char *resultRow;
+};
+
+class NdbScanOperation : public NdbOperation {
+public:
+  enum ScanFlag {
+    SF_TupScan = (1 << 16),
+    SF_DiskScan = (2 << 16),
+    SF_OrderBy = (1 << 24),
+    SF_OrderByFull = (16 << 24),
+    SF_Descending = (2 << 24),
+    SF_ReadRangeNo = (4 << 24),
+    SF_MultiRange = (8 << 24),
+    SF_KeyInfo = 1
+  };
+
+  struct ScanOptions {
+    enum Type {
+      SO_SCANFLAGS = 0x01,
+      SO_PARALLEL = 0x02,
+      SO_BATCH = 0x04,
+      SO_GETVALUE = 0x08,
+      SO_PARTITION_ID = 0x10,
+      SO_INTERPRETED = 0x20,
+      SO_CUSTOMDATA = 0x40,
+      SO_PARTINFO = 0x80
+    };
+
+    Uint64 optionsPresent;
+    Uint32 scan_flags;
+    Uint32 parallel;
+    Uint32 batch;
+    void *extraGetValues;
+    Uint32 numExtraGetValues;
+    Uint32 partitionId;
+    const NdbInterpretedCode *interpretedCode;
+    void *customData;
+    void *partitionInfo;
+    Uint32 sizeOfPartInfo;
+  };
+
+  int readTuples(LockMode lock_mode = LM_Read, Uint32 scan_flags = 0,
+                 Uint32 parallel = 0, Uint32 batch = 0);
+  int nextResult(bool fetchAllowed = true, bool forceSend = false);
+  int nextResult(const char **out_row_ptr, bool fetchAllowed,
+                 bool forceSend);
+  void close(bool forceSend = false, bool releaseOp = false);
+
+  NdbOperation *updateCurrentTuple();
+  const NdbOperation *updateCurrentTuple(NdbTransaction *takeOverTrans,
+                                         const NdbRecord *record,
+                                         const char *row,
+                                         const unsigned char *mask = 0,
+                                         const OperationOptions *opts = 0,
+                                         Uint32 sizeOfOptions = 0);
+
+protected:
+  friend class NdbTransaction;
+  friend class NdbScanFilter;
+  NdbScanOperation(NdbTransaction *trans, NdbStandin::TableData *table,
+                   Type type);
+  ~NdbScanOperation();
+
+  void apply_options(const ScanOptions *options);
+  virtual bool in_range(size_t row) const;
+  void open();
+  bool fetch();
+  void deliver(size_t row);
+
+  Uint32 scanFlags;
+  Uint32 batch;
+  bool pruned;
+  Uint32 partitionId;
+  NdbStandin::Filter *filter;
+
+  // Rows qualifying for the scan, in delivery order
+  std::vector<size_t> result;
+  size_t fetched;          // rows of `result` received by the client
+  size_t position;         // next row to hand out
+  size_t current;          // row handed out last
+  bool opened;
+  bool closed;
+  std::vector<char> rowBuffer;
+};
+
+class NdbIndexScanOperation : public NdbScanOperation {
+public:
+  enum BoundType {
+    BoundLE = 0,
+    BoundLT = 1,
+    BoundGE = 2,
+    BoundGT = 3,
+    BoundEQ = 4
+  };
+
+  struct IndexBound {
+    const char *low_key;
+    Uint32 low_key_count;
+    bool low_inclusive;
+    const char *high_key;
+    Uint32 high_key_count;
+    bool high_inclusive;
+    Uint32 range_no;
+  };
+
+  int setBound(const char *attr, int type, const void *value);
+  int setBound(const NdbRecord *key_record, const IndexBound &bound);
+  int end_of_bound(Uint32 range_no = 0);
+
+private:
+  friend class NdbTransaction;
+  friend class NdbScanOperation;
+  // An empty bound leaves that end of the range open
+  struct Bound {
+    std::vector<std::vector<char> > keys;
+    bool inclusive;
+  };
+
+  NdbIndexScanOperation(NdbTransaction *trans,
+                        NdbStandin::IndexData *index);
+  bool in_range(size_t row) const;
+  int key_compare(size_t a, size_t b) const;
+  int bound_compare(size_t row, const Bound &bound) const;
+
+  NdbStandin::IndexData *index;
+  Bound low, high;
+};
+
+class NdbScanFilter {
+public:
+  enum Group {
+    AND = 1,
+    OR = 2,
+    NAND = 3,
+    NOR = 4
+  };
+
+  enum BinaryCondition {
+    COND_LE = 0,
+    COND_LT = 1,
+    COND_GE = 2,
+    COND_GT = 3,
+    COND_EQ = 4,
+    COND_NE = 5,
+    COND_LIKE = 6,
+    COND_NOT_LIKE = 7
+  };
+
+  NdbScanFilter(NdbInterpretedCode *code);
+  NdbScanFilter(NdbOperation *op);
+
+  int begin(Group group = AND);
+  int end();
+  int cmp(BinaryCondition cond, int ColId, const void *val, Uint32 len = 0);
+  int eq(int ColId, Uint32 value);
+  const NdbError &getNdbError() const { return error; }
+
+private:
+  NdbStandin::TableData *table;
+  NdbStandin::Filter **target;     // root of the filter being defined
+  std::vector<NdbStandin::Filter*> stack;
+  NdbError error;
+};
+
+typedef void (*NdbAsynchCallback)(int result, NdbTransaction *trans,
+                                  void *anyObject);
+
+class NdbTransaction {
+public:
+  enum ExecType {
+    NoExecTypeDef = -1,
+    Prepare,
+    NoCommit,
+    Commit,
+    Rollback
+  };
+
+  enum CommitStatusType {
+    NotStarted,
+    Started,
+    Committed,
+    Aborted,
+    NeedAbort
+  };
+
+  int execute(ExecType execType,
+              NdbOperation::AbortOption abortOption =
+                NdbOperation::DefaultAbortOption,
+              int force = 0);
+
+  // Sent by the next Ndb::sendPreparedTransactions() or sendPollNdb();
+  // the callback runs from pollNdb() or sendPollNdb()
+  void executeAsynchPrepare(ExecType execType, NdbAsynchCallback callback,
+                            void *anyObject,
+                            NdbOperation::AbortOption abortOption =
+                              NdbOperation::DefaultAbortOption);
+
+  NdbOperation *getNdbOperation(const NdbDictionary::Table *table);
+  NdbScanOperation *getNdbScanOperation(const NdbDictionary::Table *table);
+  NdbIndexScanOperation *
+  getNdbIndexScanOperation(const NdbDictionary::Index *index);
+
+  const NdbOperation *readTuple(const NdbRecord *key_rec,
+                                const char *key_row,
+                                const NdbRecord *result_rec,
+                                char *result_row,
+                                NdbOperation::LockMode lock_mode =
+                                  NdbOperation::LM_Read,
+                                const unsigned char *result_mask = 0,
+                                const NdbOperation::OperationOptions *opts = 0,
+                                Uint32 sizeOfOptions = 0);
+  const NdbOperation *updateTuple(const NdbRecord *key_rec,
+                                  const char *key_row,
+                                  const NdbRecord *attr_rec,
+                                  const char *attr_row,
+                                  const unsigned char *mask = 0,
+                                  const NdbOperation::OperationOptions *opts = 0,
+                                  Uint32 sizeOfOptions = 0);
+  NdbScanOperation *scanTable(const NdbRecord *result_record,
+                              NdbOperation::LockMode lock_mode =
+                                NdbOperation::LM_Read,
+                              const unsigned char *result_mask = 0,
+                              const NdbScanOperation::ScanOptions *options = 0,
+                              Uint32 sizeOfOptions = 0);
+  NdbIndexScanOperation *
+  scanIndex(const NdbRecord *key_record,
+            const NdbRecord *result_record,
+            NdbOperation::LockMode lock_mode = NdbOperation::LM_Read,
+            const unsigned char *result_mask = 0,
+            const NdbIndexScanOperation::IndexBound *bound = 0,
+            const NdbScanOperation::ScanOptions *options = 0,
+            Uint32 sizeOfOptions = 0);
+
+  const NdbError &getNdbError() const { return error; }
+  CommitStatusType commitStatus() const { return status; }
+  Uint32 getConnectedNodeId() const { return node; }
+
+private:
+  friend class Ndb;
+  friend class NdbOperation;
+  friend class NdbScanOperation;
+  friend class NdbIndexScanOperation;
+  NdbTransaction(Ndb *ndb);
+  ~NdbTransaction();
+
+  // Runs the operations defined since the last call and returns the
+  // latency of the round trip that takes, in *us
+  int run(ExecType execType, NdbOperation::AbortOption abortOption,
+          Uint32 *us);
+
+  Ndb *ndb;
+  Uint32 node;             // transaction coordinator
+  std::vector<NdbOperation*> operations;
+  size_t executed;         // operations already sent
+  bool committed;
+  CommitStatusType status;
+  NdbError error;
+
+  // Asynchronous execution
+  ExecType asyncExecType;
+  NdbOperation::AbortOption asyncAbortOption;
+  NdbAsynchCallback asyncCallback;
+  void *asyncObject;
+  int asyncResult;
+  Uint64 asyncDueNs;       // steady clock time the reply arrives
+};
+
+class Ndb {
+public:
+  enum ClientStatistics {
+    WaitExecCompleteCount = 0,
+    WaitScanResultCount,
+    WaitMetaRequestCount,
+    WaitNanosCount,
+    BytesSentCount,
+    BytesRecvdCount,
+    TransStartCount,
+    TransCommitCount,
+    TransAbortCount,
+    TransCloseCount,
+    PkOpCount,
+    UkOpCount,
+    TableScanCount,
+    RangeScanCount,
+    PrunedScanCount,
+    ScanBatchCount,
+    ReadRowCount,
+    TransLocalReadRowCount,
+    DataEventsRecvdCount,
+    NonDataEventsRecvdCount,
+    EventBytesRecvdCount,
+    ForcedSendsCount,
+    UnforcedSendsCount,
+    DeferredSendsCount,
+    NumClientStatistics
+  };
+
+  struct Free_list_usage {
+    const char *m_name;
+    Uint32 m_created;
+    Uint32 m_free;
+    Uint32 m_sizeof;
+  };
+
+  Ndb(Ndb_cluster_connection *ndb_cluster_connection,
+      const char *aCatalogName = "", const char *aSchemaName = "def");
+  ~Ndb();
+
+  int init(int maxNoOfTransactions = 4);
+  NdbDictionary::Dictionary *getDictionary() const { return dict; }
+
+  NdbTransaction *startTransaction(const NdbDictionary::Table *table = 0,
+                                   const char *keyData = 0,
+                                   Uint32 keyLen = 0);
+  NdbTransaction *startTransaction(const NdbDictionary::Table *table,
+                                   Uint32 partitionId);
+  void closeTransaction(NdbTransaction *trans);
+
+  // Asynchronous transactions. The poll calls wait up to
+  // aMillisecondNumber for minNoOfEventsToWakeup sent transactions to
+  // complete, run the callbacks of all completed ones and return how many
+  // there were.
+  void sendPreparedTransactions(int forceSend = 0);
+  int pollNdb(int aMillisecondNumber = 3000, int minNoOfEventsToWakeup = 1);
+  int sendPollNdb(int aMillisecondNumber = 3000,
+                  int minNoOfEventsToWakeup = 1, int forceSend = 0);
+
+  const NdbError &getNdbError() const { return error; }
+  Uint64 getClientStat(Uint32 id) const;
+  const char *getClientStatName(Uint32 id) const;
+
+  // Iterates the free lists: start with m_name = 0, NULL after the last
+  Free_list_usage *get_free_list_usage(Free_list_usage *curr);
+
+private:
+  // Objects are not pooled; a list's m_created is the most ever alive
+  // at once and m_free the part of that not in use now.
+  enum FreeList {
+    FL_Transaction,
+    FL_Operation,
+    FL_ScanOperation,
+    FL_RecAttr,
+    NumFreeLists
+  };
+  void obj_alloc(FreeList list);
+  void obj_free(FreeList list);
+
+  friend class NdbTransaction;
+  friend class NdbOperation;
+  friend class NdbScanOperation;
+  friend class NdbDictionary::Dictionary;
+
+  Ndb_cluster_connection *connection;
+  std::string database;
+  NdbDictionary::Dictionary *dict;
+  bool initialized;
+  NdbError error;
+  Uint64 clientStats[NumClientStatistics];
+  Uint32 liveObjects[NumFreeLists];
+  Uint32 createdObjects[NumFreeLists];
+  std::vector<NdbTransaction*> prepared, sent;
+};
+
+#endif
@@ -0,0 +1,1970 @@
+// Implementation of the in-process NDB API stand-in; see NdbApi.hpp.
+#include "NdbApi.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+
+class NdbRecord {
+public:
+  int version;
+  struct Col {
+    int col;                 // table column number
+    Uint32 offset;
+    Uint32 nullbit_byte;
+    Uint32 nullbit_bit;
+    bool nullable;
+  };
+
+  NdbStandin::TableData *table;
+  NdbStandin::IndexData *index;
+  std::vector<Col> cols;
+};
+
+namespace NdbStandin {
+
+struct Row {
+  std::vector<char> data;    // all columns, packed at TableData::offsets
+  std::vector<bool> null;
+};
+
+struct TableData {
+  std::string name;
+  int version;
+  std::vector<NdbDictionary::Column> columns;
+  std::vector<Uint32> offsets;
+  Uint32 rowSize;
+  std::vector<int> pk;
+  Uint32 partitions;
+  std::vector<Row> rows;
+  std::vector<Uint32> partitionOf;
+  std::map<std::string, size_t> byKey;
+  std::vector<IndexData*> uniqueIndexes;
+  bool readBackup;
+  bool fullyReplicated;
+
+  TableData(const char *name, Uint32 partitions)
+    : name(name), version(1), rowSize(0), partitions(partitions),
+      readBackup(false), fullyReplicated(false)
+  {
+  }
+
+  void add_column(const char *name, NdbDictionary::Column::Type type,
+                  int length, bool nullable, bool pk_column)
+  {
+    NdbDictionary::Column c;
+    c.name = name;
+    c.no = (int) columns.size();
+    c.type = type;
+    c.length = length;
+    c.size = type == NdbDictionary::Column::Char ? length : 4;
+    c.nullable = nullable;
+    c.pk = pk_column;
+    if (pk_column)
+      pk.push_back(c.no);
+    offsets.push_back(rowSize);
+    rowSize += c.size;
+    columns.push_back(c);
+  }
+
+  int find(const char *name) const
+  {
+    for (size_t i = 0; i < columns.size(); i++)
+      if (columns[i].name == name)
+        return (int) i;
+    return -1;
+  }
+
+  const char *value(const Row &row, int col) const
+  {
+    return &row.data[offsets[col]];
+  }
+
+  std::string key_of(const Row &row) const
+  {
+    std::string key;
+    for (size_t i = 0; i < pk.size(); i++)
+      key.append(value(row, pk[i]), columns[pk[i]].size);
+    return key;
+  }
+
+  // Total order of two values of a column; NULL sorts first
+  int compare(int col, const char *a, const char *b) const
+  {
+    const NdbDictionary::Column &c = columns[col];
+    if (c.type == NdbDictionary::Column::Char)
+      return std::memcmp(a, b, c.size);
+    if (c.type == NdbDictionary::Column::Int) {
+      Int32 x, y;
+      std::memcpy(&x, a, 4);
+      std::memcpy(&y, b, 4);
+      return x < y ? -1 : (x > y ? 1 : 0);
+    }
+    Uint32 x, y;
+    std::memcpy(&x, a, 4);
+    std::memcpy(&y, b, 4);
+    return x < y ? -1 : (x > y ? 1 : 0);
+  }
+
+  Uint32 partition_of(const char *key, size_t len) const
+  {
+    Uint32 h = 2166136261u;             // FNV-1a over the key
+    for (size_t i = 0; i < len; i++)
+      h = (h ^ (unsigned char) key[i]) * 16777619u;
+    return h % partitions;
+  }
+
+  void insert(const Row &row)
+  {
+    std::string key = key_of(row);
+    byKey[key] = rows.size();
+    partitionOf.push_back(partition_of(key.data(), key.size()));
+    rows.push_back(row);
+  }
+
+  Row new_row() const
+  {
+    Row row;
+    row.data.assign(rowSize, 0);
+    row.null.assign(columns.size(), false);
+    return row;
+  }
+
+  void set(Row &row, const char *col, const char *s) const
+  {
+    int no = find(col);
+    char *dst = &row.data[offsets[no]];
+    size_t len = std::min(std::strlen(s), (size_t) columns[no].size);
+    std::memset(dst, ' ', columns[no].size);
+    std::memcpy(dst, s, len);
+  }
+
+  void set(Row &row, const char *col, Int32 v) const
+  {
+    std::memcpy(&row.data[offsets[find(col)]], &v, 4);
+  }
+};
+
+struct IndexData {
+  NdbDictionary::Index index;
+  std::string name;
+  NdbDictionary::Index::Type type;
+  TableData *table;
+  std::vector<int> columns;
+
+  std::map<std::string, size_t> byKey;     // unique indexes only
+
+  IndexData(const char *name, NdbDictionary::Index::Type type,
+            TableData *table)
+    : name(name), type(type), table(table)
+  {
+    index.data = this;
+  }
+
+  std::string key_of(const Row &row) const
+  {
+    std::string key;
+    for (size_t i = 0; i < columns.size(); i++)
+      key.append(table->value(row, columns[i]),
+                 table->columns[columns[i]].getSizeInBytes());
+    return key;
+  }
+
+  void rebuild()
+  {
+    byKey.clear();
+    for (size_t r = 0; r < table->rows.size(); r++)
+      byKey[key_of(table->rows[r])] = r;
+  }
+};
+
+struct Filter {
+  enum Kind { Group, Cond } kind;
+  int op;                    // NdbScanFilter::Group or BinaryCondition
+  int col;
+  std::vector<char> value;
+  std::vector<Filter*> children;
+
+  ~Filter()
+  {
+    for (size_t i = 0; i < children.size(); i++)
+      delete children[i];
+  }
+
+  Filter *clone() const
+  {
+    Filter *f = new Filter(*this);
+    for (size_t i = 0; i < children.size(); i++)
+      f->children[i] = children[i]->clone();
+    return f;
+  }
+
+  static bool like(const char *s, size_t slen, const char *p, size_t plen)
+  {
+    if (plen == 0)
+      return slen == 0;
+    if (*p == '%') {
+      for (size_t i = 0; i <= slen; i++)
+        if (like(s + i, slen - i, p + 1, plen - 1))
+          return true;
+      return false;
+    }
+    if (slen == 0 || (*p != '_' && *p != *s))
+      return false;
+    return like(s + 1, slen - 1, p + 1, plen - 1);
+  }
+
+  bool eval(const TableData &t, const Row &row) const
+  {
+    if (kind == Group) {
+      bool any = false, all = true;
+      for (size_t i = 0; i < children.size(); i++) {
+        bool r = children[i]->eval(t, row);
+        any = any || r;
+        all = all && r;
+      }
+      switch (op) {
+      case NdbScanFilter::AND:  return all;
+      case NdbScanFilter::OR:   return any;
+      case NdbScanFilter::NAND: return !all;
+      default:                  return !any;
+      }
+    }
+
+    if (row.null[col])
+      return false;
+    const char *v = t.value(row, col);
+    if (op == NdbScanFilter::COND_LIKE || op == NdbScanFilter::COND_NOT_LIKE) {
+      size_t len = t.columns[col].getSizeInBytes();
+      while (len > 0 && v[len - 1] == ' ')
+        len--;
+      bool m = like(v, len, &value[0], value.size());
+      return op == NdbScanFilter::COND_LIKE ? m : !m;
+    }
+
+    // Column <cond> value
+    int c = t.compare(col, v, &value[0]);
+    switch (op) {
+    case NdbScanFilter::COND_LE: return c <= 0;
+    case NdbScanFilter::COND_LT: return c < 0;
+    case NdbScanFilter::COND_GE: return c >= 0;
+    case NdbScanFilter::COND_GT: return c > 0;
+    case NdbScanFilter::COND_EQ: return c == 0;
+    default:                     return c != 0;
+    }
+  }
+};
+
+struct Cluster {
+  std::mutex mutex;
+  bool loaded;
+  bool configured;
+  Config config;
+  Stats stats;
+  std::mt19937 rng;
+  std::vector<TableData*> tables;
+  std::vector<IndexData*> indexes;
+
+  Uint32 nextNode;
+  std::chrono::steady_clock::time_point nextAlter;
+  std::vector<std::chrono::steady_clock::time_point> stallEnd;  // per node
+  std::vector<std::chrono::steady_clock::time_point> busyUntil; // per node
+
+  Cluster() : loaded(false), configured(false), nextNode(0)
+  {
+    std::memset(&stats, 0, sizeof stats);
+  }
+
+  static Uint32 env(const char *name, Uint32 def)
+  {
+    const char *v = std::getenv(name);
+    return v ? (Uint32) std::strtoul(v, NULL, 10) : def;
+  }
+
+  void configure()
+  {
+    if (configured)
+      return;
+    config.round_trip_us = env("NDB_STANDIN_RTT_US", 100);
+    config.jitter_us = env("NDB_STANDIN_JITTER_US", 0);
+    config.scan_batch = env("NDB_STANDIN_BATCH", 256);
+    config.partitions = env("NDB_STANDIN_PARTITIONS", 4);
+    config.city_rows = env("NDB_STANDIN_CITIES", 4079);
+    config.data_nodes = env("NDB_STANDIN_NODES", 2);
+    config.hop_us = env("NDB_STANDIN_HOP_US", 50);
+    config.alter_ms = env("NDB_STANDIN_ALTER_MS", 0);
+    config.stall_permille = env("NDB_STANDIN_STALL_PERMILLE", 0);
+    config.stall_us = env("NDB_STANDIN_STALL_US", 5000);
+    config.request_us = env("NDB_STANDIN_REQUEST_US", 0);
+    config.op_us = env("NDB_STANDIN_OP_US", 0);
+    if (config.partitions == 0) config.partitions = 1;
+    if (config.data_nodes == 0) config.data_nodes = 1;
+    if (config.scan_batch == 0) config.scan_batch = 1;
+    configured = true;
+  }
+
+  void load();
+
+  // Applies the simulated ALTER TABLEs that are due
+  void tick()
+  {
+    if (!config.alter_ms || !loaded)
+      return;
+    std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+    std::chrono::milliseconds step(config.alter_ms);
+    if (nextAlter == std::chrono::steady_clock::time_point())
+      nextAlter = now + step;
+    for (; now >= nextAlter; nextAlter += step)
+      find_table("City")->version++;
+  }
+
+  TableData *find_table(const char *name)
+  {
+    for (size_t i = 0; i < tables.size(); i++)
+      if (tables[i]->name == name)
+        return tables[i];
+    return NULL;
+  }
+
+  // Data nodes are numbered from 1. Partition p has its primary replica
+  // on node p % nodes + 1 and its backup on the next node.
+  Uint32 primary_node(Uint32 partition) const
+  {
+    return partition % config.data_nodes + 1;
+  }
+
+  bool holds_replica(Uint32 node, Uint32 partition) const
+  {
+    Uint32 nodes = config.data_nodes;
+    return node == primary_node(partition) ||
+           (nodes > 1 && node == (partition + 1) % nodes + 1);
+  }
+
+  // Latency of one request/response exchange with the data nodes,
+  // coordinated by `node`, carrying `keyOps` key operations
+  Uint32 latency_us(Uint64 rows, bool remote, Uint32 node,
+                    Uint32 keyOps = 0)
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    stats.round_trips++;
+    stats.rows_sent += rows;
+    Uint32 us = config.round_trip_us + (remote ? config.hop_us : 0);
+    if (config.jitter_us)
+      us += rng() % (config.jitter_us + 1);
+
+    if (config.stall_permille && node >= 1 && node <= config.data_nodes) {
+      std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+      stallEnd.resize(config.data_nodes);
+      std::chrono::steady_clock::time_point &end = stallEnd[node - 1];
+      if (end <= now && rng() % 1000 < config.stall_permille)
+        end = now + std::chrono::microseconds(config.stall_us);
+      if (end > now)
+        us += (Uint32) std::chrono::duration_cast<std::chrono::microseconds>(
+                end - now).count();
+    }
+
+    // The request waits for the ones the node took on before it
+    Uint32 work = config.request_us + keyOps * config.op_us;
+    if (work && node >= 1 && node <= config.data_nodes) {
+      std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+      busyUntil.resize(config.data_nodes);
+      std::chrono::steady_clock::time_point &busy = busyUntil[node - 1];
+      busy = std::max(busy, now) + std::chrono::microseconds(work);
+      us += (Uint32) std::chrono::duration_cast<std::chrono::microseconds>(
+              busy - now).count();
+    }
+    return us;
+  }
+
+  // Sleeps outside the lock so that concurrent clients overlap like they
+  // would on a real cluster
+  void round_trip(Uint64 rows, bool remote, Uint32 node)
+  {
+    Uint32 us = latency_us(rows, remote, node);
+    if (us)
+      std::this_thread::sleep_for(std::chrono::microseconds(us));
+  }
+};
+
+static Cluster &cluster()
+{
+  static Cluster c;
+  return c;
+}
+
+void Cluster::load()
+{
+  if (loaded)
+    return;
+  configure();
+
+  // Country: the columns used by the samples
+  TableData *country = new TableData("Country", config.partitions);
+  country->add_column("Code", NdbDictionary::Column::Char, 3, false, true);
+  country->add_column("Name", NdbDictionary::Column::Char, 52, false, false);
+  country->add_column("Capital", NdbDictionary::Column::Int, 1, true, false);
+  country->readBackup = true;
+
+  static const struct { const char *code, *name; Int32 capital; }
+  countries[] = {
+    { "JPN", "Japan", 1532 },       { "USA", "United States", 3813 },
+    { "CHN", "China", 1891 },       { "IND", "India", 1109 },
+    { "KOR", "South Korea", 2331 }, { "DEU", "Germany", 3068 },
+    { "GBR", "United Kingdom", 456 }, { "SWE", "Sweden", 3048 },
+    { "ATA", "Antarctica", 0 }
+  };
+  std::vector<std::string> codes;
+  for (size_t i = 0; i < sizeof(countries) / sizeof(countries[0]); i++) {
+    Row row = country->new_row();
+    country->set(row, "Code", countries[i].code);
+    country->set(row, "Name", countries[i].name);
+    if (countries[i].capital)
+      country->set(row, "Capital", countries[i].capital);
+    else
+      row.null[country->find("Capital")] = true;
+    country->insert(row);
+    codes.push_back(countries[i].code);
+  }
+  // Generated countries QAA, QAB, ... up to the 239 of world.Country
+  for (int i = 0; codes.size() < 239; i++) {
+    char code[4] = { 'Q', (char)('A' + i / 26), (char)('A' + i % 26), 0 };
+    char name[32];
+    std::snprintf(name, sizeof(name), "Country %s", code);
+    Row row = country->new_row();
+    country->set(row, "Code", code);
+    country->set(row, "Name", name);
+    row.null[country->find("Capital")] = true;
+    country->insert(row);
+    codes.push_back(code);
+  }
+
+  // City
+  TableData *city = new TableData("City", config.partitions);
+  city->add_column("ID", NdbDictionary::Column::Int, 1, false, true);
+  city->add_column("Name", NdbDictionary::Column::Char, 35, false, false);
+  city->add_column("CountryCode", NdbDictionary::Column::Char, 3,
+                   false, false);
+  city->add_column("District", NdbDictionary::Column::Char, 20,
+                   false, false);
+  city->add_column("Population", NdbDictionary::Column::Int, 1,
+                   false, false);
+
+  static const struct { Int32 id; const char *name, *cc, *district; Int32 pop; }
+  cities[] = {
+    { 1532, "Tokyo", "JPN", "Tokyo-to", 7980230 },
+    { 1533, "Jokohama [Yokohama]", "JPN", "Kanagawa", 3339594 },
+    { 1534, "Osaka", "JPN", "Osaka", 2595674 },
+    { 1535, "Nagoya", "JPN", "Aichi", 2154376 },
+    { 1536, "Sapporo", "JPN", "Hokkaido", 1790886 },
+    { 1537, "Kioto", "JPN", "Kyoto", 1461974 },
+    { 1538, "Kobe", "JPN", "Hyogo", 1425139 },
+    { 1539, "Fukuoka", "JPN", "Fukuoka", 1308379 },
+    { 1540, "Kawasaki", "JPN", "Kanagawa", 1217359 },
+    { 1541, "Hiroshima", "JPN", "Hiroshima", 1119117 },
+    { 1542, "Kitakyushu", "JPN", "Fukuoka", 1016264 },
+    { 1543, "Sendai", "JPN", "Miyagi", 989975 },
+    { 1024, "Mumbai (Bombay)", "IND", "Maharashtra", 10500000 },
+    { 2331, "Seoul", "KOR", "Seoul", 9981619 },
+    { 1890, "Shanghai", "CHN", "Shanghai", 9696300 },
+    { 3793, "New York", "USA", "New York", 8008278 },
+    { 456, "London", "GBR", "England", 7285000 },
+    { 3068, "Berlin", "DEU", "Berliini", 3386667 },
+    { 3048, "Stockholm", "SWE", "Lisboa", 750348 }
+  };
+  const size_t seeds = sizeof(cities) / sizeof(cities[0]);
+  for (size_t i = 0; i < seeds && i < config.city_rows; i++) {
+    Row row = city->new_row();
+    city->set(row, "ID", cities[i].id);
+    city->set(row, "Name", cities[i].name);
+    city->set(row, "CountryCode", cities[i].cc);
+    city->set(row, "District", cities[i].district);
+    city->set(row, "Population", cities[i].pop);
+    city->insert(row);
+  }
+  // Generated cities fill the remaining IDs; a fixed LCG keeps the data
+  // identical from run to run.
+  Uint32 seed = 12345;
+  for (Int32 id = 1; city->rows.size() < config.city_rows; id++) {
+    Row row = city->new_row();
+    city->set(row, "ID", id);
+    if (city->byKey.count(city->key_of(row)))
+      continue;
+    seed = seed * 1103515245u + 12345u;
+    char name[36], district[21];
+    std::snprintf(name, sizeof(name), "City %d", id);
+    std::snprintf(district, sizeof(district), "District %u", seed % 50);
+    Int32 pop = 1000 + (Int32)((seed >> 8) % 200000);
+    if (id % 40 == 0)
+      pop += (Int32)((seed >> 4) % 3000000);
+    city->set(row, "Name", name);
+    city->set(row, "CountryCode", codes[(seed >> 16) % codes.size()].c_str());
+    city->set(row, "District", district);
+    city->set(row, "Population", pop);
+    city->insert(row);
+  }
+
+  IndexData *population =
+    new IndexData("Population", NdbDictionary::Index::OrderedIndex, city);
+  population->columns.push_back(city->find("Population"));
+
+  // As created by city_unique_key.sql
+  IndexData *nameDistrict =
+    new IndexData("name_district$unique",
+                  NdbDictionary::Index::UniqueHashIndex, city);
+  nameDistrict->columns.push_back(city->find("Name"));
+  nameDistrict->columns.push_back(city->find("CountryCode"));
+  nameDistrict->columns.push_back(city->find("District"));
+  nameDistrict->rebuild();
+  city->uniqueIndexes.push_back(nameDistrict);
+
+  tables.push_back(country);
+  tables.push_back(city);
+  indexes.push_back(population);
+  indexes.push_back(nameDistrict);
+  loaded = true;
+}
+
+Config &config()
+{
+  std::lock_guard<std::mutex> guard(cluster().mutex);
+  cluster().configure();
+  return cluster().config;
+}
+
+Stats stats()
+{
+  std::lock_guard<std::mutex> guard(cluster().mutex);
+  return cluster().stats;
+}
+
+void reset_stats()
+{
+  std::lock_guard<std::mutex> guard(cluster().mutex);
+  std::memset(&cluster().stats, 0, sizeof(Stats));
+}
+
+} // namespace NdbStandin
+
+using NdbStandin::TableData;
+using NdbStandin::IndexData;
+using NdbStandin::Filter;
+using NdbStandin::Row;
+using NdbStandin::cluster;
+
+int ndb_init()
+{
+  return 0;
+}
+
+void ndb_end(int)
+{
+}
+
+void NdbError::set(int c, const char *msg, Status st, Classification cl)
+{
+  code = c;
+  message = msg;
+  status = st;
+  classification = cl;
+}
+
+// Ndb_cluster_connection
+
+Ndb_cluster_connection::Ndb_cluster_connection(const char *)
+  : connected(false), neighbour(0)
+{
+}
+
+Ndb_cluster_connection::~Ndb_cluster_connection()
+{
+}
+
+int Ndb_cluster_connection::connect(int, int, int)
+{
+  std::lock_guard<std::mutex> guard(cluster().mutex);
+  cluster().load();
+  connected = true;
+  return 0;
+}
+
+int Ndb_cluster_connection::wait_until_ready(int, int)
+{
+  return connected ? 0 : -1;
+}
+
+unsigned Ndb_cluster_connection::no_db_nodes()
+{
+  return NdbStandin::config().data_nodes;
+}
+
+void Ndb_cluster_connection::set_data_node_neighbour(Uint32 neighbour_node)
+{
+  neighbour = neighbour_node;
+}
+
+void Ndb_cluster_connection::init_get_next_node(
+  Ndb_cluster_connection_node_iter &iter)
+{
+  iter.cur_pos = 0;
+}
+
+unsigned Ndb_cluster_connection::get_next_node(
+  Ndb_cluster_connection_node_iter &iter)
+{
+  if (iter.cur_pos >= no_db_nodes())
+    return 0;
+  return ++iter.cur_pos;
+}
+
+unsigned Ndb_cluster_connection::node_id()
+{
+  return connected ? 50 : 0;
+}
+
+// NdbRecAttr
+
+Uint32 NdbRecAttr::u_32_value() const
+{
+  Uint32 v = 0;
+  std::memcpy(&v, &value[0], std::min<size_t>(4, value.size()));
+  return v;
+}
+
+Int32 NdbRecAttr::int32_value() const
+{
+  return (Int32) u_32_value();
+}
+
+// NdbDictionary
+
+const char *NdbDictionary::Table::getName() const
+{
+  return data->name.c_str();
+}
+
+const NdbDictionary::Column *
+NdbDictionary::Table::getColumn(const char *name) const
+{
+  int no = data->find(name);
+  return no < 0 ? NULL : &data->columns[no];
+}
+
+const NdbDictionary::Column *
+NdbDictionary::Table::getColumn(int attributeId) const
+{
+  if (attributeId < 0 || attributeId >= (int) data->columns.size())
+    return NULL;
+  return &data->columns[attributeId];
+}
+
+int NdbDictionary::Table::getNoOfColumns() const
+{
+  return (int) data->columns.size();
+}
+
+int NdbDictionary::Table::getNoOfPrimaryKeys() const
+{
+  return (int) data->pk.size();
+}
+
+Uint32 NdbDictionary::Table::getPartitionCount() const
+{
+  return data->partitions;
+}
+
+bool NdbDictionary::Table::getReadBackupFlag() const
+{
+  return data->readBackup;
+}
+
+bool NdbDictionary::Table::getFullyReplicated() const
+{
+  return data->fullyReplicated;
+}
+
+const char *NdbDictionary::Index::getName() const
+{
+  return data->name.c_str();
+}
+
+const char *NdbDictionary::Index::getTable() const
+{
+  return data->table->name.c_str();
+}
+
+unsigned NdbDictionary::Index::getNoOfColumns() const
+{
+  return (unsigned) data->columns.size();
+}
+
+const NdbDictionary::Column *
+NdbDictionary::Index::getColumn(unsigned no) const
+{
+  if (no >= data->columns.size())
+    return NULL;
+  return &data->table->columns[data->columns[no]];
+}
+
+NdbDictionary::Index::Type NdbDictionary::Index::getType() const
+{
+  return data->type;
+}
+
+NdbDictionary::Dictionary::~Dictionary()
+{
+  for (size_t i = 0; i < records.size(); i++)
+    delete records[i];
+  for (size_t i = 0; i < tables.size(); i++)
+    delete tables[i].second;
+  for (size_t i = 0; i < retiredTables.size(); i++)
+    delete retiredTables[i];
+}
+
+// Tables are cached per Dictionary and keep the schema version they were
+// fetched with until invalidated
+const NdbDictionary::Table *
+NdbDictionary::Dictionary::getTable(const char *name) const
+{
+  for (size_t i = 0; i < tables.size(); i++)
+    if (tables[i].first == name)
+      return tables[i].second;
+
+  std::lock_guard<std::mutex> guard(cluster().mutex);
+  cluster().tick();
+  TableData *t = NULL;
+  if (ndb->database == "world")
+    t = cluster().find_table(name);
+  if (t == NULL) {
+    error.set(723, "No such table existed", NdbError::PermanentError,
+              NdbError::SchemaError);
+    return NULL;
+  }
+  Table *table = new Table;
+  table->data = t;
+  table->version = t->version;
+  tables.push_back(std::make_pair(std::string(name), table));
+  return table;
+}
+
+void NdbDictionary::Dictionary::invalidateTable(const char *name)
+{
+  for (size_t i = 0; i < tables.size(); i++) {
+    if (tables[i].first == name) {
+      retiredTables.push_back(tables[i].second);
+      tables.erase(tables.begin() + i);
+      return;
+    }
+  }
+}
+
+const NdbDictionary::Index *
+NdbDictionary::Dictionary::getIndex(const char *indexName,
+                                    const char *tableName) const
+{
+  std::vector<IndexData*> &indexes = cluster().indexes;
+  for (size_t i = 0; i < indexes.size(); i++)
+    if (ndb->database == "world" &&
+        indexes[i]->name == indexName &&
+        indexes[i]->table->name == tableName)
+      return &indexes[i]->index;
+  error.set(4243, "Index not found", NdbError::PermanentError,
+            NdbError::SchemaError);
+  return NULL;
+}
+
+int NdbDictionary::Dictionary::listIndexes(List &list,
+                                           const char *tableName) const
+{
+  if (getTable(tableName) == NULL)
+    return -1;
+  std::vector<IndexData*> &indexes = cluster().indexes;
+  delete[] list.elements;
+  list.elements = new List::Element[indexes.size()];
+  list.count = 0;
+  for (size_t i = 0; i < indexes.size(); i++) {
+    if (indexes[i]->table->name != tableName)
+      continue;
+    List::Element &e = list.elements[list.count++];
+    e.id = (unsigned) i + 1;
+    e.type = (Object::Type) indexes[i]->type;
+    e.database = (char*) "world";
+    e.schema = (char*) "def";
+    e.name = (char*) indexes[i]->name.c_str();
+  }
+  return 0;
+}
+
+NdbRecord *
+NdbDictionary::Dictionary::makeRecord(TableData *table, IndexData *index,
+                                      const RecordSpecification *recSpec,
+                                      Uint32 length, Uint32 elemSize)
+{
+  NdbRecord *rec = new NdbRecord;
+  rec->version = table->version;
+  rec->table = table;
+  rec->index = index;
+  for (Uint32 i = 0; i < length; i++) {
+    const RecordSpecification *spec =
+      (const RecordSpecification*) ((const char*) recSpec + i * elemSize);
+    int no = spec->column ? table->find(spec->column->getName()) : -1;
+    if (no < 0) {
+      error.set(4004, "Attribute name or id not found in the table");
+      delete rec;
+      return NULL;
+    }
+    NdbRecord::Col c;
+    c.col = no;
+    c.offset = spec->offset;
+    c.nullbit_byte = spec->nullbit_byte_offset;
+    c.nullbit_bit = spec->nullbit_bit_in_byte;
+    c.nullable = table->columns[no].getNullable();
+    rec->cols.push_back(c);
+  }
+  records.push_back(rec);
+  return rec;
+}
+
+NdbRecord *
+NdbDictionary::Dictionary::createRecord(const Table *table,
+                                        const RecordSpecification *recSpec,
+                                        Uint32 length, Uint32 elemSize,
+                                        Uint32)
+{
+  NdbRecord *rec = makeRecord(table->data, NULL, recSpec, length, elemSize);
+  if (rec != NULL)
+    rec->version = table->version;
+  return rec;
+}
+
+NdbRecord *
+NdbDictionary::Dictionary::createRecord(const Index *index,
+                                        const RecordSpecification *recSpec,
+                                        Uint32 length, Uint32 elemSize,
+                                        Uint32)
+{
+  return makeRecord(index->data->table, index->data,
+                    recSpec, length, elemSize);
+}
+
+Uint32 NdbDictionary::getRecordRowLength(const NdbRecord *record)
+{
+  Uint32 length = 0;
+  for (size_t i = 0; i < record->cols.size(); i++) {
+    const NdbRecord::Col &rc = record->cols[i];
+    length = std::max<Uint32>(length, rc.offset +
+                              record->table->columns[rc.col].getSizeInBytes());
+    if (rc.nullable)
+      length = std::max<Uint32>(length, rc.nullbit_byte + 1);
+  }
+  return length;
+}
+
+bool NdbDictionary::getFirstAttrId(const NdbRecord *record,
+                                   Uint32 &firstAttrId)
+{
+  bool found = false;
+  for (size_t i = 0; i < record->cols.size(); i++) {
+    Uint32 id = record->cols[i].col;
+    if (!found || id < firstAttrId)
+      firstAttrId = id;
+    found = true;
+  }
+  return found;
+}
+
+bool NdbDictionary::getNextAttrId(const NdbRecord *record, Uint32 &attrId)
+{
+  bool found = false;
+  Uint32 next = 0;
+  for (size_t i = 0; i < record->cols.size(); i++) {
+    Uint32 id = record->cols[i].col;
+    if (id > attrId && (!found || id < next)) {
+      next = id;
+      found = true;
+    }
+  }
+  if (found)
+    attrId = next;
+  return found;
+}
+
+bool NdbDictionary::getOffset(const NdbRecord *record, Uint32 attrId,
+                              Uint32 &offset)
+{
+  for (size_t i = 0; i < record->cols.size(); i++) {
+    if ((Uint32) record->cols[i].col == attrId) {
+      offset = record->cols[i].offset;
+      return true;
+    }
+  }
+  return false;
+}
+
+void NdbDictionary::Dictionary::releaseRecord(NdbRecord *rec)
+{
+  std::vector<NdbRecord*>::iterator it =
+    std::find(records.begin(), records.end(), rec);
+  if (it != records.end()) {
+    delete *it;
+    records.erase(it);
+  }
+}
+
+// NdbInterpretedCode and NdbScanFilter
+
+NdbInterpretedCode::NdbInterpretedCode(const NdbDictionary::Table *table,
+                                       Uint32 *, Uint32)
+  : table(table ? table->data : NULL), filter(NULL)
+{
+}
+
+NdbInterpretedCode::~NdbInterpretedCode()
+{
+  delete filter;
+}
+
+NdbScanFilter::NdbScanFilter(NdbInterpretedCode *code)
+  : table(code->table), target(&code->filter)
+{
+}
+
+NdbScanFilter::NdbScanFilter(NdbOperation *op)
+  : table(op->table), target(NULL)
+{
+  NdbScanOperation *sop = dynamic_cast<NdbScanOperation*>(op);
+  if (sop != NULL)
+    target = &sop->filter;
+}
+
+int NdbScanFilter::begin(Group group)
+{
+  if (target == NULL) {
+    error.set(4011, "Scan filter needs a scan operation");
+    return -1;
+  }
+  Filter *f = new Filter;
+  f->kind = Filter::Group;
+  f->op = group;
+  f->col = -1;
+  if (stack.empty()) {
+    delete *target;
+    *target = f;
+  } else {
+    stack.back()->children.push_back(f);
+  }
+  stack.push_back(f);
+  return 0;
+}
+
+int NdbScanFilter::end()
+{
+  if (stack.empty()) {
+    error.set(4011, "Scan filter end() without begin()");
+    return -1;
+  }
+  stack.pop_back();
+  return 0;
+}
+
+int NdbScanFilter::cmp(BinaryCondition cond, int ColId, const void *val,
+                       Uint32 len)
+{
+  if (stack.empty() || table == NULL ||
+      ColId < 0 || ColId >= (int) table->columns.size()) {
+    error.set(4011, "Invalid scan filter condition");
+    return -1;
+  }
+  const NdbDictionary::Column &c = table->columns[ColId];
+  Filter *f = new Filter;
+  f->kind = Filter::Cond;
+  f->op = cond;
+  f->col = ColId;
+  if (cond == COND_LIKE || cond == COND_NOT_LIKE) {
+    const char *s = (const char*) val;
+    f->value.assign(s, s + (len ? len : std::strlen(s)));
+  } else if (c.getType() == NdbDictionary::Column::Char) {
+    // Values shorter than the column compare as if blank padded
+    f->value.assign(c.getSizeInBytes(), ' ');
+    std::memcpy(&f->value[0], val,
+                std::min<size_t>(len ? len : c.getSizeInBytes(),
+                                 c.getSizeInBytes()));
+  } else {
+    f->value.assign((const char*) val, (const char*) val + 4);
+  }
+  stack.back()->children.push_back(f);
+  return 0;
+}
+
+int NdbScanFilter::eq(int ColId, Uint32 value)
+{
+  return cmp(COND_EQ, ColId, &value, 4);
+}
+
+// NdbOperation
+
+NdbOperation::NdbOperation(NdbTransaction *trans, TableData *table,
+                           Type type)
+  : trans(trans), table(table), type(type), lockMode(LM_Read),
+    targetRow(-1), schemaVersion(table->version), remote(false),
+    keyIndex(NULL), resultRecord(NULL), resultRow(NULL)
+{
+  trans->ndb->obj_alloc(type == Scan || type == IndexScan ?
+                        Ndb::FL_ScanOperation : Ndb::FL_Operation);
+}
+
+NdbOperation::~NdbOperation()
+{
+  for (size_t i = 0; i < recAttrs.size(); i++) {
+    delete recAttrs[i];
+    trans->ndb->obj_free(Ndb::FL_RecAttr);
+  }
+  trans->ndb->obj_free(type == Scan || type == IndexScan ?
+                       Ndb::FL_ScanOperation : Ndb::FL_Operation);
+}
+
+int NdbOperation::add_value(ColumnValues &to, const char *name,
+                            const void *value, Uint32 len)
+{
+  int no = table->find(name);
+  if (no < 0) {
+    error.set(4004, "Attribute name or id not found in the table");
+    return -1;
+  }
+  const NdbDictionary::Column &c = table->columns[no];
+  std::vector<char> v(c.getSizeInBytes(),
+                      c.getType() == NdbDictionary::Column::Char ? ' ' : 0);
+  std::memcpy(&v[0], value, std::min<size_t>(len, v.size()));
+  to.push_back(std::make_pair(no, v));
+  return 0;
+}
+
+void NdbOperation::add_record(ColumnValues &to, const NdbRecord *record,
+                              const char *row, bool keys_only)
+{
+  for (size_t i = 0; i < record->cols.size(); i++) {
+    const NdbRecord::Col &rc = record->cols[i];
+    const NdbDictionary::Column &c = table->columns[rc.col];
+    // All columns of an index record are key columns
+    if (record->index == NULL && keys_only != c.getPrimaryKey())
+      continue;
+    if (rc.nullable && (row[rc.nullbit_byte] & (1 << rc.nullbit_bit))) {
+      to.push_back(std::make_pair(rc.col, std::vector<char>()));
+    } else {
+      to.push_back(std::make_pair(rc.col,
+                                  std::vector<char>(row + rc.offset,
+                                                    row + rc.offset +
+                                                    c.getSizeInBytes())));
+    }
+  }
+}
+
+int NdbOperation::readTuple(LockMode lm)
+{
+  type = Read;
+  lockMode = lm;
+  return 0;
+}
+
+int NdbOperation::updateTuple()
+{
+  type = Update;
+  lockMode = LM_Exclusive;
+  return 0;
+}
+
+int NdbOperation::equal(const char *name, const char *aValue)
+{
+  return add_value(keys, name, aValue, (Uint32) std::strlen(aValue));
+}
+
+int NdbOperation::equal(const char *name, Int32 aValue)
+{
+  return add_value(keys, name, &aValue, 4);
+}
+
+int NdbOperation::equal(const char *name, Uint32 aValue)
+{
+  return add_value(keys, name, &aValue, 4);
+}
+
+NdbRecAttr *NdbOperation::getValue(const char *name, char *)
+{
+  int no = table->find(name);
+  if (no < 0) {
+    error.set(4004, "Attribute name or id not found in the table");
+    trans->error = error;
+    return NULL;
+  }
+  NdbRecAttr *ra = new NdbRecAttr(no);
+  recAttrs.push_back(ra);
+  trans->ndb->obj_alloc(Ndb::FL_RecAttr);
+  return ra;
+}
+
+int NdbOperation::setValue(const char *name, const char *aValue)
+{
+  return add_value(values, name, aValue, (Uint32) std::strlen(aValue));
+}
+
+int NdbOperation::setValue(const char *name, Int32 aValue)
+{
+  return add_value(values, name, &aValue, 4);
+}
+
+int NdbOperation::setValue(const char *name, Uint32 aValue)
+{
+  return add_value(values, name, &aValue, 4);
+}
+
+void NdbOperation::fill_rec_attrs(size_t r)
+{
+  const Row &row = table->rows[r];
+  for (size_t i = 0; i < recAttrs.size(); i++) {
+    NdbRecAttr *ra = recAttrs[i];
+    const char *v = table->value(row, ra->column);
+    ra->defined = true;
+    ra->null = row.null[ra->column];
+    ra->value.assign(v, v + table->columns[ra->column].getSizeInBytes());
+  }
+  if (resultRecord != NULL) {
+    for (size_t i = 0; i < resultRecord->cols.size(); i++) {
+      const NdbRecord::Col &rc = resultRecord->cols[i];
+      if (rc.nullable) {
+        if (row.null[rc.col]) {
+          resultRow[rc.nullbit_byte] |= (char) (1 << rc.nullbit_bit);
+          continue;
+        }
+        resultRow[rc.nullbit_byte] &= (char) ~(1 << rc.nullbit_bit);
+      }
+      std::memcpy(resultRow + rc.offset, table->value(row, rc.col),
+                  table->columns[rc.col].getSizeInBytes());
+    }
+  }
+}
+
+// Called with the cluster mutex held
+int NdbOperation::execute_key_op()
+{
+  long r = targetRow;
+  if (r < 0 && keyIndex != NULL) {
+    std::string key;
+    for (size_t i = 0; i < keyIndex->columns.size(); i++) {
+      size_t k = 0;
+      while (k < keys.size() && keys[k].first != keyIndex->columns[i])
+        k++;
+      if (k == keys.size() || keys[k].second.empty()) {
+        error.set(4011, "Unique key not fully defined");
+        return -1;
+      }
+      key.append(keys[k].second.begin(), keys[k].second.end());
+    }
+    std::map<std::string, size_t>::const_iterator it =
+      keyIndex->byKey.find(key);
+    if (it == keyIndex->byKey.end()) {
+      error.set(626, "Tuple did not exist", NdbError::PermanentError,
+                NdbError::NoDataFound);
+      return -1;
+    }
+    r = (long) it->second;
+  } else if (r < 0) {
+    std::string key;
+    for (size_t i = 0; i < table->pk.size(); i++) {
+      size_t k = 0;
+      while (k < keys.size() && keys[k].first != table->pk[i])
+        k++;
+      if (k == keys.size()) {
+        error.set(4011, "Primary key not fully defined");
+        return -1;
+      }
+      key.append(keys[k].second.begin(), keys[k].second.end());
+    }
+    std::map<std::string, size_t>::const_iterator it = table->byKey.find(key);
+    if (it == table->byKey.end()) {
+      error.set(626, "Tuple did not exist", NdbError::PermanentError,
+                NdbError::NoDataFound);
+      return -1;
+    }
+    r = (long) it->second;
+  }
+
+  // Committed reads of a read backup table are served by any replica,
+  // everything else by the primary
+  Uint32 partition = table->partitionOf[r];
+  if (table->fullyReplicated)
+    remote = false;
+  else if (type == Read && lockMode == LM_CommittedRead && table->readBackup)
+    remote = !cluster().holds_replica(trans->node, partition);
+  else
+    remote = trans->node != cluster().primary_node(partition);
+
+  if (type == Read) {
+    fill_rec_attrs(r);
+  } else {
+    Row &row = table->rows[r];
+    // Unique index keys before the update, of the indexes it touches
+    std::vector<std::pair<IndexData*, std::string> > oldKeys;
+    for (size_t u = 0; u < table->uniqueIndexes.size(); u++) {
+      IndexData *idx = table->uniqueIndexes[u];
+      for (size_t i = 0; i < values.size(); i++) {
+        if (std::find(idx->columns.begin(), idx->columns.end(),
+                      values[i].first) != idx->columns.end()) {
+          oldKeys.push_back(std::make_pair(idx, idx->key_of(row)));
+          break;
+        }
+      }
+    }
+    for (size_t i = 0; i < values.size(); i++) {
+      int col = values[i].first;
+      if (table->columns[col].getPrimaryKey())
+        continue;
+      row.null[col] = values[i].second.empty();
+      if (!row.null[col])
+        std::memcpy(&row.data[table->offsets[col]], &values[i].second[0],
+                    values[i].second.size());
+    }
+    for (size_t k = 0; k < oldKeys.size(); k++) {
+      IndexData *idx = oldKeys[k].first;
+      std::map<std::string, size_t>::iterator it =
+        idx->byKey.find(oldKeys[k].second);
+      if (it != idx->byKey.end() && it->second == (size_t) r)
+        idx->byKey.erase(it);
+      idx->byKey[idx->key_of(row)] = r;
+    }
+  }
+  return 0;
+}
+
+// NdbScanOperation
+
+NdbScanOperation::NdbScanOperation(NdbTransaction *trans, TableData *table,
+                                   Type type)
+  : NdbOperation(trans, table, type), scanFlags(0), batch(0),
+    pruned(false), partitionId(0), filter(NULL),
+    fetched(0), position(0), current(0), opened(false), closed(false)
+{
+}
+
+NdbScanOperation::~NdbScanOperation()
+{
+  delete filter;
+}
+
+int NdbScanOperation::readTuples(LockMode lm, Uint32 flags, Uint32,
+                                 Uint32 batch_size)
+{
+  lockMode = lm;
+  scanFlags = flags;
+  batch = batch_size;
+  return 0;
+}
+
+void NdbScanOperation::apply_options(const ScanOptions *options)
+{
+  if (options == NULL)
+    return;
+  if (options->optionsPresent & ScanOptions::SO_SCANFLAGS)
+    scanFlags = options->scan_flags;
+  if (options->optionsPresent & ScanOptions::SO_BATCH)
+    batch = options->batch;
+  if (options->optionsPresent & ScanOptions::SO_PARTITION_ID) {
+    pruned = true;
+    partitionId = options->partitionId;
+  }
+  if ((options->optionsPresent & ScanOptions::SO_INTERPRETED) &&
+      options->interpretedCode != NULL &&
+      options->interpretedCode->filter != NULL) {
+    delete filter;
+    filter = options->interpretedCode->filter->clone();
+  }
+}
+
+bool NdbScanOperation::in_range(size_t) const
+{
+  return true;
+}
+
+// Called with the cluster mutex held. The set of rows is fixed when the
+// scan starts; rows are handed out batch by batch.
+void NdbScanOperation::open()
+{
+  result.clear();
+  for (Uint32 p = 0; p < table->partitions; p++) {
+    if (pruned && p != partitionId)
+      continue;
+    size_t first = result.size();
+    for (size_t r = 0; r < table->rows.size(); r++) {
+      if (table->partitionOf[r] != p || !in_range(r))
+        continue;
+      if (filter != NULL && !filter->eval(*table, table->rows[r]))
+        continue;
+      result.push_back(r);
+    }
+    if (type == IndexScan) {
+      // Each fragment of an ordered index is returned in index order
+      const NdbIndexScanOperation *isop =
+        static_cast<const NdbIndexScanOperation*>(this);
+      std::stable_sort(result.begin() + first, result.end(),
+                       [this, isop](size_t a, size_t b) {
+                         return isop->key_compare(a, b) < 0;
+                       });
+    }
+  }
+
+  if (type == IndexScan &&
+      (scanFlags & (SF_OrderBy | SF_OrderByFull | SF_Descending))) {
+    const NdbIndexScanOperation *isop =
+      static_cast<const NdbIndexScanOperation*>(this);
+    bool desc = (scanFlags & SF_Descending) != 0;
+    std::stable_sort(result.begin(), result.end(),
+                     [isop, desc](size_t a, size_t b) {
+                       int c = isop->key_compare(a, b);
+                       return desc ? c > 0 : c < 0;
+                     });
+  }
+
+  opened = true;
+  fetched = 0;
+  position = 0;
+}
+
+// Rows returned by one round trip: one batch from every partition scanned
+bool NdbScanOperation::fetch()
+{
+  if (fetched >= result.size())
+    return false;
+  Uint32 per_partition = batch ? batch : cluster().config.scan_batch;
+  size_t n = (size_t) per_partition * (pruned ? 1 : table->partitions);
+  n = std::min(n, result.size() - fetched);
+  fetched += n;
+
+  Ndb *ndb = trans->ndb;
+  ndb->clientStats[Ndb::ScanBatchCount]++;
+  ndb->clientStats[Ndb::ReadRowCount] += n;
+  return true;
+}
+
+void NdbScanOperation::deliver(size_t pos)
+{
+  std::lock_guard<std::mutex> guard(cluster().mutex);
+  current = result[pos];
+  fill_rec_attrs(current);
+}
+
+int NdbScanOperation::nextResult(bool fetchAllowed, bool)
+{
+  if (!opened || closed) {
+    error.set(4120, "Scan already complete");
+    trans->error = error;
+    return -1;
+  }
+  if (position >= fetched) {
+    if (fetched >= result.size())
+      return 1;
+    if (!fetchAllowed)
+      return 2;
+    size_t before = fetched;
+    fetch();
+    cluster().round_trip(fetched - before, false, trans->node);
+    trans->ndb->clientStats[Ndb::WaitScanResultCount]++;
+  }
+  deliver(position++);
+  return 0;
+}
+
+int NdbScanOperation::nextResult(const char **out_row_ptr,
+                                 bool fetchAllowed, bool forceSend)
+{
+  if (rowBuffer.empty() && resultRecord != NULL) {
+    Uint32 size = 0;
+    for (size_t i = 0; i < resultRecord->cols.size(); i++) {
+      const NdbRecord::Col &rc = resultRecord->cols[i];
+      size = std::max<Uint32>(size, rc.offset +
+                              table->columns[rc.col].getSizeInBytes());
+      size = std::max<Uint32>(size, rc.nullbit_byte + 1);
+    }
+    rowBuffer.assign(size, 0);
+    resultRow = &rowBuffer[0];
+  }
+  int res = nextResult(fetchAllowed, forceSend);
+  if (res == 0 && out_row_ptr != NULL)
+    *out_row_ptr = resultRow;
+  return res;
+}
+
+void NdbScanOperation::close(bool, bool)
+{
+  closed = true;
+}
+
+NdbOperation *NdbScanOperation::updateCurrentTuple()
+{
+  NdbOperation *op = new NdbOperation(trans, table, Update);
+  op->targetRow = (long) current;
+  trans->operations.push_back(op);
+  return op;
+}
+
+const NdbOperation *
+NdbScanOperation::updateCurrentTuple(NdbTransaction *takeOverTrans,
+                                     const NdbRecord *record,
+                                     const char *row,
+                                     const unsigned char *,
+                                     const OperationOptions *, Uint32)
+{
+  NdbOperation *op = new NdbOperation(takeOverTrans, table, Update);
+  op->targetRow = (long) current;
+  op->add_record(op->values, record, row, false);
+  takeOverTrans->operations.push_back(op);
+  return op;
+}
+
+// NdbIndexScanOperation
+
+NdbIndexScanOperation::NdbIndexScanOperation(NdbTransaction *trans,
+                                             IndexData *index)
+  : NdbScanOperation(trans, index->table, IndexScan), index(index)
+{
+}
+
+int NdbIndexScanOperation::key_compare(size_t a, size_t b) const
+{
+  const Row &ra = table->rows[a], &rb = table->rows[b];
+  for (size_t i = 0; i < index->columns.size(); i++) {
+    int col = index->columns[i];
+    int c = table->compare(col, table->value(ra, col), table->value(rb, col));
+    if (c != 0)
+      return c;
+  }
+  return 0;
+}
+
+// Compares the index key prefix of a row with a bound
+int NdbIndexScanOperation::bound_compare(size_t r, const Bound &b) const
+{
+  const Row &row = table->rows[r];
+  for (size_t i = 0; i < b.keys.size(); i++) {
+    int col = index->columns[i];
+    int c = table->compare(col, table->value(row, col), &b.keys[i][0]);
+    if (c != 0)
+      return c;
+  }
+  return 0;
+}
+
+bool NdbIndexScanOperation::in_range(size_t r) const
+{
+  if (!low.keys.empty()) {
+    int c = bound_compare(r, low);
+    if (c < 0 || (c == 0 && !low.inclusive))
+      return false;
+  }
+  if (!high.keys.empty()) {
+    int c = bound_compare(r, high);
+    if (c > 0 || (c == 0 && !high.inclusive))
+      return false;
+  }
+  return true;
+}
+
+int NdbIndexScanOperation::setBound(const char *attr, int type,
+                                    const void *value)
+{
+  int col = table->find(attr);
+  if (col < 0 || std::find(index->columns.begin(), index->columns.end(),
+                           col) == index->columns.end()) {
+    error.set(4004, "Attribute name or id not found in the table");
+    trans->error = error;
+    return -1;
+  }
+  const char *v = (const char*) value;
+  std::vector<char> key(v, v + table->columns[col].getSizeInBytes());
+
+  // BoundLE/LT: the value is a lower bound, BoundGE/GT an upper bound
+  if (type == BoundLE || type == BoundLT || type == BoundEQ) {
+    low.keys.push_back(key);
+    low.inclusive = type != BoundLT;
+  }
+  if (type == BoundGE || type == BoundGT || type == BoundEQ) {
+    high.keys.push_back(key);
+    high.inclusive = type != BoundGT;
+  }
+  return 0;
+}
+
+int NdbIndexScanOperation::setBound(const NdbRecord *key_record,
+                                    const IndexBound &bound)
+{
+  low.keys.clear();
+  high.keys.clear();
+  for (int side = 0; side < 2; side++) {
+    const char *row = side == 0 ? bound.low_key : bound.high_key;
+    Uint32 count = side == 0 ? bound.low_key_count : bound.high_key_count;
+    Bound &b = side == 0 ? low : high;
+    b.inclusive = side == 0 ? bound.low_inclusive : bound.high_inclusive;
+    for (Uint32 i = 0; row != NULL && i < count &&
+                       i < index->columns.size(); i++) {
+      int col = index->columns[i];
+      for (size_t k = 0; k < key_record->cols.size(); k++) {
+        if (key_record->cols[k].col != col)
+          continue;
+        const char *v = row + key_record->cols[k].offset;
+        b.keys.push_back(std::vector<char>(
+                           v, v + table->columns[col].getSizeInBytes()));
+        break;
+      }
+    }
+  }
+  return 0;
+}
+
+int NdbIndexScanOperation::end_of_bound(Uint32)
+{
+  return 0;
+}
+
+// NdbTransaction
+
+NdbTransaction::NdbTransaction(Ndb *ndb)
+  : ndb(ndb), node(1), executed(0), committed(false),
+    status(NotStarted),
+    asyncExecType(NoExecTypeDef),
+    asyncAbortOption(NdbOperation::DefaultAbortOption), asyncCallback(NULL),
+    asyncObject(NULL), asyncResult(0), asyncDueNs(0)
+{
+  ndb->obj_alloc(Ndb::FL_Transaction);
+}
+
+NdbTransaction::~NdbTransaction()
+{
+  for (size_t i = 0; i < operations.size(); i++)
+    delete operations[i];
+  ndb->obj_free(Ndb::FL_Transaction);
+}
+
+NdbOperation *NdbTransaction::getNdbOperation(const NdbDictionary::Table *t)
+{
+  NdbOperation *op = new NdbOperation(this, t->data, NdbOperation::Read);
+  op->schemaVersion = t->version;
+  operations.push_back(op);
+  return op;
+}
+
+NdbScanOperation *
+NdbTransaction::getNdbScanOperation(const NdbDictionary::Table *t)
+{
+  NdbScanOperation *op =
+    new NdbScanOperation(this, t->data, NdbOperation::Scan);
+  op->schemaVersion = t->version;
+  operations.push_back(op);
+  return op;
+}
+
+NdbIndexScanOperation *
+NdbTransaction::getNdbIndexScanOperation(const NdbDictionary::Index *index)
+{
+  NdbIndexScanOperation *op = new NdbIndexScanOperation(this, index->data);
+  operations.push_back(op);
+  return op;
+}
+
+const NdbOperation *
+NdbTransaction::readTuple(const NdbRecord *key_rec, const char *key_row,
+                          const NdbRecord *result_rec, char *result_row,
+                          NdbOperation::LockMode lock_mode,
+                          const unsigned char *,
+                          const NdbOperation::OperationOptions *, Uint32)
+{
+  NdbOperation *op =
+    new NdbOperation(this, key_rec->table, NdbOperation::Read);
+  op->schemaVersion = key_rec->version;
+  op->lockMode = lock_mode;
+  op->add_record(op->keys, key_rec, key_row, true);
+  if (key_rec->index != NULL) {
+    if (key_rec->index->type != NdbDictionary::Index::UniqueHashIndex) {
+      error.set(4011, "Key reads need a primary or unique key NdbRecord");
+      delete op;
+      return NULL;
+    }
+    op->keyIndex = key_rec->index;
+  }
+  op->resultRecord = result_rec;
+  op->resultRow = result_row;
+  operations.push_back(op);
+  return op;
+}
+
+const NdbOperation *
+NdbTransaction::updateTuple(const NdbRecord *key_rec, const char *key_row,
+                            const NdbRecord *attr_rec, const char *attr_row,
+                            const unsigned char *,
+                            const NdbOperation::OperationOptions *, Uint32)
+{
+  NdbOperation *op =
+    new NdbOperation(this, key_rec->table, NdbOperation::Update);
+  op->schemaVersion = key_rec->version;
+  op->add_record(op->keys, key_rec, key_row, true);
+  op->add_record(op->values, attr_rec, attr_row, false);
+  operations.push_back(op);
+  return op;
+}
+
+NdbScanOperation *
+NdbTransaction::scanTable(const NdbRecord *result_record,
+                          NdbOperation::LockMode lock_mode,
+                          const unsigned char *,
+                          const NdbScanOperation::ScanOptions *options,
+                          Uint32)
+{
+  NdbScanOperation *op =
+    new NdbScanOperation(this, result_record->table, NdbOperation::Scan);
+  op->schemaVersion = result_record->version;
+  op->lockMode = lock_mode;
+  op->resultRecord = result_record;
+  op->apply_options(options);
+  operations.push_back(op);
+  return op;
+}
+
+NdbIndexScanOperation *
+NdbTransaction::scanIndex(const NdbRecord *key_record,
+                          const NdbRecord *result_record,
+                          NdbOperation::LockMode lock_mode,
+                          const unsigned char *,
+                          const NdbIndexScanOperation::IndexBound *bound,
+                          const NdbScanOperation::ScanOptions *options,
+                          Uint32)
+{
+  if (key_record->index == NULL ||
+      key_record->index->type != NdbDictionary::Index::OrderedIndex) {
+    error.set(4011, "scanIndex() needs an ordered index NdbRecord");
+    return NULL;
+  }
+  NdbIndexScanOperation *op =
+    new NdbIndexScanOperation(this, key_record->index);
+  op->schemaVersion = result_record->version;
+  op->lockMode = lock_mode;
+  op->resultRecord = result_record;
+  op->apply_options(options);
+  if (bound != NULL)
+    op->setBound(key_record, *bound);
+  operations.push_back(op);
+  return op;
+}
+
+int NdbTransaction::execute(ExecType execType,
+                            NdbOperation::AbortOption abortOption, int)
+{
+  Uint32 us = 0;
+  int res = run(execType, abortOption, &us);
+  if (us)
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+  return res;
+}
+
+void NdbTransaction::executeAsynchPrepare(ExecType execType,
+                                          NdbAsynchCallback callback,
+                                          void *anyObject,
+                                          NdbOperation::AbortOption
+                                            abortOption)
+{
+  asyncExecType = execType;
+  asyncAbortOption = abortOption;
+  asyncCallback = callback;
+  asyncObject = anyObject;
+  ndb->prepared.push_back(this);
+}
+
+int NdbTransaction::run(ExecType execType,
+                        NdbOperation::AbortOption abortOption, Uint32 *us)
+{
+  *us = 0;
+  if (committed) {
+    error.set(4011, "Transaction already committed");
+    return -1;
+  }
+
+  // Everything defined since the last execute() goes out in one round
+  // trip; a commit costs one even without new operations. Scans started
+  // here get their first batch with the reply.
+  bool send = executed < operations.size() ||
+              execType == Commit || execType == Rollback;
+  int res = 0;
+  Uint64 rows = 0;
+  Uint32 keyOps = 0;
+  bool remote = false;
+  {
+    std::lock_guard<std::mutex> guard(cluster().mutex);
+    cluster().tick();
+    for (; executed < operations.size(); executed++) {
+      NdbOperation *op = operations[executed];
+      if (op->schemaVersion != op->table->version) {
+        op->error.set(241, "Invalid schema object version",
+                      NdbError::PermanentError, NdbError::SchemaError);
+        error = op->error;
+        res = -1;
+        executed = operations.size();
+        break;
+      }
+      if (op->type == NdbOperation::Scan ||
+          op->type == NdbOperation::IndexScan) {
+        NdbScanOperation *sop = static_cast<NdbScanOperation*>(op);
+        sop->open();
+        size_t before = sop->fetched;
+        sop->fetch();
+        rows += sop->fetched - before;
+        ndb->clientStats[op->type == NdbOperation::Scan ?
+                         Ndb::TableScanCount : Ndb::RangeScanCount]++;
+        if (sop->pruned)
+          ndb->clientStats[Ndb::PrunedScanCount]++;
+      } else {
+        ndb->clientStats[op->keyIndex ? Ndb::UkOpCount : Ndb::PkOpCount]++;
+        keyOps++;
+        if (op->execute_key_op() != 0) {
+          error = op->error;
+          if (abortOption != NdbOperation::AO_IgnoreError) {
+            res = -1;
+            executed = operations.size();
+            break;
+          }
+        } else if (op->type == NdbOperation::Read) {
+          rows++;
+          ndb->clientStats[Ndb::ReadRowCount]++;
+          if (!op->remote)
+            ndb->clientStats[Ndb::TransLocalReadRowCount]++;
+        }
+        remote = remote || op->remote;
+      }
+    }
+  }
+
+  if (send) {
+    status = Started;
+    *us = cluster().latency_us(rows, remote, node, keyOps);
+    ndb->clientStats[Ndb::WaitExecCompleteCount]++;
+  }
+
+  if (execType == Commit || execType == Rollback || res != 0) {
+    committed = true;
+    status = res == 0 && execType == Commit ? Committed : Aborted;
+    for (size_t i = 0; i < operations.size(); i++) {
+      if (operations[i]->type == NdbOperation::Scan ||
+          operations[i]->type == NdbOperation::IndexScan)
+        static_cast<NdbScanOperation*>(operations[i])->closed = true;
+    }
+    ndb->clientStats[res == 0 && execType == Commit ?
+                     Ndb::TransCommitCount : Ndb::TransAbortCount]++;
+  }
+  return res;
+}
+
+// Ndb
+
+Ndb::Ndb(Ndb_cluster_connection *conn, const char *aCatalogName,
+         const char *)
+  : connection(conn), database(aCatalogName ? aCatalogName : ""),
+    dict(new NdbDictionary::Dictionary(this)), initialized(false)
+{
+  std::memset(clientStats, 0, sizeof clientStats);
+  std::memset(liveObjects, 0, sizeof liveObjects);
+  std::memset(createdObjects, 0, sizeof createdObjects);
+}
+
+Ndb::~Ndb()
+{
+  delete dict;
+}
+
+int Ndb::init(int)
+{
+  if (connection == NULL || connection->wait_until_ready(0, 0) != 0) {
+    error.set(4009, "Cluster Failure", NdbError::TemporaryError,
+              NdbError::NodeRecoveryError);
+    return -1;
+  }
+  initialized = true;
+  return 0;
+}
+
+// The coordinator is the primary of the hinted partition, or the
+// neighbour when it holds a replica and the table allows reading backups.
+// Unhinted transactions go to the neighbour or round robin.
+NdbTransaction *Ndb::startTransaction(const NdbDictionary::Table *table,
+                                      Uint32 partitionId)
+{
+  if (!initialized) {
+    error.set(4009, "Cluster Failure", NdbError::TemporaryError,
+              NdbError::NodeRecoveryError);
+    return NULL;
+  }
+
+  NdbTransaction *trans = new NdbTransaction(this);
+  {
+    std::lock_guard<std::mutex> guard(cluster().mutex);
+    NdbStandin::Cluster &c = cluster();
+    Uint32 neighbour = connection->neighbour;
+    if (neighbour > c.config.data_nodes)
+      neighbour = 0;
+    if (table != NULL && partitionId != ~(Uint32) 0) {
+      partitionId %= table->data->partitions;
+      trans->node = c.primary_node(partitionId);
+      if (neighbour && (table->data->readBackup ||
+                        table->data->fullyReplicated) &&
+          c.holds_replica(neighbour, partitionId))
+        trans->node = neighbour;
+    } else if (neighbour) {
+      trans->node = neighbour;
+    } else {
+      trans->node = c.nextNode++ % c.config.data_nodes + 1;
+    }
+    c.stats.transactions++;
+  }
+  clientStats[TransStartCount]++;
+  return trans;
+}
+
+NdbTransaction *Ndb::startTransaction(const NdbDictionary::Table *table,
+                                      const char *keyData, Uint32 keyLen)
+{
+  if (table == NULL || keyData == NULL)
+    return startTransaction(table, ~(Uint32) 0);
+  return startTransaction(table,
+                          table->data->partition_of(keyData, keyLen));
+}
+
+void Ndb::closeTransaction(NdbTransaction *trans)
+{
+  if (trans == NULL)
+    return;
+  prepared.erase(std::remove(prepared.begin(), prepared.end(), trans),
+                 prepared.end());
+  sent.erase(std::remove(sent.begin(), sent.end(), trans), sent.end());
+  clientStats[TransCloseCount]++;
+  delete trans;
+}
+
+static Uint64 steady_now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Ndb::sendPreparedTransactions(int forceSend)
+{
+  std::vector<NdbTransaction*> batch;
+  batch.swap(prepared);
+  for (size_t i = 0; i < batch.size(); i++) {
+    NdbTransaction *trans = batch[i];
+    Uint32 us;
+    trans->asyncResult = trans->run(trans->asyncExecType,
+                                    trans->asyncAbortOption, &us);
+    trans->asyncDueNs = steady_now_ns() + (Uint64) us * 1000;
+    sent.push_back(trans);
+  }
+  if (!batch.empty())
+    clientStats[forceSend ? ForcedSendsCount : UnforcedSendsCount]++;
+}
+
+int Ndb::pollNdb(int aMillisecondNumber, int minNoOfEventsToWakeup)
+{
+  // Wait for the wanted number of replies, in the order they arrive
+  std::vector<Uint64> due;
+  for (size_t i = 0; i < sent.size(); i++)
+    due.push_back(sent[i]->asyncDueNs);
+  std::sort(due.begin(), due.end());
+  size_t want = minNoOfEventsToWakeup < 1 ? 1 : minNoOfEventsToWakeup;
+  Uint64 deadline = steady_now_ns() + (Uint64) aMillisecondNumber * 1000000;
+  if (!due.empty()) {
+    Uint64 until = std::min(due[std::min(want, due.size()) - 1], deadline);
+    Uint64 now = steady_now_ns();
+    if (until > now)
+      std::this_thread::sleep_for(std::chrono::nanoseconds(until - now));
+  }
+
+  std::vector<NdbTransaction*> completed;
+  Uint64 now = steady_now_ns();
+  for (size_t i = 0; i < sent.size(); ) {
+    if (sent[i]->asyncDueNs <= now) {
+      completed.push_back(sent[i]);
+      sent.erase(sent.begin() + i);
+    } else {
+      i++;
+    }
+  }
+  // A callback may close its transaction or prepare new ones
+  for (size_t i = 0; i < completed.size(); i++)
+    completed[i]->asyncCallback(completed[i]->asyncResult, completed[i],
+                                completed[i]->asyncObject);
+  return (int) completed.size();
+}
+
+int Ndb::sendPollNdb(int aMillisecondNumber, int minNoOfEventsToWakeup,
+                     int forceSend)
+{
+  sendPreparedTransactions(forceSend);
+  return pollNdb(aMillisecondNumber, minNoOfEventsToWakeup);
+}
+
+Uint64 Ndb::getClientStat(Uint32 id) const
+{
+  return id < NumClientStatistics ? clientStats[id] : 0;
+}
+
+const char *Ndb::getClientStatName(Uint32 id) const
+{
+  static const char *names[NumClientStatistics] = {
+    "WaitExecCompleteCount", "WaitScanResultCount", "WaitMetaRequestCount",
+    "WaitNanosCount", "BytesSentCount", "BytesRecvdCount",
+    "TransStartCount", "TransCommitCount", "TransAbortCount",
+    "TransCloseCount", "PkOpCount", "UkOpCount", "TableScanCount",
+    "RangeScanCount", "PrunedScanCount", "ScanBatchCount", "ReadRowCount",
+    "TransLocalReadRowCount", "DataEventsRecvdCount",
+    "NonDataEventsRecvdCount", "EventBytesRecvdCount", "ForcedSendsCount",
+    "UnforcedSendsCount", "DeferredSendsCount"
+  };
+  return id < NumClientStatistics ? names[id] : NULL;
+}
+
+void Ndb::obj_alloc(FreeList list)
+{
+  if (++liveObjects[list] > createdObjects[list])
+    createdObjects[list] = liveObjects[list];
+}
+
+void Ndb::obj_free(FreeList list)
+{
+  liveObjects[list]--;
+}
+
+Ndb::Free_list_usage *Ndb::get_free_list_usage(Free_list_usage *curr)
+{
+  static const char *names[NumFreeLists] = {
+    "NdbTransaction", "NdbOperation", "NdbIndexScanOperation", "NdbRecAttr"
+  };
+  static const Uint32 sizes[NumFreeLists] = {
+    sizeof(NdbTransaction), sizeof(NdbOperation),
+    sizeof(NdbIndexScanOperation), sizeof(NdbRecAttr)
+  };
+
+  int next = 0;
+  if (curr->m_name != NULL) {
+    while (next < NumFreeLists && std::strcmp(names[next], curr->m_name) != 0)
+      next++;
+    next++;
+  }
+  if (next >= NumFreeLists)
+    return NULL;
+
+  curr->m_name = names[next];
+  curr->m_created = createdObjects[next];
+  curr->m_free = createdObjects[next] - liveObjects[next];
+  curr->m_sizeof = sizes[next];
+  return curr;
+}
@@ -0,0 +1,480 @@
+// Committed reads from the nearest replica.
+//
+// read_tuples.cc reads Country with LM_Read. A locked read is always
+// served by the primary replica, and an unhinted transaction picks its
+// coordinator without regard to where the row lives, so most reads pay an
+// extra hop between data nodes and all of them load the primaries.
+//
+// For a table with READ_BACKUP or FULLY_REPLICATED set (see
+// country_read_backup.sql), a committed read can be served by any replica.
+// ReplicaReader starts each transaction with the key as hint and reads with
+// LM_CommittedRead, so the coordinator is a node holding the row, and the
+// data node neighbour makes that the nearest one. Keys the session has
+// written itself are read with LM_Read until the session ends, and so are
+// all reads when the table does not allow reading backups.
+//
+// The neighbour is a node id, or "auto" to time a few reads through every
+// data node and take the fastest. The benchmark reports latency and the
+// share of rows read on the coordinator node (TransLocalReadRowCount /
+// ReadRowCount) for locked reads as in read_tuples.cc and for both
+// ReplicaReader modes.
+//
+// Usage: nearest_replica_read [reads] [auto|none|<node id>]
+#include <NdbApi.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <stddef.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+const char *connectstring = "127.0.0.1:1186";
+const char *db = "world";
+
+typedef std::chrono::steady_clock Clock;
+
+struct CountryRow {
+  char   nullBits;
+  char   Code[3];
+  char   Name[52];
+  Uint32 Capital;
+};
+
+// Reads Country rows by primary key from the nearest replica when that
+// is safe, and from the primary otherwise.
+class ReplicaReader {
+public:
+  enum Consistency {
+    Committed,          // latest committed row, any replica
+    ReadYourWrites      // always the primary, under a shared lock
+  };
+
+  ReplicaReader(Ndb *ndb, const NdbDictionary::Table *table,
+                const NdbRecord *pkRecord, const NdbRecord *valsRecord)
+    : replicaReads(0), lockedReads(0), lastNode(0),
+      ndb(ndb), table(table), pkRecord(pkRecord), valsRecord(valsRecord)
+  {
+    replicaOk = table->getReadBackupFlag() || table->getFullyReplicated();
+  };
+
+  bool replica_reads_allowed() const { return replicaOk; }
+
+  // `row.Code` holds the key; the other columns are filled in
+  int read(CountryRow &row, Consistency consistency = Committed);
+
+  // The session wrote this key; later reads must see that write
+  void note_write(const char *code) { written.insert(std::string(code, 3)); }
+
+  Uint64 replicaReads, lockedReads;
+  Uint32 lastNode;     // coordinator of the last read
+
+private:
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb *ndb;
+  const NdbDictionary::Table *table;
+  const NdbRecord *pkRecord, *valsRecord;
+  bool replicaOk;
+  std::set<std::string> written;
+};
+
+int ReplicaReader::read(CountryRow &row, Consistency consistency)
+{
+  bool locked = consistency == ReadYourWrites || !replicaOk ||
+                written.count(std::string(row.Code, 3)) > 0;
+
+  // The hint puts the coordinator on a node with a replica of the row,
+  // the neighbour if it has one. Locked reads still go to the primary.
+  NdbTransaction *myTransaction =
+    ndb->startTransaction(table, row.Code, sizeof(row.Code));
+  if (myTransaction == NULL) {
+    print_error(ndb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  const NdbOperation *op =
+    myTransaction->readTuple(pkRecord, (char*) &row,
+                             valsRecord, (char*) &row,
+                             locked ? NdbOperation::LM_Read
+                                    : NdbOperation::LM_CommittedRead);
+  if (op == NULL ||
+      myTransaction->execute( NdbTransaction::Commit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Read failed.");
+    ndb->closeTransaction(myTransaction);
+    return -1;
+  }
+
+  lastNode = myTransaction->getConnectedNodeId();
+  if (locked)
+    lockedReads++;
+  else
+    replicaReads++;
+  ndb->closeTransaction(myTransaction);
+  return 0;
+}
+
+class NearestReplicaExample {
+public:
+  NearestReplicaExample() : cluster_connection(NULL), myNdb(NULL),
+                            myDict(NULL), myTable(NULL) {};
+  ~NearestReplicaExample();
+  int doTest(int reads, const char *neighbour);
+
+private:
+  enum Mode { LockedUnhinted, ReplicaCommitted, ReplicaLocked };
+
+  struct Result {
+    double avg_us, p50_us, p99_us;
+    Uint64 rows, localRows;
+    std::map<Uint32, Uint64> nodes;   // reads per coordinator node
+  };
+
+  int load_codes();
+  int choose_neighbour(const char *neighbour);
+  int run(Mode mode, int reads, Result &result);
+  int locked_read(CountryRow &row, Uint32 &node);
+  int read_your_writes();
+  void report(const char *label, const Result &r, const Result *base);
+
+  std::string char_to_str(const char *s, int max_len)
+  {
+    std::string str(s, max_len);
+    return str.substr(0, str.find_last_not_of(" ") + 1);
+  }
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *cluster_connection;
+  Ndb *myNdb;
+  NdbDictionary::Dictionary* myDict;
+  const NdbDictionary::Table *myTable;
+  const NdbRecord *pkRecord, *valsRecord, *nameRecord;
+  std::vector<std::string> codes;
+};
+
+int NearestReplicaExample::doTest(int reads, const char *neighbour)
+{
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  // Step 2. Connecting to the cluster
+  cluster_connection = new Ndb_cluster_connection(connectstring);
+  if (cluster_connection->connect(4 /* retries               */,
+                                  5 /* delay between retries */,
+                                  1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (cluster_connection->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+
+  // Step 3. Connect to 'world' database
+  myNdb = new Ndb(cluster_connection, db);
+  if (myNdb->init()) {
+    print_error(myNdb->getNdbError(),
+                "Could not connect to the database object.");
+    return 3;
+  }
+
+  // Step 4. Get table metadata
+  myDict = myNdb->getDictionary();
+  if ((myTable = myDict->getTable("Country")) == NULL) {
+    print_error(myDict->getNdbError(), "Could not retrieve a table.");
+    return 4;
+  }
+  std::cout << "Country: read backup "
+            << (myTable->getReadBackupFlag() ? "on" : "off")
+            << ", fully replicated "
+            << (myTable->getFullyReplicated() ? "on" : "off") << std::endl;
+  if (!myTable->getReadBackupFlag() && !myTable->getFullyReplicated())
+    std::cout << "Replica reads are not allowed; ReplicaReader uses locked "
+              << "reads (see country_read_backup.sql)." << std::endl;
+
+  // Step 5. Define NdbRecord's
+  NdbDictionary::RecordSpecification recordSpec[3];
+  std::memset(recordSpec, 0, sizeof recordSpec);
+  int rsSize = sizeof(recordSpec[0]);
+
+  recordSpec[0].column = myTable->getColumn("Code");
+  recordSpec[0].offset = offsetof(struct CountryRow, Code);
+  recordSpec[1].column = myTable->getColumn("Name");
+  recordSpec[1].offset = offsetof(struct CountryRow, Name);
+  recordSpec[2].column = myTable->getColumn("Capital");
+  recordSpec[2].offset = offsetof(struct CountryRow, Capital);
+  recordSpec[2].nullbit_byte_offset = offsetof(struct CountryRow, nullBits);
+  recordSpec[2].nullbit_bit_in_byte = 0;
+
+  pkRecord = myDict->createRecord(myTable, recordSpec, 1, rsSize);
+  nameRecord = myDict->createRecord(myTable, recordSpec, 2, rsSize);
+  valsRecord = myDict->createRecord(myTable, recordSpec, 3, rsSize);
+  if (pkRecord == NULL || nameRecord == NULL || valsRecord == NULL) {
+    print_error(myDict->getNdbError(), "Failed to initialize NdbRecords'.");
+    return 5;
+  }
+
+  // Step 6. Pick the data node neighbour
+  if (load_codes())
+    return 6;
+  if (choose_neighbour(neighbour))
+    return 7;
+
+  // Step 7. Compare locked reads with both ReplicaReader modes
+  Result base, replica, locked;
+  if (run(LockedUnhinted, reads, base) ||
+      run(ReplicaCommitted, reads, replica) ||
+      run(ReplicaLocked, reads, locked))
+    return 8;
+
+  std::cout << "========== " << reads << " Country reads ==========" << std::endl;
+  report("LM_Read, no hint    ", base, NULL);
+  report("replica, committed  ", replica, &base);
+  report("replica, read-writes", locked, &base);
+
+  // Step 8. Writes of the session switch its reads of that key to locked
+  if (read_your_writes())
+    return 9;
+  return 0;
+}
+
+int NearestReplicaExample::load_codes()
+{
+  NdbTransaction *myTransaction = myNdb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(myNdb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  NdbScanOperation *sop =
+    myTransaction->scanTable(pkRecord, NdbOperation::LM_CommittedRead);
+  if (sop == NULL ||
+      myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    myNdb->closeTransaction(myTransaction);
+    return -1;
+  }
+
+  int check;
+  const CountryRow *row;
+  while ((check = sop->nextResult((const char**) &row, true, false)) == 0)
+    codes.push_back(std::string(row->Code, 3));
+  myNdb->closeTransaction(myTransaction);
+  if (check == -1 || codes.empty()) {
+    std::cerr << "Could not read country codes." << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+// "auto" times committed reads through every data node as neighbour and
+// keeps the fastest; with "none" the neighbour is left unset.
+int NearestReplicaExample::choose_neighbour(const char *neighbour)
+{
+  if (std::strcmp(neighbour, "none") == 0) {
+    std::cout << "Data node neighbour: none" << std::endl;
+    return 0;
+  }
+  if (std::strcmp(neighbour, "auto") != 0) {
+    cluster_connection->set_data_node_neighbour(std::atoi(neighbour));
+    std::cout << "Data node neighbour: " << neighbour << std::endl;
+    return 0;
+  }
+
+  const int probes = 100;
+  ReplicaReader reader(myNdb, myTable, pkRecord, valsRecord);
+  Ndb_cluster_connection_node_iter iter;
+  Uint32 best = 0;
+  double bestUs = 0;
+  cluster_connection->init_get_next_node(iter);
+  for (Uint32 node; (node = cluster_connection->get_next_node(iter)) != 0; ) {
+    cluster_connection->set_data_node_neighbour(node);
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < probes; i++) {
+      CountryRow row;
+      std::memcpy(row.Code, codes[i % codes.size()].data(), 3);
+      if (reader.read(row))
+        return -1;
+    }
+    double us = std::chrono::duration<double, std::micro>(
+                  Clock::now() - start).count() / probes;
+    std::cout << "Probe node " << node << ": " << std::fixed
+              << std::setprecision(1) << us << " us/read" << std::endl;
+    if (best == 0 || us < bestUs) {
+      best = node;
+      bestUs = us;
+    }
+  }
+
+  cluster_connection->set_data_node_neighbour(best);
+  std::cout << "Data node neighbour: " << best << std::endl;
+  return 0;
+}
+
+// Same read as read_tuples.cc: unhinted transaction, shared lock
+int NearestReplicaExample::locked_read(CountryRow &row, Uint32 &node)
+{
+  NdbTransaction *myTransaction = myNdb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(myNdb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  const NdbOperation *op =
+    myTransaction->readTuple(pkRecord, (char*) &row,
+                             valsRecord, (char*) &row,
+                             NdbOperation::LM_Read);
+  if (op == NULL ||
+      myTransaction->execute( NdbTransaction::Commit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Read failed.");
+    myNdb->closeTransaction(myTransaction);
+    return -1;
+  }
+  node = myTransaction->getConnectedNodeId();
+  myNdb->closeTransaction(myTransaction);
+  return 0;
+}
+
+int NearestReplicaExample::run(Mode mode, int reads, Result &result)
+{
+  ReplicaReader reader(myNdb, myTable, pkRecord, valsRecord);
+  std::vector<double> latencies;
+  latencies.reserve(reads);
+  result.nodes.clear();
+
+  Uint64 rows0 = myNdb->getClientStat(Ndb::ReadRowCount);
+  Uint64 local0 = myNdb->getClientStat(Ndb::TransLocalReadRowCount);
+
+  for (int i = 0; i < reads; i++) {
+    CountryRow row;
+    std::memcpy(row.Code, codes[(i * 7) % codes.size()].data(), 3);
+    Uint32 node = 0;
+
+    Clock::time_point start = Clock::now();
+    int err;
+    if (mode == LockedUnhinted) {
+      err = locked_read(row, node);
+    } else {
+      err = reader.read(row, mode == ReplicaCommitted
+                               ? ReplicaReader::Committed
+                               : ReplicaReader::ReadYourWrites);
+      node = reader.lastNode;
+    }
+    if (err)
+      return -1;
+    latencies.push_back(std::chrono::duration<double, std::micro>(
+                          Clock::now() - start).count());
+    result.nodes[node]++;
+  }
+
+  result.rows = myNdb->getClientStat(Ndb::ReadRowCount) - rows0;
+  result.localRows = myNdb->getClientStat(Ndb::TransLocalReadRowCount) -
+                     local0;
+
+  double sum = 0;
+  for (size_t i = 0; i < latencies.size(); i++)
+    sum += latencies[i];
+  std::sort(latencies.begin(), latencies.end());
+  result.avg_us = sum / latencies.size();
+  result.p50_us = latencies[latencies.size() / 2];
+  result.p99_us = latencies[latencies.size() * 99 / 100];
+  return 0;
+}
+
+void NearestReplicaExample::report(const char *label, const Result &r,
+                                   const Result *base)
+{
+  std::cout << label << std::fixed << std::setprecision(1)
+            << "  avg " << r.avg_us << " us"
+            << ", p50 " << r.p50_us << " us"
+            << ", p99 " << r.p99_us << " us"
+            << ", local " << (r.rows ? 100.0 * r.localRows / r.rows : 0.0)
+            << "%";
+  if (base != NULL)
+    std::cout << ", avg delta " << std::showpos << (r.avg_us - base->avg_us)
+              << std::noshowpos << " us";
+  std::cout << ", coordinators";
+  for (std::map<Uint32, Uint64>::const_iterator it = r.nodes.begin();
+       it != r.nodes.end(); ++it)
+    std::cout << " " << it->first << ":" << it->second;
+  std::cout << std::endl;
+}
+
+// Rewrites the name of one country unchanged, then reads it back. The
+// read after the write is locked, reads of other keys stay on replicas.
+int NearestReplicaExample::read_your_writes()
+{
+  std::cout << "========== Read your writes ==========" << std::endl;
+  ReplicaReader reader(myNdb, myTable, pkRecord, valsRecord);
+
+  CountryRow row;
+  std::memcpy(row.Code, "JPN", 3);
+  if (reader.read(row))
+    return -1;
+
+  NdbTransaction *myTransaction =
+    myNdb->startTransaction(myTable, row.Code, sizeof(row.Code));
+  if (myTransaction == NULL) {
+    print_error(myNdb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+  if (myTransaction->updateTuple(pkRecord, (char*) &row,
+                                 nameRecord, (char*) &row) == NULL ||
+      myTransaction->execute( NdbTransaction::Commit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Update failed.");
+    myNdb->closeTransaction(myTransaction);
+    return -1;
+  }
+  myNdb->closeTransaction(myTransaction);
+  reader.note_write(row.Code);
+
+  CountryRow again, other;
+  std::memcpy(again.Code, "JPN", 3);
+  std::memcpy(other.Code, "USA", 3);
+  if (reader.read(again))
+    return -1;
+  std::cout << "JPN after write: " << char_to_str(again.Name, 52)
+            << " (node " << reader.lastNode << ")" << std::endl;
+  if (reader.read(other))
+    return -1;
+  std::cout << "Replica reads: " << reader.replicaReads
+            << ", locked reads: " << reader.lockedReads << std::endl;
+  return 0;
+}
+
+NearestReplicaExample::~NearestReplicaExample()
+{
+  // Step 9. Cleanup
+  if (myNdb) delete myNdb;
+  if (cluster_connection) delete cluster_connection;
+  ndb_end(0);
+}
+
+int main(int argc, char *argv[])
+{
+  int reads = argc > 1 ? std::atoi(argv[1]) : 2000;
+  const char *neighbour = argc > 2 ? argv[2] : "auto";
+  if (reads <= 0) {
+    std::cerr << "Usage: " << argv[0]
+              << " [reads] [auto|none|<node id>]" << std::endl;
+    return 1;
+  }
+
+  NearestReplicaExample ex;
+  return ex.doTest(reads, neighbour);
+}
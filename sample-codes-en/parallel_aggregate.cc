@@ -0,0 +1,389 @@
+// Partition-parallel GROUP BY aggregation over City.
+//
+// Computes SUM/COUNT/MIN/MAX of Population per CountryCode without
+// shipping whole CityRow's to a single nextResult() loop. Each worker
+// thread has its own Ndb object and scans a subset of the table's
+// partitions (SO_PARTITION_ID), reading only the two columns involved.
+// Rows are folded into a thread-local open-addressing hash table keyed by
+// the three-byte country code, and the partial tables are merged once all
+// scans have finished.
+//
+// The benchmark repeats the aggregation for 1, 2, 4, ... threads. Use
+// scale_city.sql to create a larger CityScaled table to run it against.
+//
+// Usage: parallel_aggregate [table] [max_threads] [SUM|COUNT|MIN|MAX]
+#include <NdbApi.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <stddef.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+const char *connectstring = "127.0.0.1:1186";
+const char *db = "world";
+
+typedef std::chrono::steady_clock Clock;
+
+// Aggregates of one group
+struct GroupAgg {
+  Uint32 key;     // packed CountryCode, 0 = empty slot
+  Int64  sum;
+  Uint64 count;
+  Int32  min;
+  Int32  max;
+};
+
+// Open-addressing hash table with linear probing. Country codes are three
+// bytes, so the packed code itself is the key and never collides with the
+// empty marker 0.
+class GroupTable {
+public:
+  GroupTable() : used(0) { slots.resize(256); clear_slots(slots); };
+
+  static Uint32 pack(const char *code)
+  {
+    return ((Uint32)(unsigned char) code[0] << 16) |
+           ((Uint32)(unsigned char) code[1] << 8) |
+           (Uint32)(unsigned char) code[2];
+  }
+
+  void add(Uint32 key, Int32 value)
+  {
+    GroupAgg &g = find(key);
+    g.sum += value;
+    g.count++;
+    if (value < g.min) g.min = value;
+    if (value > g.max) g.max = value;
+  }
+
+  void merge(const GroupTable &other)
+  {
+    for (size_t i = 0; i < other.slots.size(); i++) {
+      const GroupAgg &o = other.slots[i];
+      if (o.key == 0)
+        continue;
+      GroupAgg &g = find(o.key);
+      g.sum += o.sum;
+      g.count += o.count;
+      if (o.min < g.min) g.min = o.min;
+      if (o.max > g.max) g.max = o.max;
+    }
+  }
+
+  // Groups in CountryCode order
+  std::vector<GroupAgg> sorted() const
+  {
+    std::vector<GroupAgg> out;
+    for (size_t i = 0; i < slots.size(); i++)
+      if (slots[i].key != 0)
+        out.push_back(slots[i]);
+    std::sort(out.begin(), out.end(),
+              [](const GroupAgg &a, const GroupAgg &b) {
+                return a.key < b.key;
+              });
+    return out;
+  }
+
+  size_t size() const { return used; }
+
+private:
+  static size_t hash(Uint32 key) { return key * 2654435761u; }
+
+  static void clear_slots(std::vector<GroupAgg> &v)
+  {
+    for (size_t i = 0; i < v.size(); i++) {
+      v[i].key = 0;
+      v[i].sum = 0;
+      v[i].count = 0;
+      v[i].min = INT32_MAX;
+      v[i].max = INT32_MIN;
+    }
+  }
+
+  GroupAgg &find(Uint32 key)
+  {
+    size_t mask = slots.size() - 1;
+    size_t i = hash(key) & mask;
+    while (slots[i].key != key) {
+      if (slots[i].key == 0) {
+        if ((used + 1) * 2 > slots.size()) {
+          grow();
+          return find(key);
+        }
+        slots[i].key = key;
+        used++;
+        break;
+      }
+      i = (i + 1) & mask;
+    }
+    return slots[i];
+  }
+
+  void grow()
+  {
+    std::vector<GroupAgg> old;
+    old.swap(slots);
+    slots.resize(old.size() * 2);
+    clear_slots(slots);
+    used = 0;
+    for (size_t i = 0; i < old.size(); i++) {
+      if (old[i].key == 0)
+        continue;
+      GroupAgg &g = find(old[i].key);
+      g = old[i];
+    }
+  }
+
+  std::vector<GroupAgg> slots;
+  size_t used;
+};
+
+class ParallelAggregate {
+public:
+  ParallelAggregate() : cluster_connection(NULL), myTable(NULL),
+                        aggRecord(NULL), partitions(0) {};
+  ~ParallelAggregate();
+  int doTest(const char *table_name, int max_threads, const char *agg);
+
+private:
+  // Narrow projection: only the grouping key and the aggregated column
+  struct AggRow {
+    char  CountryCode[3];
+    Int32 Population;
+  };
+
+  struct WorkerResult {
+    GroupTable groups;
+    Uint64 rows;
+    int error;
+  };
+
+  int run_aggregation(int nthreads, GroupTable &result, Uint64 &rows);
+  void worker(int thread_no, int nthreads, WorkerResult *res);
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *cluster_connection;
+  const NdbDictionary::Table *myTable;
+  const NdbRecord *aggRecord;
+  Uint32 partitions;
+};
+
+int ParallelAggregate::doTest(const char *table_name, int max_threads,
+                              const char *agg)
+{
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  // Step 2. Connecting to the cluster
+  cluster_connection = new Ndb_cluster_connection(connectstring);
+  if (cluster_connection->connect(4 /* retries               */,
+                                  5 /* delay between retries */,
+                                  1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (cluster_connection->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+
+  // Step 3. Get table metadata
+  Ndb metaNdb(cluster_connection, db);
+  if (metaNdb.init()) {
+    print_error(metaNdb.getNdbError(),
+                "Could not connect to the database object.");
+    return 3;
+  }
+
+  NdbDictionary::Dictionary *myDict = metaNdb.getDictionary();
+  myTable = myDict->getTable(table_name);
+  if (myTable == NULL) {
+    print_error(myDict->getNdbError(), "Could not retrieve a table.");
+    return 4;
+  }
+  partitions = myTable->getPartitionCount();
+
+  // Step 4. Define the narrow NdbRecord
+  NdbDictionary::RecordSpecification recordSpec[2];
+  std::memset(recordSpec, 0, sizeof recordSpec);
+
+  recordSpec[0].column = myTable->getColumn("CountryCode");
+  recordSpec[0].offset = offsetof(struct AggRow, CountryCode);
+  recordSpec[1].column = myTable->getColumn("Population");
+  recordSpec[1].offset = offsetof(struct AggRow, Population);
+
+  aggRecord = myDict->createRecord(myTable, recordSpec, 2,
+                                   sizeof(recordSpec[0]));
+  if (aggRecord == NULL) {
+    print_error(myDict->getNdbError(), "Failed to initialize NdbRecords'.");
+    return 5;
+  }
+
+  // Step 5. Benchmark across thread counts. More threads than partitions
+  // would only leave threads idle.
+  std::cout << "Table " << table_name << ", " << partitions
+            << " partitions" << std::endl;
+  std::cout << "threads       rows   groups    time_ms       rows/s"
+            << std::endl;
+
+  GroupTable result;
+  int nthreads = 1;
+  for (;;) {
+    GroupTable groups;
+    Uint64 rows = 0;
+    Clock::time_point start = Clock::now();
+    int err = run_aggregation(nthreads, groups, rows);
+    if (err)
+      return err;
+    double ms = std::chrono::duration<double, std::milli>(
+                  Clock::now() - start).count();
+
+    std::cout << std::setw(7) << nthreads
+              << std::setw(11) << rows
+              << std::setw(9) << groups.size()
+              << std::fixed << std::setprecision(1)
+              << std::setw(11) << ms
+              << std::setprecision(0)
+              << std::setw(13) << (ms > 0 ? rows * 1000.0 / ms : 0.0)
+              << std::endl;
+    result = groups;
+
+    if (nthreads >= max_threads || (Uint32) nthreads >= partitions)
+      break;
+    nthreads = std::min(nthreads * 2, max_threads);
+  }
+
+  // Step 6. Print the result of the last run
+  std::vector<GroupAgg> out = result.sorted();
+  for (size_t i = 0; i < out.size(); i++) {
+    const GroupAgg &g = out[i];
+    char code[4] = { (char)(g.key >> 16), (char)(g.key >> 8), (char) g.key, 0 };
+    std::cout << code << ": ";
+    if (std::strcmp(agg, "COUNT") == 0)
+      std::cout << g.count;
+    else if (std::strcmp(agg, "MIN") == 0)
+      std::cout << g.min;
+    else if (std::strcmp(agg, "MAX") == 0)
+      std::cout << g.max;
+    else
+      std::cout << g.sum;
+    std::cout << std::endl;
+  }
+  return 0;
+}
+
+int ParallelAggregate::run_aggregation(int nthreads, GroupTable &result,
+                                       Uint64 &rows)
+{
+  std::vector<WorkerResult> results(nthreads);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < nthreads; i++)
+    workers.push_back(std::thread(&ParallelAggregate::worker, this,
+                                  i, nthreads, &results[i]));
+  for (int i = 0; i < nthreads; i++)
+    workers[i].join();
+
+  // Merge the partial tables
+  for (int i = 0; i < nthreads; i++) {
+    if (results[i].error)
+      return results[i].error;
+    result.merge(results[i].groups);
+    rows += results[i].rows;
+  }
+  return 0;
+}
+
+void ParallelAggregate::worker(int thread_no, int nthreads, WorkerResult *res)
+{
+  res->rows = 0;
+  res->error = 0;
+
+  Ndb ndb(cluster_connection, db);
+  if (ndb.init()) {
+    print_error(ndb.getNdbError(),
+                "Could not connect to the database object.");
+    res->error = 6;
+    return;
+  }
+
+  // Partitions thread_no, thread_no + nthreads, ... belong to this thread
+  for (Uint32 part = thread_no; part < partitions; part += nthreads) {
+    // Start the transaction on the node holding the partition
+    NdbTransaction *myTransaction = ndb.startTransaction(myTable, part);
+    if (myTransaction == NULL) {
+      print_error(ndb.getNdbError(), "Could not start transaction.");
+      res->error = 7;
+      return;
+    }
+
+    NdbScanOperation::ScanOptions options;
+    options.optionsPresent =
+      NdbScanOperation::ScanOptions::SO_SCANFLAGS |
+      NdbScanOperation::ScanOptions::SO_PARTITION_ID;
+    options.scan_flags = NdbScanOperation::SF_TupScan;
+    options.partitionId = part;
+
+    NdbScanOperation *sop =
+      myTransaction->scanTable(aggRecord,
+                               NdbOperation::LM_CommittedRead,
+                               NULL,
+                               &options,
+                               sizeof(NdbScanOperation::ScanOptions));
+    if (sop == NULL ||
+        myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+      print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+      ndb.closeTransaction(myTransaction);
+      res->error = 8;
+      return;
+    }
+
+    int check;
+    AggRow *row;
+    while ((check = sop->nextResult((const char**) &row, true, false)) == 0) {
+      res->groups.add(GroupTable::pack(row->CountryCode), row->Population);
+      res->rows++;
+    }
+
+    if (check == -1) {
+      print_error(myTransaction->getNdbError(), "Error during scan.");
+      ndb.closeTransaction(myTransaction);
+      res->error = 9;
+      return;
+    }
+    ndb.closeTransaction(myTransaction);
+  }
+}
+
+ParallelAggregate::~ParallelAggregate()
+{
+  // Step 7. Cleanup
+  if (cluster_connection) delete cluster_connection;
+  ndb_end(0);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *table_name = argc > 1 ? argv[1] : "City";
+  int max_threads = argc > 2 ? std::atoi(argv[2]) : 8;
+  const char *agg = argc > 3 ? argv[3] : "SUM";
+  if (max_threads <= 0) {
+    std::cerr << "Usage: " << argv[0]
+              << " [table] [max_threads] [SUM|COUNT|MIN|MAX]" << std::endl;
+    return 1;
+  }
+
+  ParallelAggregate ex;
+  return ex.doTest(table_name, max_threads, agg);
+}
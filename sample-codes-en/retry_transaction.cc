@@ -0,0 +1,291 @@
+// Transaction runner with retry of temporary errors.
+//
+// The other samples treat any failed execute() as final. Under load many
+// failures are temporary (lock wait timeouts, node overload, send buffers
+// exhausted, node restarts) and NdbError::status tells us so. The
+// TransactionRunner below takes a callable that defines the operations of
+// one transaction, runs it, and retries temporary failures with jittered
+// exponential backoff until a time budget is used up. Retries are counted
+// per error code.
+//
+// The demo starts a few threads that all lock and rewrite the same City
+// row, so some of them run into lock wait timeouts (error 266) and are
+// retried instead of failing.
+//
+// Usage: retry_transaction [threads] [transactions_per_thread]
+#include <NdbApi.hpp>
+#include <iostream>
+#include <string>
+#include <map>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <stddef.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+const char *connectstring = "127.0.0.1:1186";
+const char *db = "world";
+
+typedef std::chrono::steady_clock Clock;
+
+class TransactionRunner {
+public:
+  // Defines (and may partially execute with NoCommit) the operations of
+  // one transaction attempt. Returns 0 on success, -1 if an NDB call
+  // failed; the error is then taken from the transaction.
+  typedef std::function<int (NdbTransaction*)> Body;
+
+  enum Outcome { Ok = 0, Failed, GaveUp };
+
+  TransactionRunner() : base_delay_us(1000), max_delay_us(200000),
+                        budget_ms(5000), rng(std::random_device()()) {};
+
+  void set_backoff(Uint32 base_us, Uint32 max_us)
+  {
+    base_delay_us = base_us;
+    max_delay_us = max_us;
+  }
+  void set_budget(Uint32 ms) { budget_ms = ms; }
+
+  // Run the body in a new transaction and commit it. `idempotent` allows a
+  // retry after NdbError::UnknownResult, i.e. when the commit may or may
+  // not have happened.
+  Outcome run(Ndb *ndb, const Body &body, bool idempotent = false,
+              const NdbDictionary::Table *hintTable = NULL,
+              const char *hintKey = NULL, Uint32 hintKeyLen = 0)
+  {
+    Clock::time_point deadline =
+      Clock::now() + std::chrono::milliseconds(budget_ms);
+
+    for (Uint32 attempt = 0; ; attempt++) {
+      NdbError error;
+      NdbTransaction *trans =
+        ndb->startTransaction(hintTable, hintKey, hintKeyLen);
+      if (trans == NULL) {
+        error = ndb->getNdbError();
+      } else {
+        if (body(trans) == 0 &&
+            trans->execute(NdbTransaction::Commit) == 0) {
+          ndb->closeTransaction(trans);
+          count(0);
+          return Ok;
+        }
+        error = trans->getNdbError();
+        ndb->closeTransaction(trans);
+      }
+
+      bool retryable =
+        error.status == NdbError::TemporaryError ||
+        (idempotent && error.status == NdbError::UnknownResult);
+      if (!retryable) {
+        print_error(error, "Transaction failed");
+        count(-1);
+        return Failed;
+      }
+
+      // Full jitter: sleep a random time up to the exponential bound
+      Uint64 bound = (Uint64) base_delay_us << std::min<Uint32>(attempt, 20);
+      if (bound > max_delay_us) bound = max_delay_us;
+      Uint64 delay_us = uniform(bound);
+      if (Clock::now() + std::chrono::microseconds(delay_us) > deadline) {
+        print_error(error, "Retry budget exhausted");
+        count(-2);
+        return GaveUp;
+      }
+      count(error.code);
+      std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+    }
+  }
+
+  void print_stats()
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    std::cout << "Committed: " << counts[0]
+              << ", failed: " << counts[-1]
+              << ", gave up: " << counts[-2] << std::endl;
+    for (std::map<int, Uint64>::const_iterator it = counts.begin();
+         it != counts.end(); ++it) {
+      if (it->first > 0)
+        std::cout << "  retries after error " << it->first
+                  << ": " << it->second << std::endl;
+    }
+  }
+
+private:
+  // 0 = committed, -1 = failed, -2 = gave up, >0 = retry after that code
+  void count(int code)
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    counts[code]++;
+  }
+
+  Uint64 uniform(Uint64 bound)
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    return std::uniform_int_distribution<Uint64>(0, bound)(rng);
+  }
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Uint32 base_delay_us, max_delay_us, budget_ms;
+  std::mt19937_64 rng;
+  std::mutex mutex;
+  std::map<int, Uint64> counts;
+};
+
+class RetryExample {
+public:
+  RetryExample() : cluster_connection(NULL), myTable(NULL),
+                   valsRecord(NULL), pkRecord(NULL) {};
+  ~RetryExample();
+  int doTest(int nthreads, int ntrans);
+
+private:
+  struct CityRow {
+    Int32 ID;
+    char  Name[35];
+    char  CountryCode[3];
+    char  District[20];
+    Int32 Population;
+  };
+
+  void worker(int ntrans);
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *cluster_connection;
+  const NdbDictionary::Table *myTable;
+  const NdbRecord *valsRecord, *pkRecord;
+  TransactionRunner runner;
+};
+
+int RetryExample::doTest(int nthreads, int ntrans)
+{
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  // Step 2. Connecting to the cluster
+  cluster_connection = new Ndb_cluster_connection(connectstring);
+  if (cluster_connection->connect(4 /* retries               */,
+                                  5 /* delay between retries */,
+                                  1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (cluster_connection->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+
+  // Step 3. Get table metadata and define NdbRecord's. The Ndb object
+  // used here is only for the dictionary; each worker has its own.
+  Ndb metaNdb(cluster_connection, db);
+  if (metaNdb.init()) {
+    print_error(metaNdb.getNdbError(),
+                "Could not connect to the database object.");
+    return 3;
+  }
+
+  NdbDictionary::Dictionary *myDict = metaNdb.getDictionary();
+  myTable = myDict->getTable("City");
+  if (myTable == NULL) {
+    print_error(myDict->getNdbError(), "Could not retrieve a table.");
+    return 4;
+  }
+
+  NdbDictionary::RecordSpecification recordSpec[5];
+  std::memset(recordSpec, 0, sizeof recordSpec);
+  int rsSize = sizeof(recordSpec[0]);
+
+  recordSpec[0].column = myTable->getColumn("ID");
+  recordSpec[0].offset = offsetof(struct CityRow, ID);
+  recordSpec[1].column = myTable->getColumn("Name");
+  recordSpec[1].offset = offsetof(struct CityRow, Name);
+  recordSpec[2].column = myTable->getColumn("CountryCode");
+  recordSpec[2].offset = offsetof(struct CityRow, CountryCode);
+  recordSpec[3].column = myTable->getColumn("District");
+  recordSpec[3].offset = offsetof(struct CityRow, District);
+  recordSpec[4].column = myTable->getColumn("Population");
+  recordSpec[4].offset = offsetof(struct CityRow, Population);
+
+  pkRecord = myDict->createRecord(myTable, recordSpec, 1, rsSize);
+  valsRecord = myDict->createRecord(myTable, recordSpec, 5, rsSize);
+  if (pkRecord == NULL || valsRecord == NULL) {
+    print_error(myDict->getNdbError(), "Failed to initialize NdbRecords'.");
+    return 5;
+  }
+
+  // Step 4. Run the contending workers
+  std::vector<std::thread> workers;
+  for (int i = 0; i < nthreads; i++)
+    workers.push_back(std::thread(&RetryExample::worker, this, ntrans));
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+
+  runner.print_stats();
+  return 0;
+}
+
+void RetryExample::worker(int ntrans)
+{
+  Ndb ndb(cluster_connection, db);
+  if (ndb.init()) {
+    print_error(ndb.getNdbError(),
+                "Could not connect to the database object.");
+    return;
+  }
+
+  for (int i = 0; i < ntrans; i++) {
+    CityRow row;
+    std::memset(&row, 0, sizeof row);
+    row.ID = 1;
+
+    // Lock the row, then write it back unchanged. Everything that touches
+    // NDB goes into the body so that a retry starts from scratch.
+    TransactionRunner::Body body = [&](NdbTransaction *trans) -> int {
+      if (trans->readTuple(pkRecord, (char*) &row,
+                           valsRecord, (char*) &row,
+                           NdbOperation::LM_Exclusive) == NULL ||
+          trans->execute(NdbTransaction::NoCommit) == -1)
+        return -1;
+      if (trans->updateTuple(pkRecord, (char*) &row,
+                             valsRecord, (char*) &row) == NULL)
+        return -1;
+      return 0;
+    };
+
+    runner.run(&ndb, body, true /* idempotent */,
+               myTable, (const char*) &row.ID, sizeof(row.ID));
+  }
+}
+
+RetryExample::~RetryExample()
+{
+  // Step 5. Cleanup
+  if (cluster_connection) delete cluster_connection;
+  ndb_end(0);
+}
+
+int main(int argc, char *argv[])
+{
+  int nthreads = argc > 1 ? std::atoi(argv[1]) : 4;
+  int ntrans = argc > 2 ? std::atoi(argv[2]) : 1000;
+
+  RetryExample ex;
+  return ex.doTest(nthreads, ntrans);
+}
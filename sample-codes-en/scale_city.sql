@@ -0,0 +1,21 @@
+-- Creates CityScaled, a copy of world.City multiplied `factor` times, for
+-- benchmarking scans on more rows than the 4079 of the original table.
+-- Copy n of a city gets ID + n * 10000; all other columns are unchanged,
+-- so per-CountryCode aggregates are exactly `factor` times the original.
+DROP PROCEDURE IF EXISTS scale_city;
+delimiter //
+CREATE PROCEDURE scale_city(factor INT)
+  BEGIN
+    DECLARE n INT DEFAULT 0;
+
+    DROP TABLE IF EXISTS CityScaled;
+    CREATE TABLE CityScaled LIKE City;
+
+    WHILE n < factor DO
+      INSERT INTO CityScaled
+        SELECT ID + n * 10000, Name, CountryCode, District, Population
+          FROM City;
+      SET n = n + 1;
+    END WHILE;
+END;//
+delimiter ;
@@ -0,0 +1,365 @@
+// Continuous data node thread load sampler.
+//
+// This is the NDB API counterpart of the sigcount procedure in
+// signal_balancing.sql. Instead of copying ndbinfo.threadstat into a
+// temporary table through a MySQL server, the counters are read directly
+// from the data nodes with the NdbInfo scan interface (the same interface
+// used by the ndbinfo_select_all tool), at a fixed interval and for as long
+// as the sampler runs.
+//
+// NdbInfo is not part of the installed NdbApi.hpp; build against the MySQL
+// Cluster source tree, e.g.
+//   g++ -I<src>/storage/ndb/src/ndbapi ... thread_load_sampler.cc
+//
+// Usage: thread_load_sampler [interval_sec] [samples] [csv_file]
+//   interval_sec  seconds between two snapshots (default 10)
+//   samples       number of intervals to report, 0 = until Ctrl-C (default 0)
+//   csv_file      time series output (default: stdout only)
+#include <NdbApi.hpp>
+#include <NdbInfo.hpp>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <map>
+#include <vector>
+#include <utility>
+#include <cstdlib>
+#include <csignal>
+#include <ctime>
+#include <unistd.h>
+
+const char *connectstring = "127.0.0.1:1186";
+
+// A thread doing more than this share of the work of its thread type on the
+// same node (compared to an even split) is reported as imbalanced.
+const double imbalance_ratio = 1.5;
+// A thread spending this share of the interval on CPU is reported as
+// saturated.
+const double saturation_cpu_pct = 90.0;
+// A thread that executes many signals per loop and hardly ever waits is
+// also saturated, even if the OS accounting says otherwise.
+const double saturation_signals_per_loop = 100.0;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int)
+{
+  stop_requested = 1;
+}
+
+class ThreadLoadSampler {
+public:
+  ThreadLoadSampler() : cluster_connection(NULL), myInfo(NULL),
+                        myTable(NULL), interval(10), samples(0) {};
+  ~ThreadLoadSampler();
+  int doTest(int interval_sec, int nsamples, const char *csv_file);
+
+private:
+  // One row of ndbinfo.threadstat; only the columns used by sigcount and
+  // the OS rusage counters are kept.
+  struct ThreadStat {
+    Uint32 node_id;
+    Uint32 thr_no;
+    std::string thr_nm;
+    Uint64 os_now;          // milliseconds
+    Uint64 c_loop;
+    Uint64 c_exec;
+    Uint64 c_wait;
+    Uint64 os_ru_utime;     // microseconds
+    Uint64 os_ru_stime;     // microseconds
+  };
+
+  // Difference between two snapshots of the same thread; the first six
+  // fields are the columns returned by sigcount.
+  struct ThreadLoad {
+    Uint32 node_id;
+    Uint32 thr_no;
+    std::string thr_nm;
+    Uint64 time_ms;
+    Uint64 loops;
+    Uint64 execs;
+    Uint64 waits;
+    double signals_per_loop;
+    double cpu_pct;
+    bool imbalanced;
+    bool saturated;
+  };
+
+  typedef std::pair<Uint32, Uint32> ThreadKey;  // (node_id, thr_no)
+  typedef std::map<ThreadKey, ThreadStat> Snapshot;
+
+  int take_snapshot(Snapshot &snap);
+  void compute_load(const Snapshot &s1, const Snapshot &s2,
+                    std::vector<ThreadLoad> &load);
+  void flag_threads(std::vector<ThreadLoad> &load);
+  void report(time_t now, const std::vector<ThreadLoad> &load);
+
+  void print_error(int code, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << code << ")." << std::endl;
+  }
+
+  Ndb_cluster_connection *cluster_connection;
+  NdbInfo *myInfo;
+  const NdbInfo::Table *myTable;
+  std::ofstream csv;
+  int interval;
+  int samples;
+};
+
+int ThreadLoadSampler::doTest(int interval_sec, int nsamples,
+                              const char *csv_file)
+{
+  interval = interval_sec;
+  samples = nsamples;
+
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  // Step 2. Connecting to the cluster
+  cluster_connection = new Ndb_cluster_connection(connectstring);
+  if (cluster_connection->connect(4 /* retries               */,
+                                  5 /* delay between retries */,
+                                  1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (cluster_connection->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+
+  // Step 3. Initialize ndbinfo access. The empty prefix makes the base
+  // tables available under their plain names.
+  myInfo = new NdbInfo(cluster_connection, "");
+  if (!myInfo->init()) {
+    std::cerr << "Could not initialize ndbinfo." << std::endl;
+    return 3;
+  }
+
+  int res = myInfo->openTable("threadstat", &myTable);
+  if (res != 0) {
+    print_error(res, "Could not open threadstat");
+    return 4;
+  }
+
+  // Step 4. Open the time series output
+  if (csv_file != NULL) {
+    csv.open(csv_file, std::ios::out | std::ios::trunc);
+    if (!csv) {
+      std::cerr << "Could not open " << csv_file << "." << std::endl;
+      return 5;
+    }
+    csv << "timestamp,node_id,thr_no,thr_nm,time_ms,loops,execs,waits,"
+        << "signals_per_loop,cpu_pct,imbalanced,saturated" << std::endl;
+  }
+
+  // Step 5. Sample in a loop. Each snapshot is the starting point of the
+  // next interval, so no time is lost between intervals.
+  Snapshot prev, curr;
+  if ((res = take_snapshot(prev)) != 0)
+    return res;
+
+  for (int n = 0; !stop_requested && (samples == 0 || n < samples); n++) {
+    sleep(interval);
+    if (stop_requested)
+      break;
+
+    curr.clear();
+    if ((res = take_snapshot(curr)) != 0)
+      return res;
+
+    std::vector<ThreadLoad> load;
+    compute_load(prev, curr, load);
+    flag_threads(load);
+    report(time(NULL), load);
+
+    prev.swap(curr);
+  }
+  return 0;
+}
+
+int ThreadLoadSampler::take_snapshot(Snapshot &snap)
+{
+  NdbInfoScanOperation *scanOp = NULL;
+  int res = myInfo->createScanOperation(myTable, &scanOp);
+  if (res != 0) {
+    print_error(res, "Could not create a scan operation");
+    return 6;
+  }
+
+  if ((res = scanOp->readTuples()) != 0) {
+    print_error(res, "Could not prepare a scan");
+    myInfo->releaseScanOperation(scanOp);
+    return 7;
+  }
+
+  const NdbInfoRecAttr *node_id = scanOp->getValue("node_id");
+  const NdbInfoRecAttr *thr_no = scanOp->getValue("thr_no");
+  const NdbInfoRecAttr *thr_nm = scanOp->getValue("thr_nm");
+  const NdbInfoRecAttr *os_now = scanOp->getValue("os_now");
+  const NdbInfoRecAttr *c_loop = scanOp->getValue("c_loop");
+  const NdbInfoRecAttr *c_exec = scanOp->getValue("c_exec");
+  const NdbInfoRecAttr *c_wait = scanOp->getValue("c_wait");
+  const NdbInfoRecAttr *os_ru_utime = scanOp->getValue("os_ru_utime");
+  const NdbInfoRecAttr *os_ru_stime = scanOp->getValue("os_ru_stime");
+  if (node_id == NULL || thr_no == NULL || thr_nm == NULL ||
+      os_now == NULL || c_loop == NULL || c_exec == NULL ||
+      c_wait == NULL || os_ru_utime == NULL || os_ru_stime == NULL) {
+    std::cerr << "Could not get threadstat columns." << std::endl;
+    myInfo->releaseScanOperation(scanOp);
+    return 8;
+  }
+
+  if ((res = scanOp->execute()) != 0) {
+    print_error(res, "Failed to execute a scan");
+    myInfo->releaseScanOperation(scanOp);
+    return 9;
+  }
+
+  while ((res = scanOp->nextResult()) == 1) {
+    ThreadStat st;
+    st.node_id = node_id->u_32_value();
+    st.thr_no = thr_no->u_32_value();
+    st.thr_nm = thr_nm->c_str();
+    st.os_now = os_now->u_64_value();
+    st.c_loop = c_loop->u_64_value();
+    st.c_exec = c_exec->u_64_value();
+    st.c_wait = c_wait->u_64_value();
+    st.os_ru_utime = os_ru_utime->u_64_value();
+    st.os_ru_stime = os_ru_stime->u_64_value();
+    snap[ThreadKey(st.node_id, st.thr_no)] = st;
+  }
+  myInfo->releaseScanOperation(scanOp);
+
+  if (res != 0) {
+    print_error(res, "Error during scan");
+    return 10;
+  }
+  return 0;
+}
+
+void ThreadLoadSampler::compute_load(const Snapshot &s1, const Snapshot &s2,
+                                     std::vector<ThreadLoad> &load)
+{
+  // Same as the INNER JOIN ... USING (node_id, thr_no) in sigcount. Threads
+  // whose counters went backwards belong to a restarted node and are
+  // skipped for this interval.
+  for (Snapshot::const_iterator it2 = s2.begin(); it2 != s2.end(); ++it2) {
+    Snapshot::const_iterator it1 = s1.find(it2->first);
+    if (it1 == s1.end())
+      continue;
+    const ThreadStat &a = it1->second;
+    const ThreadStat &b = it2->second;
+    if (b.os_now <= a.os_now || b.c_loop < a.c_loop ||
+        b.c_exec < a.c_exec || b.c_wait < a.c_wait)
+      continue;
+
+    ThreadLoad l;
+    l.node_id = b.node_id;
+    l.thr_no = b.thr_no;
+    l.thr_nm = b.thr_nm;
+    l.time_ms = b.os_now - a.os_now;
+    l.loops = b.c_loop - a.c_loop;
+    l.execs = b.c_exec - a.c_exec;
+    l.waits = b.c_wait - a.c_wait;
+    l.signals_per_loop = l.loops ? (double) l.execs / l.loops : 0.0;
+    Uint64 cpu_us = (b.os_ru_utime + b.os_ru_stime) -
+                    (a.os_ru_utime + a.os_ru_stime);
+    l.cpu_pct = 100.0 * cpu_us / (l.time_ms * 1000.0);
+    l.imbalanced = false;
+    l.saturated = false;
+    load.push_back(l);
+  }
+}
+
+void ThreadLoadSampler::flag_threads(std::vector<ThreadLoad> &load)
+{
+  // Threads of the same type on the same node (e.g. all ldm threads of
+  // node 1) should share the work evenly.
+  typedef std::pair<Uint32, std::string> GroupKey;
+  std::map<GroupKey, std::pair<Uint64, int> > groups;
+  for (size_t i = 0; i < load.size(); i++) {
+    std::pair<Uint64, int> &g = groups[GroupKey(load[i].node_id,
+                                                load[i].thr_nm)];
+    g.first += load[i].execs;
+    g.second++;
+  }
+
+  for (size_t i = 0; i < load.size(); i++) {
+    ThreadLoad &l = load[i];
+    const std::pair<Uint64, int> &g = groups[GroupKey(l.node_id, l.thr_nm)];
+    if (g.second > 1 && g.first > 0) {
+      double mean = (double) g.first / g.second;
+      l.imbalanced = l.execs > mean * imbalance_ratio;
+    }
+    l.saturated = l.cpu_pct >= saturation_cpu_pct ||
+                  (l.signals_per_loop >= saturation_signals_per_loop &&
+                   l.waits == 0);
+  }
+}
+
+void ThreadLoadSampler::report(time_t now, const std::vector<ThreadLoad> &load)
+{
+  char ts[32];
+  strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", localtime(&now));
+
+  std::cout << "========== " << ts << " ==========" << std::endl;
+  std::cout << "node thr thr_nm     time_ms      loops      execs"
+            << "      waits  sig/loop   cpu%" << std::endl;
+  for (size_t i = 0; i < load.size(); i++) {
+    const ThreadLoad &l = load[i];
+    std::cout << std::setw(4) << l.node_id
+              << std::setw(4) << l.thr_no << " "
+              << std::left << std::setw(8) << l.thr_nm << std::right
+              << std::setw(10) << l.time_ms
+              << std::setw(11) << l.loops
+              << std::setw(11) << l.execs
+              << std::setw(11) << l.waits
+              << std::fixed << std::setprecision(2)
+              << std::setw(10) << l.signals_per_loop
+              << std::setw(7) << std::setprecision(1) << l.cpu_pct
+              << (l.imbalanced ? "  IMBALANCED" : "")
+              << (l.saturated ? "  SATURATED" : "")
+              << std::endl;
+
+    if (csv.is_open()) {
+      csv << ts << ',' << l.node_id << ',' << l.thr_no << ','
+          << l.thr_nm << ',' << l.time_ms << ',' << l.loops << ','
+          << l.execs << ',' << l.waits << ','
+          << std::fixed << std::setprecision(2) << l.signals_per_loop << ','
+          << std::setprecision(1) << l.cpu_pct << ','
+          << l.imbalanced << ',' << l.saturated << std::endl;
+    }
+  }
+}
+
+ThreadLoadSampler::~ThreadLoadSampler()
+{
+  // Step 6. Cleanup
+  if (csv.is_open()) csv.close();
+  if (myTable) myInfo->closeTable(myTable);
+  if (myInfo) delete myInfo;
+  if (cluster_connection) delete cluster_connection;
+  ndb_end(0);
+}
+
+int main(int argc, char *argv[])
+{
+  int interval_sec = argc > 1 ? atoi(argv[1]) : 10;
+  int nsamples = argc > 2 ? atoi(argv[2]) : 0;
+  const char *csv_file = argc > 3 ? argv[3] : NULL;
+  if (interval_sec <= 0) {
+    std::cerr << "Usage: " << argv[0]
+              << " [interval_sec] [samples] [csv_file]" << std::endl;
+    return 1;
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  ThreadLoadSampler sampler;
+  return sampler.doTest(interval_sec, nsamples, csv_file);
+}
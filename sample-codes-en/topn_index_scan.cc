@@ -0,0 +1,369 @@
+// Top-N ordered index scan with early termination.
+//
+// "The 10 most populous cities of country X" with the scan from
+// NdbApiExample3::do_index_scan_read() reads the whole index range and
+// leaves it to the caller to stop after 10 rows. Here the query is run as
+// one ordered scan per partition of City, each sized so that its first
+// batch already holds N rows. The client merges the partition streams with
+// a binary heap, fetches more from a partition only when its head has been
+// consumed, and closes all scans as soon as N rows have been returned.
+//
+// The same query is also run the old way (one ordered scan, default
+// batch, read to the end) and the rows received from the data nodes
+// (Ndb::ReadRowCount) are reported for both.
+//
+// Usage: topn_index_scan [N] [CountryCode]
+#include <NdbApi.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <chrono>
+#include <stddef.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+const char *connectstring = "127.0.0.1:1186";
+const char *db = "world";
+
+typedef std::chrono::steady_clock Clock;
+
+class TopNIndexScan {
+public:
+  TopNIndexScan() : cluster_connection(NULL), myNdb(NULL),
+                    myDict(NULL), myTable(NULL) {};
+  ~TopNIndexScan();
+  int doTest(Uint32 limit, const char *country);
+
+private:
+  struct CityRow {
+    Int32 ID;
+    char  Name[35];
+    char  CountryCode[3];
+    char  District[20];
+    Int32 Population;
+  };
+
+  // One partition's ordered stream; `current` is its head row
+  struct Stream {
+    NdbIndexScanOperation *op;
+    const CityRow *current;
+  };
+
+  // Orders streams so that the heap top has the largest Population
+  struct StreamLess {
+    const std::vector<Stream> *streams;
+    bool operator()(size_t a, size_t b) const
+    {
+      return (*streams)[a].current->Population <
+             (*streams)[b].current->Population;
+    }
+  };
+
+  int top_n_merge(Uint32 limit, const char *country,
+                  std::vector<CityRow> &out);
+  int full_range(Uint32 limit, const char *country,
+                 std::vector<CityRow> &out);
+  int define_filter(NdbInterpretedCode &code, const char *country);
+  void report(const char *label, const std::vector<CityRow> &rows,
+              Uint64 fetched, Uint64 batches, double ms);
+
+  std::string char_to_str(const char *s, int max_len)
+  {
+    std::string str(s, max_len);
+    return str.substr(0, str.find_last_not_of(" ") + 1);
+  }
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *cluster_connection;
+  Ndb *myNdb;
+  NdbDictionary::Dictionary* myDict;
+  const NdbDictionary::Table *myTable;
+  const NdbDictionary::Index *myIndex;
+  const NdbDictionary::Column *myColumn;
+  const NdbRecord *valsRecord, *indexRecord;
+};
+
+int TopNIndexScan::doTest(Uint32 limit, const char *country)
+{
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  // Step 2. Connecting to the cluster
+  cluster_connection = new Ndb_cluster_connection(connectstring);
+  if (cluster_connection->connect(4 /* retries               */,
+                                  5 /* delay between retries */,
+                                  1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (cluster_connection->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+
+  // Step 3. Connect to 'world' database
+  myNdb = new Ndb(cluster_connection, db);
+  if (myNdb->init()) {
+    print_error(myNdb->getNdbError(),
+                "Could not connect to the database object.");
+    return 3;
+  }
+
+  // Step 4. Get table metadata
+  myDict = myNdb->getDictionary();
+  if ((myTable = myDict->getTable("City")) == NULL ||
+      (myIndex = myDict->getIndex("Population", "City")) == NULL ||
+      (myColumn = myTable->getColumn("CountryCode")) == NULL) {
+    print_error(myDict->getNdbError(), "Could not retrieve metadata.");
+    return 4;
+  }
+
+  // Step 5. Define NdbRecord's
+  NdbDictionary::RecordSpecification recordSpec[5];
+  std::memset(recordSpec, 0, sizeof recordSpec);
+  int rsSize = sizeof(recordSpec[0]);
+
+  recordSpec[0].column = myTable->getColumn("ID");
+  recordSpec[0].offset = offsetof(struct CityRow, ID);
+  recordSpec[1].column = myTable->getColumn("Name");
+  recordSpec[1].offset = offsetof(struct CityRow, Name);
+  recordSpec[2].column = myTable->getColumn("CountryCode");
+  recordSpec[2].offset = offsetof(struct CityRow, CountryCode);
+  recordSpec[3].column = myTable->getColumn("District");
+  recordSpec[3].offset = offsetof(struct CityRow, District);
+  recordSpec[4].column = myTable->getColumn("Population");
+  recordSpec[4].offset = offsetof(struct CityRow, Population);
+
+  valsRecord = myDict->createRecord(myTable, recordSpec, 5, rsSize);
+  indexRecord = myDict->createRecord(myIndex, &recordSpec[4], 1, rsSize);
+  if (valsRecord == NULL || indexRecord == NULL) {
+    print_error(myDict->getNdbError(), "Failed to initialize NdbRecords'.");
+    return 5;
+  }
+
+  // Step 6. Run both variants and compare the work done
+  for (int variant = 0; variant < 2; variant++) {
+    std::vector<CityRow> rows;
+    Uint64 fetched0 = myNdb->getClientStat(Ndb::ReadRowCount);
+    Uint64 batches0 = myNdb->getClientStat(Ndb::ScanBatchCount);
+    Clock::time_point start = Clock::now();
+
+    int err = variant == 0 ? full_range(limit, country, rows)
+                           : top_n_merge(limit, country, rows);
+    if (err)
+      return err;
+
+    double ms = std::chrono::duration<double, std::milli>(
+                  Clock::now() - start).count();
+    report(variant == 0 ? "Full range scan" : "Top-N merge",
+           rows,
+           myNdb->getClientStat(Ndb::ReadRowCount) - fetched0,
+           myNdb->getClientStat(Ndb::ScanBatchCount) - batches0,
+           ms);
+  }
+  return 0;
+}
+
+int TopNIndexScan::define_filter(NdbInterpretedCode &code, const char *country)
+{
+  NdbScanFilter filter(&code);
+  if (filter.begin(NdbScanFilter::AND) < 0 ||
+      filter.cmp(NdbScanFilter::COND_EQ,
+                 myColumn->getColumnNo(), country, 3) < 0 ||
+      filter.end() < 0) {
+    print_error(filter.getNdbError(), "Failed to set a filter.");
+    return -1;
+  }
+  return 0;
+}
+
+int TopNIndexScan::top_n_merge(Uint32 limit, const char *country,
+                               std::vector<CityRow> &out)
+{
+  NdbInterpretedCode code(myTable);
+  if (define_filter(code, country))
+    return 6;
+
+  NdbTransaction *myTransaction = myNdb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(myNdb->getNdbError(), "Could not start transaction.");
+    return 7;
+  }
+
+  // Step 7. One descending scan per partition. A batch of `limit` rows per
+  // partition is enough to answer the query in a single round trip unless
+  // one partition holds most of the top rows.
+  Uint32 partitions = myTable->getPartitionCount();
+  std::vector<Stream> streams(partitions);
+  for (Uint32 part = 0; part < partitions; part++) {
+    NdbScanOperation::ScanOptions options;
+    options.optionsPresent =
+      NdbScanOperation::ScanOptions::SO_SCANFLAGS |
+      NdbScanOperation::ScanOptions::SO_PARTITION_ID |
+      NdbScanOperation::ScanOptions::SO_BATCH |
+      NdbScanOperation::ScanOptions::SO_INTERPRETED;
+    options.scan_flags =
+      NdbScanOperation::SF_OrderBy | NdbScanOperation::SF_Descending;
+    options.partitionId = part;
+    options.batch = limit;
+    options.interpretedCode = &code;
+
+    streams[part].current = NULL;
+    streams[part].op =
+      myTransaction->scanIndex(indexRecord,
+                               valsRecord,
+                               NdbOperation::LM_CommittedRead,
+                               NULL,
+                               NULL,   // whole index, highest first
+                               &options,
+                               sizeof(NdbScanOperation::ScanOptions));
+    if (streams[part].op == NULL) {
+      print_error(myTransaction->getNdbError(),
+                  "Could not retrieve an operation.");
+      myNdb->closeTransaction(myTransaction);
+      return 8;
+    }
+  }
+
+  // Step 8. Send all scans at once
+  if (myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    myNdb->closeTransaction(myTransaction);
+    return 9;
+  }
+
+  // Step 9. Merge. Each stream is advanced only after its head row has
+  // been copied out, so at most one batch per partition is buffered.
+  StreamLess less = { &streams };
+  std::priority_queue<size_t, std::vector<size_t>, StreamLess> heap(less);
+  int check = 0;
+  for (size_t i = 0; i < streams.size() && check != -1; i++) {
+    check = streams[i].op->nextResult((const char**) &streams[i].current,
+                                      true, false);
+    if (check == 0)
+      heap.push(i);
+  }
+
+  while (check != -1 && !heap.empty() && out.size() < limit) {
+    size_t i = heap.top();
+    heap.pop();
+    out.push_back(*streams[i].current);
+    if (out.size() == limit)
+      break;
+    check = streams[i].op->nextResult((const char**) &streams[i].current,
+                                      true, false);
+    if (check == 0)
+      heap.push(i);
+  }
+
+  if (check == -1) {
+    print_error(myTransaction->getNdbError(), "Error during index scan.");
+    myNdb->closeTransaction(myTransaction);
+    return 10;
+  }
+
+  // Step 10. Stop all partition scans on the data nodes right away
+  for (size_t i = 0; i < streams.size(); i++)
+    streams[i].op->close(false, true);
+  myNdb->closeTransaction(myTransaction);
+  return 0;
+}
+
+int TopNIndexScan::full_range(Uint32 limit, const char *country,
+                              std::vector<CityRow> &out)
+{
+  NdbInterpretedCode code(myTable);
+  if (define_filter(code, country))
+    return 11;
+
+  NdbTransaction *myTransaction = myNdb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(myNdb->getNdbError(), "Could not start transaction.");
+    return 12;
+  }
+
+  // Same as do_index_scan_read(): one ordered scan, default batch size
+  NdbScanOperation::ScanOptions options;
+  options.optionsPresent =
+    NdbScanOperation::ScanOptions::SO_SCANFLAGS |
+    NdbScanOperation::ScanOptions::SO_INTERPRETED;
+  options.scan_flags =
+    NdbScanOperation::SF_OrderBy | NdbScanOperation::SF_Descending;
+  options.interpretedCode = &code;
+
+  NdbIndexScanOperation *isop =
+    myTransaction->scanIndex(indexRecord,
+                             valsRecord,
+                             NdbOperation::LM_CommittedRead,
+                             NULL,
+                             NULL,
+                             &options,
+                             sizeof(NdbScanOperation::ScanOptions));
+  if (isop == NULL ||
+      myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    myNdb->closeTransaction(myTransaction);
+    return 13;
+  }
+
+  int check;
+  CityRow *row;
+  while ((check = isop->nextResult((const char**) &row, true, false)) == 0) {
+    if (out.size() < limit)
+      out.push_back(*row);
+  }
+
+  if (check == -1) {
+    print_error(myTransaction->getNdbError(), "Error during index scan.");
+    myNdb->closeTransaction(myTransaction);
+    return 14;
+  }
+  myNdb->closeTransaction(myTransaction);
+  return 0;
+}
+
+void TopNIndexScan::report(const char *label,
+                           const std::vector<CityRow> &rows,
+                           Uint64 fetched, Uint64 batches, double ms)
+{
+  std::cout << "========== " << label << " ==========" << std::endl;
+  for (size_t i = 0; i < rows.size(); i++) {
+    std::cout << "Id: " << rows[i].ID
+              << ", Name: " << char_to_str(rows[i].Name, 35)
+              << ", Population: " << rows[i].Population
+              << std::endl;
+  }
+  std::cout << "Rows returned: " << rows.size()
+            << ", rows fetched: " << fetched
+            << ", batches: " << batches
+            << ", time: " << ms << " ms" << std::endl;
+}
+
+TopNIndexScan::~TopNIndexScan()
+{
+  // Step 11. Cleanup
+  if (myNdb) delete myNdb;
+  if (cluster_connection) delete cluster_connection;
+  ndb_end(0);
+}
+
+int main(int argc, char *argv[])
+{
+  int limit = argc > 1 ? std::atoi(argv[1]) : 10;
+  const char *country = argc > 2 ? argv[2] : "JPN";
+  if (limit <= 0 || std::strlen(country) != 3) {
+    std::cerr << "Usage: " << argv[0] << " [N] [CountryCode]" << std::endl;
+    return 1;
+  }
+
+  TopNIndexScan ex;
+  return ex.doTest(limit, country);
+}
@@ -0,0 +1,548 @@
+// Batched lookups through a unique hash index.
+//
+// NdbApiExample3::do_scan_read() finds cities with a filtered table scan,
+// which visits every fragment of City no matter how few rows match. When
+// the attribute looked up is a unique key, a unique index read goes to
+// exactly one row, and many such reads can be defined in one transaction
+// and sent with a single execute().
+//
+// UniqueKeyLookup takes the key columns from the caller, looks for a
+// unique hash index over exactly those columns and reads a whole batch of
+// keys through it. If the table has no such index it falls back to one
+// filtered scan for the batch. The benchmark compares both paths for
+// batches of 1, 10 and 100 keys.
+//
+// Requires the unique key from city_unique_key.sql; without it every
+// lookup takes the scan path.
+//
+// Usage: unique_index_lookup [repetitions]
+#include <NdbApi.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stddef.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+const char *connectstring = "127.0.0.1:1186";
+const char *db = "world";
+
+typedef std::chrono::steady_clock Clock;
+
+struct CityRow {
+  Int32 ID;
+  char  Name[35];
+  char  CountryCode[3];
+  char  District[20];
+  Int32 Population;
+};
+
+// Reads rows of one table by a unique key. Key and result rows share the
+// layout described by `rowRecord`; the key columns are declared with their
+// offsets in that layout.
+class UniqueKeyLookup {
+public:
+  UniqueKeyLookup(Ndb *ndb, const NdbDictionary::Table *table,
+                  const NdbRecord *rowRecord, size_t rowSize)
+    : ndb(ndb), table(table), rowRecord(rowRecord), rowSize(rowSize),
+      index(NULL), keyRecord(NULL) {};
+
+  int declare_key(const char *column, Uint32 offset);
+  int prepare();
+  bool uses_index() const { return keyRecord != NULL; }
+  const char *index_name() const
+  {
+    return index ? index->getName() : "none";
+  }
+
+  // Looks up `count` keys. Row i of `keyRows` holds key i; the matching
+  // row is written to row i of `outRows` and found[i] is set accordingly.
+  int lookup(const char *keyRows, char *outRows, size_t count,
+             std::vector<bool> &found, bool forceScan = false);
+
+private:
+  struct KeyColumn {
+    const NdbDictionary::Column *column;
+    Uint32 offset;
+  };
+
+  int lookup_index(const char *keyRows, char *outRows, size_t count,
+                   std::vector<bool> &found);
+  int lookup_scan(const char *keyRows, char *outRows, size_t count,
+                  std::vector<bool> &found);
+  bool same_key(const char *a, const char *b) const;
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  // Operations defined per execute(); larger batches are split
+  static const size_t max_batch = 256;
+
+  Ndb *ndb;
+  const NdbDictionary::Table *table;
+  const NdbRecord *rowRecord;
+  size_t rowSize;
+  std::vector<KeyColumn> keys;
+  const NdbDictionary::Index *index;
+  const NdbRecord *keyRecord;
+};
+
+int UniqueKeyLookup::declare_key(const char *column, Uint32 offset)
+{
+  KeyColumn key;
+  key.column = table->getColumn(column);
+  key.offset = offset;
+  if (key.column == NULL) {
+    std::cerr << "No column " << column << " in "
+              << table->getName() << "." << std::endl;
+    return -1;
+  }
+  keys.push_back(key);
+  return 0;
+}
+
+// Picks a unique hash index covering exactly the declared columns, in any
+// order, and builds the key NdbRecord for it.
+int UniqueKeyLookup::prepare()
+{
+  NdbDictionary::Dictionary *dict = ndb->getDictionary();
+  NdbDictionary::Dictionary::List list;
+  if (keys.empty() || dict->listIndexes(list, table->getName()) != 0) {
+    print_error(dict->getNdbError(), "Could not list indexes.");
+    return -1;
+  }
+
+  for (unsigned i = 0; i < list.count && keyRecord == NULL; i++) {
+    if (list.elements[i].type != NdbDictionary::Object::UniqueHashIndex)
+      continue;
+    const NdbDictionary::Index *candidate =
+      dict->getIndex(list.elements[i].name, table->getName());
+    if (candidate == NULL || candidate->getNoOfColumns() != keys.size())
+      continue;
+
+    std::vector<NdbDictionary::RecordSpecification> spec(keys.size());
+    std::memset(&spec[0], 0, spec.size() * sizeof(spec[0]));
+    unsigned matched = 0;
+    for (unsigned c = 0; c < candidate->getNoOfColumns(); c++) {
+      const char *name = candidate->getColumn(c)->getName();
+      for (size_t k = 0; k < keys.size(); k++) {
+        if (std::strcmp(keys[k].column->getName(), name) == 0) {
+          spec[c].column = keys[k].column;
+          spec[c].offset = keys[k].offset;
+          matched++;
+          break;
+        }
+      }
+    }
+    if (matched != keys.size())
+      continue;
+
+    keyRecord = dict->createRecord(candidate, &spec[0], matched,
+                                   sizeof(spec[0]));
+    if (keyRecord == NULL) {
+      print_error(dict->getNdbError(), "Failed to create a key NdbRecord.");
+      return -1;
+    }
+    index = candidate;
+  }
+  return 0;
+}
+
+int UniqueKeyLookup::lookup(const char *keyRows, char *outRows,
+                            size_t count, std::vector<bool> &found,
+                            bool forceScan)
+{
+  found.assign(count, false);
+  if (count == 0)
+    return 0;
+  if (uses_index() && !forceScan)
+    return lookup_index(keyRows, outRows, count, found);
+  return lookup_scan(keyRows, outRows, count, found);
+}
+
+int UniqueKeyLookup::lookup_index(const char *keyRows, char *outRows,
+                                  size_t count, std::vector<bool> &found)
+{
+  NdbTransaction *myTransaction = ndb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(ndb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  // One round trip per max_batch keys. Missing keys must not abort the
+  // others, so errors are ignored here and checked per operation.
+  std::vector<const NdbOperation*> ops(count);
+  for (size_t first = 0; first < count; first += max_batch) {
+    size_t last = std::min(count, first + max_batch);
+    for (size_t i = first; i < last; i++) {
+      ops[i] = myTransaction->readTuple(keyRecord,
+                                        keyRows + i * rowSize,
+                                        rowRecord,
+                                        outRows + i * rowSize,
+                                        NdbOperation::LM_CommittedRead);
+      if (ops[i] == NULL) {
+        print_error(myTransaction->getNdbError(),
+                    "Could not define a unique index read.");
+        ndb->closeTransaction(myTransaction);
+        return -1;
+      }
+    }
+
+    NdbTransaction::ExecType type =
+      last == count ? NdbTransaction::Commit : NdbTransaction::NoCommit;
+    if (myTransaction->execute(type, NdbOperation::AO_IgnoreError) == -1 &&
+        myTransaction->getNdbError().classification != NdbError::NoDataFound) {
+      print_error(myTransaction->getNdbError(), "Transaction failed.");
+      ndb->closeTransaction(myTransaction);
+      return -1;
+    }
+
+    for (size_t i = first; i < last; i++) {
+      const NdbError &e = ops[i]->getNdbError();
+      if (e.code == 0) {
+        found[i] = true;
+      } else if (e.classification != NdbError::NoDataFound) {
+        print_error(e, "Unique index read failed.");
+        ndb->closeTransaction(myTransaction);
+        return -1;
+      }
+    }
+  }
+
+  ndb->closeTransaction(myTransaction);
+  return 0;
+}
+
+// Fallback: one table scan whose filter is the OR of all keys
+int UniqueKeyLookup::lookup_scan(const char *keyRows, char *outRows,
+                                 size_t count, std::vector<bool> &found)
+{
+  NdbInterpretedCode code(table);
+  NdbScanFilter filter(&code);
+  int res = filter.begin(NdbScanFilter::OR);
+  for (size_t i = 0; i < count && res == 0; i++) {
+    res = filter.begin(NdbScanFilter::AND);
+    for (size_t k = 0; k < keys.size() && res == 0; k++) {
+      res = filter.cmp(NdbScanFilter::COND_EQ,
+                       keys[k].column->getColumnNo(),
+                       keyRows + i * rowSize + keys[k].offset,
+                       keys[k].column->getSizeInBytes());
+    }
+    if (res == 0)
+      res = filter.end();
+  }
+  if (res < 0 || filter.end() < 0) {
+    print_error(filter.getNdbError(), "Failed to set a filter.");
+    return -1;
+  }
+
+  NdbTransaction *myTransaction = ndb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(ndb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  NdbScanOperation::ScanOptions options;
+  options.optionsPresent =
+    NdbScanOperation::ScanOptions::SO_SCANFLAGS |
+    NdbScanOperation::ScanOptions::SO_INTERPRETED;
+  options.scan_flags = NdbScanOperation::SF_TupScan;
+  options.interpretedCode = &code;
+
+  NdbScanOperation *sop =
+    myTransaction->scanTable(rowRecord,
+                             NdbOperation::LM_CommittedRead,
+                             NULL,
+                             &options,
+                             sizeof(NdbScanOperation::ScanOptions));
+  if (sop == NULL ||
+      myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    ndb->closeTransaction(myTransaction);
+    return -1;
+  }
+
+  int check;
+  const char *row;
+  while ((check = sop->nextResult(&row, true, false)) == 0) {
+    for (size_t i = 0; i < count; i++) {
+      if (!found[i] && same_key(keyRows + i * rowSize, row)) {
+        std::memcpy(outRows + i * rowSize, row, rowSize);
+        found[i] = true;
+      }
+    }
+  }
+
+  if (check == -1) {
+    print_error(myTransaction->getNdbError(), "Error during scan.");
+    ndb->closeTransaction(myTransaction);
+    return -1;
+  }
+  ndb->closeTransaction(myTransaction);
+  return 0;
+}
+
+bool UniqueKeyLookup::same_key(const char *a, const char *b) const
+{
+  for (size_t k = 0; k < keys.size(); k++) {
+    if (std::memcmp(a + keys[k].offset, b + keys[k].offset,
+                    keys[k].column->getSizeInBytes()) != 0)
+      return false;
+  }
+  return true;
+}
+
+class UniqueLookupBenchmark {
+public:
+  UniqueLookupBenchmark() : cluster_connection(NULL), myNdb(NULL),
+                            myDict(NULL), myTable(NULL) {};
+  ~UniqueLookupBenchmark();
+  int doTest(int repetitions);
+
+private:
+  int sample_keys(size_t count, std::vector<CityRow> &keys);
+  int show_lookup(UniqueKeyLookup &lookup);
+  int benchmark(UniqueKeyLookup &lookup, const std::vector<CityRow> &keys,
+                size_t batch, int repetitions, bool forceScan, double &ms);
+
+  std::string char_to_str(const char *s, int max_len)
+  {
+    std::string str(s, max_len);
+    return str.substr(0, str.find_last_not_of(" ") + 1);
+  }
+
+  void set_chars(char *dst, size_t len, const char *src)
+  {
+    std::memset(dst, ' ', len);
+    std::memcpy(dst, src, std::min(len, std::strlen(src)));
+  }
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *cluster_connection;
+  Ndb *myNdb;
+  NdbDictionary::Dictionary* myDict;
+  const NdbDictionary::Table *myTable;
+  const NdbRecord *valsRecord;
+};
+
+int UniqueLookupBenchmark::doTest(int repetitions)
+{
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  // Step 2. Connecting to the cluster
+  cluster_connection = new Ndb_cluster_connection(connectstring);
+  if (cluster_connection->connect(4 /* retries               */,
+                                  5 /* delay between retries */,
+                                  1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (cluster_connection->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+
+  // Step 3. Connect to 'world' database
+  myNdb = new Ndb(cluster_connection, db);
+  if (myNdb->init()) {
+    print_error(myNdb->getNdbError(),
+                "Could not connect to the database object.");
+    return 3;
+  }
+
+  // Step 4. Get table metadata
+  myDict = myNdb->getDictionary();
+  if ((myTable = myDict->getTable("City")) == NULL) {
+    print_error(myDict->getNdbError(), "Could not retrieve a table.");
+    return 4;
+  }
+
+  // Step 5. Define NdbRecord's
+  NdbDictionary::RecordSpecification recordSpec[5];
+  std::memset(recordSpec, 0, sizeof recordSpec);
+  int rsSize = sizeof(recordSpec[0]);
+
+  recordSpec[0].column = myTable->getColumn("ID");
+  recordSpec[0].offset = offsetof(struct CityRow, ID);
+  recordSpec[1].column = myTable->getColumn("Name");
+  recordSpec[1].offset = offsetof(struct CityRow, Name);
+  recordSpec[2].column = myTable->getColumn("CountryCode");
+  recordSpec[2].offset = offsetof(struct CityRow, CountryCode);
+  recordSpec[3].column = myTable->getColumn("District");
+  recordSpec[3].offset = offsetof(struct CityRow, District);
+  recordSpec[4].column = myTable->getColumn("Population");
+  recordSpec[4].offset = offsetof(struct CityRow, Population);
+
+  valsRecord = myDict->createRecord(myTable, recordSpec, 5, rsSize);
+  if (valsRecord == NULL) {
+    print_error(myDict->getNdbError(), "Failed to initialize NdbRecords'.");
+    return 5;
+  }
+
+  // Step 6. Declare the unique key and find an index for it
+  UniqueKeyLookup lookup(myNdb, myTable, valsRecord, sizeof(CityRow));
+  if (lookup.declare_key("Name", offsetof(struct CityRow, Name)) ||
+      lookup.declare_key("CountryCode",
+                         offsetof(struct CityRow, CountryCode)) ||
+      lookup.declare_key("District", offsetof(struct CityRow, District)) ||
+      lookup.prepare())
+    return 6;
+  std::cout << "Unique index: " << lookup.index_name() << std::endl;
+  if (!lookup.uses_index())
+    std::cout << "No unique index on (Name, CountryCode, District); "
+              << "lookups fall back to a table scan." << std::endl;
+
+  if (show_lookup(lookup))
+    return 7;
+
+  // Step 7. Benchmark both paths with keys of existing cities
+  std::vector<CityRow> keys;
+  if (sample_keys(100, keys))
+    return 8;
+
+  const size_t batches[] = { 1, 10, 100 };
+  std::cout << "========== Batch latency (ms) ==========" << std::endl;
+  for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+    size_t batch = std::min(batches[b], keys.size());
+    double indexMs = 0, scanMs = 0;
+    if (lookup.uses_index() &&
+        benchmark(lookup, keys, batch, repetitions, false, indexMs))
+      return 9;
+    if (benchmark(lookup, keys, batch, repetitions, true, scanMs))
+      return 9;
+
+    std::cout << "keys: " << batch
+              << ", unique index: ";
+    if (lookup.uses_index())
+      std::cout << indexMs;
+    else
+      std::cout << "n/a";
+    std::cout << ", filtered scan: " << scanMs << std::endl;
+  }
+  return 0;
+}
+
+// Looks up one existing and one missing city
+int UniqueLookupBenchmark::show_lookup(UniqueKeyLookup &lookup)
+{
+  CityRow keys[2];
+  std::memset(keys, 0, sizeof keys);
+  set_chars(keys[0].Name, sizeof(keys[0].Name), "Tokyo");
+  set_chars(keys[0].CountryCode, sizeof(keys[0].CountryCode), "JPN");
+  set_chars(keys[0].District, sizeof(keys[0].District), "Tokyo-to");
+  set_chars(keys[1].Name, sizeof(keys[1].Name), "Atlantis");
+  set_chars(keys[1].CountryCode, sizeof(keys[1].CountryCode), "GRC");
+  set_chars(keys[1].District, sizeof(keys[1].District), "Aegean");
+
+  CityRow rows[2];
+  std::vector<bool> found;
+  if (lookup.lookup((const char*) keys, (char*) rows, 2, found))
+    return -1;
+
+  std::cout << "========== Lookup test ==========" << std::endl;
+  for (int i = 0; i < 2; i++) {
+    std::cout << char_to_str(keys[i].Name, 35) << ", "
+              << char_to_str(keys[i].CountryCode, 3) << ", "
+              << char_to_str(keys[i].District, 20) << ": ";
+    if (found[i])
+      std::cout << "Id: " << rows[i].ID
+                << ", Population: " << rows[i].Population << std::endl;
+    else
+      std::cout << "not found" << std::endl;
+  }
+  return 0;
+}
+
+// Takes `count` cities spread evenly over one scan of City
+int UniqueLookupBenchmark::sample_keys(size_t count,
+                                       std::vector<CityRow> &keys)
+{
+  NdbTransaction *myTransaction = myNdb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(myNdb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  NdbScanOperation *sop =
+    myTransaction->scanTable(valsRecord, NdbOperation::LM_CommittedRead);
+  if (sop == NULL ||
+      myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    myNdb->closeTransaction(myTransaction);
+    return -1;
+  }
+
+  std::vector<CityRow> all;
+  int check;
+  const CityRow *row;
+  while ((check = sop->nextResult((const char**) &row, true, false)) == 0)
+    all.push_back(*row);
+  myNdb->closeTransaction(myTransaction);
+  if (check == -1 || all.empty()) {
+    std::cerr << "Could not read sample keys." << std::endl;
+    return -1;
+  }
+
+  size_t step = std::max<size_t>(1, all.size() / count);
+  for (size_t i = 0; i < all.size() && keys.size() < count; i += step)
+    keys.push_back(all[i]);
+  return 0;
+}
+
+// Average time of one lookup() of `batch` keys
+int UniqueLookupBenchmark::benchmark(UniqueKeyLookup &lookup,
+                                     const std::vector<CityRow> &keys,
+                                     size_t batch, int repetitions,
+                                     bool forceScan, double &ms)
+{
+  std::vector<CityRow> rows(batch);
+  std::vector<bool> found;
+  Clock::time_point start = Clock::now();
+  for (int r = 0; r < repetitions; r++) {
+    if (lookup.lookup((const char*) &keys[0], (char*) &rows[0], batch,
+                      found, forceScan))
+      return -1;
+    for (size_t i = 0; i < batch; i++) {
+      if (!found[i]) {
+        std::cerr << "Key " << keys[i].ID << " was not found." << std::endl;
+        return -1;
+      }
+    }
+  }
+  ms = std::chrono::duration<double, std::milli>(
+         Clock::now() - start).count() / repetitions;
+  return 0;
+}
+
+UniqueLookupBenchmark::~UniqueLookupBenchmark()
+{
+  // Step 8. Cleanup
+  if (myNdb) delete myNdb;
+  if (cluster_connection) delete cluster_connection;
+  ndb_end(0);
+}
+
+int main(int argc, char *argv[])
+{
+  int repetitions = argc > 1 ? std::atoi(argv[1]) : 20;
+  if (repetitions <= 0) {
+    std::cerr << "Usage: " << argv[0] << " [repetitions]" << std::endl;
+    return 1;
+  }
+
+  UniqueLookupBenchmark ex;
+  return ex.doTest(repetitions);
+}
@@ -0,0 +1,610 @@
+// Cross-thread coalescing of single-row writes.
+//
+// Every write in the samples goes out in a transaction of its own, for
+// example the CountryCode rewrite of do_scan_update in
+// scan_tuples_record.cc. When many threads each write one row at a time,
+// every row costs a transaction, a commit and a send of its own, and the
+// data nodes receive a flood of small requests.
+//
+// WriteCoalescer accepts single-row write intents from any thread and
+// returns a future for each. Dispatcher threads each own an Ndb. A
+// dispatcher collects intents until it has max_batch of them or the
+// oldest one has waited max_delay, then writes all of them in one
+// transaction with one execute(Commit). The transaction runs with
+// AO_IgnoreError, so a failing row does not abort the other rows in the
+// batch. Once the transaction has committed, each caller's future gets
+// the result of its own operation. A temporary error of the whole
+// transaction makes the dispatcher send the batch again; an unknown
+// result is passed on to every caller in the batch as it is. Rows of
+// one batch commit together, so a caller must not rely on its write
+// being isolated from the others.
+//
+// A batch defines its operations in primary key order, and intents for
+// the same row and columns are merged into one operation that writes the
+// latest row. Concurrent batches therefore take their row locks in the
+// same order and do not deadlock on each other. They can still conflict:
+// a batch waits for any other transaction holding one of its rows, and a
+// transaction outside the coalescer may take the locks in another order
+// and deadlock with it. Such a batch fails with a lock timeout (266)
+// after TransactionDeadlockDetectionTimeout and is sent again; these
+// retries are counted apart from the others.
+//
+// The benchmark rewrites CountryCode of random City rows, unchanged so
+// the table stays as it was. It uses N threads, first with one commit per
+// row and then through the coalescer. It reports throughput, latency and
+// the number of transactions. Under the stand-in library, set
+// NDB_STANDIN_REQUEST_US and NDB_STANDIN_OP_US to give the data nodes a
+// cost per request and per row. Coalescing pays off when the data nodes
+// are the bottleneck. While they have capacity to spare, the window only
+// adds latency.
+//
+// Usage: write_coalescer [threads] [writes per thread] [max batch]
+//                        [max delay us]
+#include <NdbApi.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <stddef.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+const char *connectstring = "127.0.0.1:1186";
+const char *db = "world";
+
+typedef std::chrono::steady_clock Clock;
+
+struct CityRow {
+  Int32 ID;
+  char  Name[35];
+  char  CountryCode[3];
+  char  District[20];
+  Int32 Population;
+};
+
+class WriteCoalescer {
+public:
+  WriteCoalescer(Ndb_cluster_connection *conn, const char *database,
+                 size_t maxBatch, int maxDelayUs)
+    : transactions(0), writes(0), retries(0), lockRetries(0), conn(conn),
+      database(database), maxBatch(maxBatch),
+      maxDelay(std::chrono::microseconds(maxDelayUs)), stopping(false) {}
+  ~WriteCoalescer();
+
+  // Starts the dispatchers, each with an Ndb of its own
+  int start(int dispatchers);
+  void stop();
+
+  // Updates the row of `table` with the key in `row`. The NdbRecords
+  // must stay valid until the future is ready; the row is copied.
+  std::future<NdbError> update(const NdbDictionary::Table *table,
+                               const NdbRecord *keyRecord,
+                               const NdbRecord *attrRecord,
+                               const char *row, size_t rowSize);
+
+  std::atomic<Uint64> transactions, writes;
+  // Batches sent again after a lock timeout, and after any other
+  // temporary error
+  std::atomic<Uint64> retries, lockRetries;
+
+private:
+  struct Intent {
+    const NdbRecord *keyRecord, *attrRecord;
+    std::string key;           // table name and key bytes, for ordering
+    std::string row;
+    Clock::time_point enqueued;
+    std::promise<NdbError> result;
+  };
+
+  void dispatch(Ndb *ndb);
+  bool next_batch(std::vector<Intent*> &batch);
+  void execute_batch(Ndb *ndb, std::vector<Intent*> &batch);
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *conn;
+  std::string database;
+  size_t maxBatch;
+  Clock::duration maxDelay;
+
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<Intent*> queue;
+  bool stopping;
+  std::vector<std::thread> threads;
+  std::vector<Ndb*> ndbs;
+};
+
+WriteCoalescer::~WriteCoalescer()
+{
+  stop();
+  for (size_t i = 0; i < ndbs.size(); i++)
+    delete ndbs[i];
+}
+
+int WriteCoalescer::start(int dispatchers)
+{
+  for (int i = 0; i < dispatchers; i++) {
+    Ndb *ndb = new Ndb(conn, database.c_str());
+    ndbs.push_back(ndb);
+    if (ndb->init()) {
+      print_error(ndb->getNdbError(),
+                  "Could not connect to the database object.");
+      return -1;
+    }
+  }
+  for (int i = 0; i < dispatchers; i++)
+    threads.push_back(std::thread(&WriteCoalescer::dispatch, this, ndbs[i]));
+  return 0;
+}
+
+// Intents already queued are still written
+void WriteCoalescer::stop()
+{
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    stopping = true;
+  }
+  ready.notify_all();
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+  threads.clear();
+}
+
+std::future<NdbError>
+WriteCoalescer::update(const NdbDictionary::Table *table,
+                       const NdbRecord *keyRecord,
+                       const NdbRecord *attrRecord,
+                       const char *row, size_t rowSize)
+{
+  Intent *intent = new Intent;
+  intent->keyRecord = keyRecord;
+  intent->attrRecord = attrRecord;
+  intent->row.assign(row, rowSize);
+
+  // Any total order on the keys will do, as long as every batch uses it
+  intent->key.assign(table->getName());
+  intent->key.push_back('\0');
+  Uint32 attrId, offset;
+  for (bool more = NdbDictionary::getFirstAttrId(keyRecord, attrId); more;
+       more = NdbDictionary::getNextAttrId(keyRecord, attrId)) {
+    NdbDictionary::getOffset(keyRecord, attrId, offset);
+    intent->key.append(row + offset,
+                       table->getColumn((int) attrId)->getSizeInBytes());
+  }
+  intent->enqueued = Clock::now();
+  std::future<NdbError> f = intent->result.get_future();
+
+  size_t queued;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    queue.push_back(intent);
+    queued = queue.size();
+  }
+  // The first intent opens a window; a full batch closes it early
+  if (queued == 1)
+    ready.notify_one();
+  else if (queued == maxBatch)
+    ready.notify_all();
+  return f;
+}
+
+// Waits for intents and takes up to maxBatch of them once there are that
+// many or the oldest has waited maxDelay. False when stopped and drained.
+bool WriteCoalescer::next_batch(std::vector<Intent*> &batch)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    ready.wait(lock, [this] { return !queue.empty() || stopping; });
+    if (queue.empty())
+      return false;
+
+    Clock::time_point deadline = queue.front()->enqueued + maxDelay;
+    while (!queue.empty() && queue.size() < maxBatch && !stopping &&
+           Clock::now() < deadline)
+      ready.wait_until(lock, deadline);
+    // Another dispatcher may have taken them meanwhile
+    if (queue.empty())
+      continue;
+
+    size_t n = std::min(queue.size(), maxBatch);
+    batch.assign(queue.begin(), queue.begin() + n);
+    queue.erase(queue.begin(), queue.begin() + n);
+    if (!queue.empty())
+      ready.notify_one();
+    return true;
+  }
+}
+
+void WriteCoalescer::dispatch(Ndb *ndb)
+{
+  std::vector<Intent*> batch;
+  while (next_batch(batch)) {
+    execute_batch(ndb, batch);
+    for (size_t i = 0; i < batch.size(); i++)
+      delete batch[i];
+    batch.clear();
+  }
+}
+
+void WriteCoalescer::execute_batch(Ndb *ndb, std::vector<Intent*> &batch)
+{
+  // Lock rows in key order, so that batches do not deadlock on each other
+  std::stable_sort(batch.begin(), batch.end(),
+                   [](const Intent *a, const Intent *b)
+                   { return a->key < b->key; });
+
+  // Intents for the same row and columns share the operation of the last
+  // of them, which carries the latest row
+  std::vector<size_t> opOf(batch.size());
+  for (size_t i = batch.size(); i-- > 0; ) {
+    const Intent *in = batch[i];
+    const Intent *next = i + 1 < batch.size() ? batch[i + 1] : NULL;
+    opOf[i] = next != NULL && next->key == in->key &&
+              next->keyRecord == in->keyRecord &&
+              next->attrRecord == in->attrRecord ? opOf[i + 1] : i;
+  }
+
+  NdbError error;
+  for (int attempt = 0; attempt < 3; attempt++) {
+    NdbTransaction *myTransaction = ndb->startTransaction();
+    if (myTransaction == NULL) {
+      error = ndb->getNdbError();
+      if (error.status == NdbError::TemporaryError)
+        continue;
+      break;
+    }
+
+    std::vector<const NdbOperation*> ops(batch.size());
+    bool defined = true;
+    for (size_t i = 0; i < batch.size() && defined; i++) {
+      if (opOf[i] != i)
+        continue;
+      Intent *in = batch[i];
+      ops[i] = myTransaction->updateTuple(in->keyRecord, in->row.data(),
+                                          in->attrRecord, in->row.data());
+      defined = ops[i] != NULL;
+    }
+    for (size_t i = 0; i < batch.size() && defined; i++)
+      ops[i] = ops[opOf[i]];
+    if (!defined) {
+      error = myTransaction->getNdbError();
+      ndb->closeTransaction(myTransaction);
+      break;
+    }
+
+    // One round trip for all rows; failed rows do not abort the others
+    myTransaction->execute(NdbTransaction::Commit,
+                           NdbOperation::AO_IgnoreError);
+    transactions++;
+
+    // Per-row results only count once the transaction has committed. A
+    // row without an error in an aborted transaction was rolled back
+    // with the rest.
+    if (myTransaction->commitStatus() == NdbTransaction::Committed) {
+      for (size_t i = 0; i < batch.size(); i++)
+        batch[i]->result.set_value(ops[i]->getNdbError());
+      writes += batch.size();
+      ndb->closeTransaction(myTransaction);
+      return;
+    }
+
+    // The transaction as a whole failed. Only a temporary error says
+    // nothing was written; after an unknown result the batch may have
+    // committed, and sending it again is left to the callers.
+    error = myTransaction->getNdbError();
+    ndb->closeTransaction(myTransaction);
+    if (error.status != NdbError::TemporaryError)
+      break;
+    if (error.classification == NdbError::TimeoutExpired)
+      lockRetries++;
+    else
+      retries++;
+  }
+
+  for (size_t i = 0; i < batch.size(); i++)
+    batch[i]->result.set_value(error);
+}
+
+class CoalescingExample {
+public:
+  CoalescingExample() : cluster_connection(NULL), myNdb(NULL),
+                        myDict(NULL), myTable(NULL) {};
+  ~CoalescingExample();
+  int doTest(int threads, int writes, size_t maxBatch, int maxDelayUs);
+
+private:
+  struct Result {
+    double secs;
+    std::vector<double> latencies;
+    Uint64 failed;
+  };
+
+  int load_rows();
+  // One commit per row when `coalescer` is NULL
+  int run(WriteCoalescer *coalescer, int threads, int writes,
+          Result &result);
+  void writer(int thread, int writes, WriteCoalescer *coalescer,
+              std::vector<double> &latencies, std::atomic<Uint64> &failed);
+  int commit_row(Ndb *ndb, const CityRow &row, NdbError &error);
+  void report(const char *label, Result &r, Uint64 transactions);
+
+  void print_error(const NdbError &e, const char *msg)
+  {
+    std::cerr << msg << ": Error code (" << e.code << "): "
+              << e.message << "." << std::endl;
+  }
+
+  Ndb_cluster_connection *cluster_connection;
+  Ndb *myNdb;
+  NdbDictionary::Dictionary* myDict;
+  const NdbDictionary::Table *myTable;
+  const NdbRecord *pkRecord, *codeRecord, *valsRecord;
+  std::vector<CityRow> rows;           // ID and CountryCode of every city
+  std::atomic<Uint64> rowCommits;
+};
+
+int CoalescingExample::doTest(int threads, int writes, size_t maxBatch,
+                              int maxDelayUs)
+{
+  // Step 1. Initialize NDB API
+  ndb_init();
+
+  // Step 2. Connecting to the cluster
+  cluster_connection = new Ndb_cluster_connection(connectstring);
+  if (cluster_connection->connect(4 /* retries               */,
+                                  5 /* delay between retries */,
+                                  1 /* verbose               */)) {
+    std::cerr << "Could not connect to MGMD." << std::endl;
+    return 1;
+  }
+
+  if (cluster_connection->wait_until_ready(30, 0) < 0) {
+    std::cerr << "Could not connect to NDBD." << std::endl;
+    return 2;
+  }
+
+  // Step 3. Connect to 'world' database
+  myNdb = new Ndb(cluster_connection, db);
+  if (myNdb->init()) {
+    print_error(myNdb->getNdbError(),
+                "Could not connect to the database object.");
+    return 3;
+  }
+
+  // Step 4. Get table metadata
+  myDict = myNdb->getDictionary();
+  if ((myTable = myDict->getTable("City")) == NULL) {
+    print_error(myDict->getNdbError(), "Could not retrieve a table.");
+    return 4;
+  }
+
+  // Step 5. Define NdbRecord's: the key, the column written, and the row
+  NdbDictionary::RecordSpecification recordSpec[5];
+  std::memset(recordSpec, 0, sizeof recordSpec);
+  int rsSize = sizeof(recordSpec[0]);
+
+  recordSpec[0].column = myTable->getColumn("ID");
+  recordSpec[0].offset = offsetof(struct CityRow, ID);
+  recordSpec[1].column = myTable->getColumn("CountryCode");
+  recordSpec[1].offset = offsetof(struct CityRow, CountryCode);
+  recordSpec[2].column = myTable->getColumn("Name");
+  recordSpec[2].offset = offsetof(struct CityRow, Name);
+  recordSpec[3].column = myTable->getColumn("District");
+  recordSpec[3].offset = offsetof(struct CityRow, District);
+  recordSpec[4].column = myTable->getColumn("Population");
+  recordSpec[4].offset = offsetof(struct CityRow, Population);
+
+  pkRecord = myDict->createRecord(myTable, recordSpec, 1, rsSize);
+  codeRecord = myDict->createRecord(myTable, &recordSpec[1], 1, rsSize);
+  valsRecord = myDict->createRecord(myTable, recordSpec, 5, rsSize);
+  if (pkRecord == NULL || codeRecord == NULL || valsRecord == NULL) {
+    print_error(myDict->getNdbError(), "Failed to initialize NdbRecords'.");
+    return 5;
+  }
+
+  // Step 6. Compare one commit per row with coalesced writes
+  if (load_rows())
+    return 6;
+  std::cout << "========== " << threads << " threads x " << writes
+            << " City writes, batches of up to " << maxBatch << " within "
+            << maxDelayUs << " us ==========" << std::endl;
+
+  Result perRow, coalesced;
+  rowCommits = 0;
+  if (run(NULL, threads, writes, perRow))
+    return 7;
+  report("per-row commits", perRow, rowCommits);
+
+  Uint64 transactions = 0, retries = 0, lockRetries = 0;
+  {
+    WriteCoalescer coalescer(cluster_connection, db, maxBatch, maxDelayUs);
+    if (coalescer.start(4 /* dispatchers */))
+      return 8;
+    if (run(&coalescer, threads, writes, coalesced))
+      return 8;
+    coalescer.stop();
+    transactions = coalescer.transactions;
+    retries = coalescer.retries;
+    lockRetries = coalescer.lockRetries;
+  }
+  report("coalesced      ", coalesced, transactions);
+  std::cout << "  rows per transaction " << std::fixed
+            << std::setprecision(1)
+            << (double) threads * writes / transactions
+            << ", batches retried after lock timeouts " << lockRetries
+            << ", after other temporary errors " << retries << std::endl;
+  return 0;
+}
+
+int CoalescingExample::load_rows()
+{
+  NdbTransaction *myTransaction = myNdb->startTransaction();
+  if (myTransaction == NULL) {
+    print_error(myNdb->getNdbError(), "Could not start transaction.");
+    return -1;
+  }
+
+  NdbScanOperation *sop =
+    myTransaction->scanTable(valsRecord, NdbOperation::LM_CommittedRead);
+  if (sop == NULL ||
+      myTransaction->execute( NdbTransaction::NoCommit ) == -1) {
+    print_error(myTransaction->getNdbError(), "Failed to prepare a scan.");
+    myNdb->closeTransaction(myTransaction);
+    return -1;
+  }
+
+  int check;
+  const CityRow *row;
+  while ((check = sop->nextResult((const char**) &row, true, false)) == 0)
+    rows.push_back(*row);
+  myNdb->closeTransaction(myTransaction);
+  if (check == -1 || rows.empty()) {
+    std::cerr << "Could not read City." << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+int CoalescingExample::run(WriteCoalescer *coalescer, int threads,
+                           int writes, Result &result)
+{
+  std::vector<std::vector<double> > latencies(threads);
+  std::atomic<Uint64> failed(0);
+  Clock::time_point start = Clock::now();
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; i++)
+    workers.push_back(std::thread(&CoalescingExample::writer, this, i,
+                                  writes, coalescer, std::ref(latencies[i]),
+                                  std::ref(failed)));
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+
+  result.secs = std::chrono::duration<double>(Clock::now() - start).count();
+  result.latencies.clear();
+  for (int i = 0; i < threads; i++)
+    result.latencies.insert(result.latencies.end(), latencies[i].begin(),
+                            latencies[i].end());
+  result.failed = failed;
+  return result.failed ? -1 : 0;
+}
+
+// Writes CountryCode of random cities back unchanged, one row at a time
+void CoalescingExample::writer(int thread, int writes,
+                               WriteCoalescer *coalescer,
+                               std::vector<double> &latencies,
+                               std::atomic<Uint64> &failed)
+{
+  Ndb *ndb = NULL;
+  if (coalescer == NULL) {
+    ndb = new Ndb(cluster_connection, db);
+    if (ndb->init()) {
+      print_error(ndb->getNdbError(),
+                  "Could not connect to the database object.");
+      failed += writes;
+      delete ndb;
+      return;
+    }
+  }
+
+  std::mt19937 rng(thread + 1);
+  latencies.reserve(writes);
+  for (int i = 0; i < writes; i++) {
+    const CityRow &row = rows[rng() % rows.size()];
+    Clock::time_point start = Clock::now();
+    NdbError error;
+    if (coalescer != NULL)
+      error = coalescer->update(myTable, pkRecord, codeRecord,
+                                (const char*) &row, sizeof row).get();
+    else
+      commit_row(ndb, row, error);
+    if (error.code != 0) {
+      print_error(error, error.status == NdbError::UnknownResult ?
+                  "Write result unknown." : "Write failed.");
+      failed++;
+      continue;
+    }
+    latencies.push_back(std::chrono::duration<double, std::micro>(
+                          Clock::now() - start).count());
+  }
+  delete ndb;
+}
+
+// One transaction and one execute(Commit) per row, as in the samples
+int CoalescingExample::commit_row(Ndb *ndb, const CityRow &row,
+                                  NdbError &error)
+{
+  NdbTransaction *myTransaction =
+    ndb->startTransaction(myTable, (const char*) &row.ID, sizeof(row.ID));
+  if (myTransaction == NULL) {
+    error = ndb->getNdbError();
+    return -1;
+  }
+
+  const NdbOperation *op =
+    myTransaction->updateTuple(pkRecord, (const char*) &row,
+                               codeRecord, (const char*) &row);
+  if (op == NULL ||
+      myTransaction->execute( NdbTransaction::Commit ) == -1) {
+    error = myTransaction->getNdbError();
+    ndb->closeTransaction(myTransaction);
+    return -1;
+  }
+  rowCommits++;
+  ndb->closeTransaction(myTransaction);
+  return 0;
+}
+
+void CoalescingExample::report(const char *label, Result &r,
+                               Uint64 transactions)
+{
+  std::vector<double> &v = r.latencies;
+  double sum = 0;
+  for (size_t i = 0; i < v.size(); i++)
+    sum += v[i];
+  std::sort(v.begin(), v.end());
+  size_t n = v.size();
+  std::cout << label << ": " << std::fixed << std::setprecision(0)
+            << n / r.secs << " writes/s, avg " << sum / n
+            << " us, p50 " << v[n / 2] << ", p99 " << v[n * 99 / 100]
+            << " us, " << transactions << " transactions" << std::endl;
+}
+
+CoalescingExample::~CoalescingExample()
+{
+  // Step 7. Cleanup
+  if (myNdb) delete myNdb;
+  if (cluster_connection) delete cluster_connection;
+  ndb_end(0);
+}
+
+int main(int argc, char *argv[])
+{
+  int threads = argc > 1 ? std::atoi(argv[1]) : 32;
+  int writes = argc > 2 ? std::atoi(argv[2]) : 1000;
+  int maxBatch = argc > 3 ? std::atoi(argv[3]) : 32;
+  int maxDelayUs = argc > 4 ? std::atoi(argv[4]) : 100;
+  if (threads <= 0 || writes <= 0 || maxBatch <= 0 || maxDelayUs < 0) {
+    std::cerr << "Usage: write_coalescer [threads] [writes per thread] "
+              << "[max batch] [max delay us]" << std::endl;
+    return 1;
+  }
+
+  CoalescingExample ex;
+  return ex.doTest(threads, writes, maxBatch, maxDelayUs);
+}